@@ -0,0 +1,755 @@
+#ifndef DSPCORE_H
+#define DSPCORE_H
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+
+/*
+ * Numeric core shared by the batch and streaming HR pipelines.
+ *
+ * DSP_FIXED_POINT selects the arithmetic at build time:
+ *   1 — integer path for the FPU-less ESP32-C3 (default). Samples are int32
+ *       Q12 (IR counts × 4096), biquads are Direct Form I with Q30
+ *       coefficients, 64-bit accumulators and first-order error feedback.
+ *       Statistics use exact integer sums and isqrt64().
+ *   0 — single-precision float, software-emulated on the C3.
+ *
+ * Headroom: samples enter the filter with the DC level already removed, so
+ * even a full-scale 18-bit swing (2^18 × 2^12 = 2^30) fits in int32. No
+ * cascade stage has more than ~1.1x gain once the numerators are rebalanced
+ * (see dspLoadSOS()).
+ */
+#ifndef DSP_FIXED_POINT
+#define DSP_FIXED_POINT 1
+#endif
+
+#define DSP_FRAC_BITS 12      // sample format Q12
+#define DSP_COEF_FRAC_BITS 30 // coefficient format Q30 (|c| < 2)
+#define DSP_STAT_SHIFT 8      // variance computed on Q4 to keep squares in 64 bits
+#define DSP_MAX_SECTIONS 4
+
+#if DSP_FIXED_POINT
+typedef int32_t dsp_sample_t;
+#define DSP_SAMPLE_MAX INT32_MAX
+#else
+typedef float dsp_sample_t;
+#define DSP_SAMPLE_MAX FLT_MAX
+#endif
+
+static inline dsp_sample_t dspFromCounts(int32_t counts)
+{
+#if DSP_FIXED_POINT
+   return counts * (1 << DSP_FRAC_BITS);
+#else
+   return (float)counts;
+#endif
+}
+
+// For logging only.
+static inline float dspToCounts(dsp_sample_t v)
+{
+#if DSP_FIXED_POINT
+   return (float)v / (float)(1 << DSP_FRAC_BITS);
+#else
+   return v;
+#endif
+}
+
+// Floor square root of a 64-bit value (digit-by-digit, no division).
+static inline uint32_t isqrt64(uint64_t v)
+{
+   uint64_t res = 0;
+   uint64_t bit = 1ULL << 62;
+   while (bit > v)
+      bit >>= 2;
+   while (bit != 0)
+   {
+      if (v >= res + bit)
+      {
+         v -= res + bit;
+         res = (res >> 1) + bit;
+      }
+      else
+      {
+         res >>= 1;
+      }
+      bit >>= 2;
+   }
+   return (uint32_t)res;
+}
+
+// ---------------------------------------------------------------------------
+// Biquad sections
+// ---------------------------------------------------------------------------
+
+struct DspBiquad
+{
+#if DSP_FIXED_POINT
+   int32_t b0, b1, b2, a1, a2; // Q30
+#else
+   float b0, b1, b2, a1, a2;
+#endif
+};
+
+struct DspBiquadState
+{
+#if DSP_FIXED_POINT
+   int32_t x1, x2, y1, y2;
+   int32_t err; // accumulator bits dropped by the last output shift
+#else
+   float z1, z2;
+#endif
+};
+
+static inline void dspBiquadReset(DspBiquadState &st)
+{
+#if DSP_FIXED_POINT
+   st.x1 = st.x2 = st.y1 = st.y2 = 0;
+   st.err = 0;
+#else
+   st.z1 = st.z2 = 0.0f;
+#endif
+}
+
+static inline dsp_sample_t dspBiquadStep(const DspBiquad &c, DspBiquadState &st, dsp_sample_t x)
+{
+#if DSP_FIXED_POINT
+   // Direct Form I; the remainder of the previous shift is fed back so the
+   // truncation noise is pushed away from DC, where the poles sit.
+   int64_t acc = (int64_t)c.b0 * x + (int64_t)c.b1 * st.x1 + (int64_t)c.b2 * st.x2 -
+                 (int64_t)c.a1 * st.y1 - (int64_t)c.a2 * st.y2 + st.err;
+   int32_t y = (int32_t)(acc >> DSP_COEF_FRAC_BITS);
+   st.err = (int32_t)(acc - ((int64_t)y << DSP_COEF_FRAC_BITS));
+   st.x2 = st.x1;
+   st.x1 = x;
+   st.y2 = st.y1;
+   st.y1 = y;
+   return y;
+#else
+   // Direct Form II Transposed
+   float y = c.b0 * x + st.z1;
+   st.z1 = c.b1 * x - c.a1 * y + st.z2;
+   st.z2 = c.b2 * x - c.a2 * y;
+   return y;
+#endif
+}
+
+// Put a section into the steady state it would reach under a constant input
+// x (scipy's lfilter_zi scaled by x) and return the constant output, which
+// is the steady input of the next section.
+static inline dsp_sample_t dspBiquadSteadyState(const DspBiquad &c, DspBiquadState &st, dsp_sample_t x)
+{
+#if DSP_FIXED_POINT
+   int64_t sumB = (int64_t)c.b0 + c.b1 + c.b2;
+   int64_t sumA = (1LL << DSP_COEF_FRAC_BITS) + c.a1 + c.a2;
+   int32_t y = (int32_t)(((int64_t)x * sumB) / sumA);
+   st.x1 = st.x2 = x;
+   st.y1 = st.y2 = y;
+   st.err = 0;
+   return y;
+#else
+   float y = x * (c.b0 + c.b1 + c.b2) / (1.0f + c.a1 + c.a2);
+   st.z1 = y - c.b0 * x;
+   st.z2 = c.b2 * x - c.a2 * y;
+   return y;
+#endif
+}
+
+// Vertex of the parabola through the samples around a local maximum, as an
+// offset from the middle sample in units of `unit` (256 for Q8 sample
+// positions, or the sample spacing in µs). Within ±unit/2.
+static inline int32_t dspParabolicPeakOffset(dsp_sample_t ym1, dsp_sample_t y0, dsp_sample_t yp1, int32_t unit)
+{
+#if DSP_FIXED_POINT
+   int64_t den = 2 * ((int64_t)ym1 - 2 * (int64_t)y0 + yp1);
+   if (den >= 0)
+      return 0;
+   int64_t off = ((int64_t)ym1 - yp1) * unit / den;
+#else
+   float den = 2.0f * (ym1 - 2.0f * y0 + yp1);
+   if (den >= 0.0f)
+      return 0;
+   int32_t off = (int32_t)((ym1 - yp1) * (float)unit / den);
+#endif
+   if (off > unit / 2)
+      off = unit / 2;
+   if (off < -unit / 2)
+      off = -unit / 2;
+   return (int32_t)off;
+}
+
+#if DSP_FIXED_POINT
+static inline int32_t dspToQ30(float v)
+{
+   return (int32_t)lroundf(v * (float)(1L << DSP_COEF_FRAC_BITS));
+}
+
+// Peak magnitude of the first `sections` biquads, sampled on a log grid of
+// 40 frequencies from Nyquist down to ~1e-6 × fs.
+static float dspCascadePeakGain(const float (*sos)[6], uint8_t sections)
+{
+   float peak = 0.0f;
+   for (uint8_t k = 0; k < 40; k++)
+   {
+      float w = (float)M_PI * powf(2.0f, -0.5f * k);
+      float c1 = cosf(w), s1 = sinf(w), c2 = cosf(2.0f * w), s2 = sinf(2.0f * w);
+      float mag = 1.0f;
+      for (uint8_t s = 0; s < sections; s++)
+      {
+         float nr = sos[s][0] + sos[s][1] * c1 + sos[s][2] * c2;
+         float ni = -sos[s][1] * s1 - sos[s][2] * s2;
+         float dr = 1.0f + sos[s][4] * c1 + sos[s][5] * c2;
+         float di = -sos[s][4] * s1 - sos[s][5] * s2;
+         mag *= sqrtf((nr * nr + ni * ni) / (dr * dr + di * di));
+      }
+      if (mag > peak)
+         peak = mag;
+   }
+   return peak;
+}
+#endif
+
+// Convert a float SOS table (b0 b1 b2 a0 a1 a2 per row, a0 == 1) into the
+// active number format. In fixed point the overall gain is redistributed in
+// powers of two so each intermediate output peaks near unity: scipy puts the
+// whole gain (~1e-6) into the first section, which would otherwise leave
+// that section's output with only a few significant bits.
+static void dspLoadSOS(const float (*sos)[6], uint8_t sections, DspBiquad *out)
+{
+#if DSP_FIXED_POINT
+   int prevExp = 0;
+   for (uint8_t s = 0; s < sections; s++)
+   {
+      int exp = 0;
+      if (s + 1 < sections)
+      {
+         float g = dspCascadePeakGain(sos, s + 1);
+         exp = (g > 0.0f) ? -(int)floorf(log2f(g) + 0.5f) : 0;
+      }
+      float scale = ldexpf(1.0f, exp - prevExp);
+      out[s].b0 = dspToQ30(sos[s][0] * scale);
+      out[s].b1 = dspToQ30(sos[s][1] * scale);
+      out[s].b2 = dspToQ30(sos[s][2] * scale);
+      out[s].a1 = dspToQ30(sos[s][4]);
+      out[s].a2 = dspToQ30(sos[s][5]);
+      prevExp = exp;
+   }
+#else
+   for (uint8_t s = 0; s < sections; s++)
+   {
+      out[s].b0 = sos[s][0];
+      out[s].b1 = sos[s][1];
+      out[s].b2 = sos[s][2];
+      out[s].a1 = sos[s][4];
+      out[s].a2 = sos[s][5];
+   }
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Decimation
+// ---------------------------------------------------------------------------
+
+// Second-order CIC decimator (two integrators, decimate, two combs) on raw
+// sensor counts, ahead of the bandpass. Multiplier-free; the wrap-around of
+// the uint32 integrators is exact as long as the output fits, which holds for
+// 18-bit counts and factors up to 64. The first sample is subtracted as an
+// anchor so the sections start in steady state. factor must be a power of
+// two; 1 passes samples straight through. Group delay is factor - 1 input
+// samples, constant, so it drops out of RR intervals.
+class CicDecimator
+{
+   uint8_t factor;
+   uint8_t shift; // log2(factor^2): CIC gain
+   uint8_t phase;
+   bool anchored;
+   int32_t anchor;
+   uint32_t integ1, integ2, comb1, comb2;
+
+public:
+   explicit CicDecimator(uint8_t decimation) : factor(decimation), shift(0)
+   {
+      while ((1u << shift) < (uint32_t)factor * factor)
+         shift++;
+      reset();
+   }
+
+   void reset()
+   {
+      phase = 0;
+      anchored = false;
+      anchor = 0;
+      integ1 = integ2 = comb1 = comb2 = 0;
+   }
+
+   // Feed one input sample; returns true when a decimated sample is in out.
+   bool push(int32_t x, int32_t &out)
+   {
+      if (!anchored)
+      {
+         anchor = x;
+         anchored = true;
+      }
+      integ1 += (uint32_t)(x - anchor);
+      integ2 += integ1;
+      if (++phase < factor)
+         return false;
+      phase = 0;
+      uint32_t c1 = integ2 - comb1;
+      comb1 = integ2;
+      uint32_t c2 = c1 - comb2;
+      comb2 = c1;
+      int32_t y = (int32_t)c2;
+      out = anchor + (shift ? (y + (1 << (shift - 1))) >> shift : y);
+      return true;
+   }
+};
+
+// ---------------------------------------------------------------------------
+// Block statistics
+// ---------------------------------------------------------------------------
+
+static dsp_sample_t dspMean(const dsp_sample_t *x, int n)
+{
+#if DSP_FIXED_POINT
+   int64_t sum = 0;
+   for (int i = 0; i < n; i++)
+      sum += x[i];
+   return (dsp_sample_t)(sum / n);
+#else
+   float sum = 0;
+   for (int i = 0; i < n; i++)
+      sum += x[i];
+   return sum / n;
+#endif
+}
+
+static dsp_sample_t dspStdDev(const dsp_sample_t *x, int n, dsp_sample_t mean)
+{
+#if DSP_FIXED_POINT
+   uint64_t sumSq = 0;
+   for (int i = 0; i < n; i++)
+   {
+      int32_t d = (x[i] - mean) >> DSP_STAT_SHIFT;
+      sumSq += (uint64_t)((int64_t)d * d);
+   }
+   return (dsp_sample_t)isqrt64(sumSq / n) << DSP_STAT_SHIFT;
+#else
+   float variance = 0;
+   for (int i = 0; i < n; i++)
+   {
+      float diff = x[i] - mean;
+      variance += diff * diff;
+   }
+   return sqrtf(variance / n);
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// RR tachogram: corrected intervals with their beat times, for the spectral
+// HRV analysis (HRVSpectrum.h). Bounded; intervals beyond the capacity are
+// not recorded.
+// ---------------------------------------------------------------------------
+#define RR_TACHOGRAM_MAX 192 // 58 s at MAX_BPM
+
+class RRTachogram
+{
+   uint32_t beatUs[RR_TACHOGRAM_MAX]; // end of each interval, from the first beat
+   uint32_t rrUs[RR_TACHOGRAM_MAX];
+   uint16_t n;
+   uint32_t clockUs;
+
+public:
+   RRTachogram() { reset(); }
+
+   void reset()
+   {
+      n = 0;
+      clockUs = 0;
+   }
+
+   void add(uint32_t intervalUs)
+   {
+      clockUs += intervalUs;
+      if (n >= RR_TACHOGRAM_MAX)
+         return;
+      beatUs[n] = clockUs;
+      rrUs[n] = intervalUs;
+      n++;
+   }
+
+   // Time covered by intervals that were dropped rather than recorded.
+   void skip(uint32_t intervalUs) { clockUs += intervalUs; }
+
+   // Keep only the intervals for which keep(beat time, interval) is true;
+   // the beat times of the others do not change.
+   template <typename Pred>
+   void retain(Pred keep)
+   {
+      uint16_t kept = 0;
+      for (uint16_t i = 0; i < n; i++)
+      {
+         if (!keep(beatUs[i], rrUs[i]))
+            continue;
+         beatUs[kept] = beatUs[i];
+         rrUs[kept] = rrUs[i];
+         kept++;
+      }
+      n = kept;
+   }
+
+   uint16_t count() const { return n; }
+   uint32_t beatTimeUs(uint16_t i) const { return beatUs[i]; }
+   uint32_t intervalUs(uint16_t i) const { return rrUs[i]; }
+};
+
+// ---------------------------------------------------------------------------
+// RR interval statistics, one interval at a time: mean and SDRR plus the
+// successive-difference metrics (RMSSD, pNN50, Poincaré SD1/SD2). O(1) memory.
+// ---------------------------------------------------------------------------
+#define RR_NN50_US 50000 // pNN50 threshold on |RR[i+1] - RR[i]|
+
+class RRStats
+{
+   uint16_t n;
+   uint16_t nDiff;  // successive differences (fewer than n - 1 after gap())
+   uint16_t nn50;   // successive differences above RR_NN50_US
+   bool haveLast;
+   uint32_t lastUs; // previous interval, for the successive difference
+   RRTachogram *tachogram; // optional, records the corrected series
+#if DSP_FIXED_POINT
+   // Exact integer sums; RR < 2^21 µs, so sumSq stays below 2^51 for any
+   // realistic session and n * sumSq below 2^60.
+   uint64_t sum;
+   uint64_t sumSq;
+   int64_t sumDiff;
+   uint64_t sumSqDiff;
+
+   // Population variances in µs²
+   uint64_t varUs2() const { return (n * sumSq - sum * sum) / ((uint64_t)n * n); }
+   uint64_t diffVarUs2() const
+   {
+      uint64_t m = nDiff;
+      return (m * sumSqDiff - (uint64_t)(sumDiff * sumDiff)) / (m * m);
+   }
+#else
+   float mean; // Welford running mean/M2 in ms
+   float m2;
+   float diffMean; // Welford over the successive differences
+   float diffM2;
+#endif
+
+public:
+   RRStats() : tachogram(nullptr) { reset(); }
+
+   // Also record every interval (and gap) into t; reset() clears it too.
+   void attach(RRTachogram *t) { tachogram = t; }
+
+   void reset()
+   {
+      if (tachogram)
+         tachogram->reset();
+      n = nDiff = nn50 = 0;
+      haveLast = false;
+      lastUs = 0;
+#if DSP_FIXED_POINT
+      sum = sumSq = sumSqDiff = 0;
+      sumDiff = 0;
+#else
+      mean = m2 = diffMean = diffM2 = 0.0f;
+#endif
+   }
+
+   void add(uint32_t rrUs)
+   {
+      if (tachogram)
+         tachogram->add(rrUs);
+      n++;
+      if (haveLast)
+      {
+         int32_t diffUs = (int32_t)(rrUs - lastUs);
+         nDiff++;
+         if (diffUs > RR_NN50_US || diffUs < -RR_NN50_US)
+            nn50++;
+#if DSP_FIXED_POINT
+         sumDiff += diffUs;
+         sumSqDiff += (uint64_t)((int64_t)diffUs * diffUs);
+#else
+         float d = (float)diffUs / 1000.0f - diffMean;
+         diffMean += d / nDiff;
+         diffM2 += d * ((float)diffUs / 1000.0f - diffMean);
+#endif
+      }
+      haveLast = true;
+      lastUs = rrUs;
+#if DSP_FIXED_POINT
+      sum += rrUs;
+      sumSq += (uint64_t)rrUs * rrUs;
+#else
+      float rr = (float)rrUs / 1000.0f;
+      float d = rr - mean;
+      mean += d / n;
+      m2 += d * (rr - mean);
+#endif
+   }
+
+   // The next interval does not follow the last one (skippedUs of beats were
+   // dropped in between), so no successive difference is taken across the gap.
+   void gap(uint32_t skippedUs)
+   {
+      haveLast = false;
+      if (tachogram)
+         tachogram->skip(skippedUs);
+   }
+
+   uint16_t count() const { return n; }
+
+   uint32_t meanUs() const
+   {
+      if (n == 0)
+         return 0;
+#if DSP_FIXED_POINT
+      return (uint32_t)(sum / n);
+#else
+      return (uint32_t)(mean * 1000.0f);
+#endif
+   }
+
+   // Population standard deviation of the RR intervals (µs).
+   uint32_t sdrrUs() const
+   {
+      if (n == 0)
+         return 0;
+#if DSP_FIXED_POINT
+      return isqrt64(varUs2());
+#else
+      return (uint32_t)(sqrtf(m2 / n) * 1000.0f);
+#endif
+   }
+
+   // Root mean square of successive differences (µs).
+   uint32_t rmssdUs() const
+   {
+      if (nDiff == 0)
+         return 0;
+#if DSP_FIXED_POINT
+      return isqrt64(sumSqDiff / nDiff);
+#else
+      return (uint32_t)(sqrtf(diffM2 / nDiff + diffMean * diffMean) * 1000.0f);
+#endif
+   }
+
+   // Share of successive differences above 50 ms, in percent (rounded).
+   uint8_t pnn50Pct() const
+   {
+      if (nDiff == 0)
+         return 0;
+      return (uint8_t)((nn50 * 200U + nDiff) / (2U * nDiff));
+   }
+
+   // Poincaré descriptors: SD1² = var(ΔRR)/2 (short-term, across the
+   // identity line), SD2² = 2·SDRR² - SD1² (long-term, along it).
+   uint32_t sd1Us() const
+   {
+      if (nDiff == 0)
+         return 0;
+#if DSP_FIXED_POINT
+      return isqrt64(diffVarUs2() / 2);
+#else
+      return (uint32_t)(sqrtf(diffM2 / nDiff / 2.0f) * 1000.0f);
+#endif
+   }
+
+   uint32_t sd2Us() const
+   {
+      if (nDiff == 0)
+         return 0;
+#if DSP_FIXED_POINT
+      uint64_t twoVar = 2 * varUs2();
+      uint64_t sd1Sq = diffVarUs2() / 2;
+      return twoVar > sd1Sq ? isqrt64(twoVar - sd1Sq) : 0;
+#else
+      float sd2Sq = 2.0f * m2 / n - diffM2 / nDiff / 2.0f;
+      return sd2Sq > 0.0f ? (uint32_t)(sqrtf(sd2Sq) * 1000.0f) : 0;
+#endif
+   }
+
+   // 95% confidence half-widths (z = 1.96, normal approximation) of the mean
+   // RR, sd/sqrt(n), and of SDRR, sd/sqrt(2(n-1)). Integer only.
+   uint32_t meanCiUs() const
+   {
+      if (n < 2)
+         return UINT32_MAX;
+      return (uint32_t)((uint64_t)sdrrUs() * 1960 / isqrt64((uint64_t)n * 1000000ULL));
+   }
+
+   uint32_t sdrrCiUs() const
+   {
+      if (n < 2)
+         return UINT32_MAX;
+      return (uint32_t)((uint64_t)sdrrUs() * 1960 / isqrt64(2ULL * (n - 1) * 1000000ULL));
+   }
+};
+
+// ---------------------------------------------------------------------------
+// RR artifact correction between peak detection and RRStats.
+//
+// Each interval is compared with the median of the last RR_ARTIFACT_WINDOW raw
+// intervals (tolerance RR_ARTIFACT_TOL_PCT of the median):
+//   - within tolerance                  -> passed on
+//   - ~2x or ~3x the median (missed)    -> split into equal intervals
+//   - short, next one completes it      -> merged (extra peak on the pulse)
+//   - short, next one compensates to 2x -> ectopic beat, both dropped
+//   - anything else                     -> dropped
+// Short intervals are held for one beat to look at their successor. The
+// first RR_ARTIFACT_BOOT intervals are buffered until their median is
+// available, so a bad first beat cannot seed the reference. Dropped intervals
+// mark a gap in RRStats so no successive difference spans them.
+// ---------------------------------------------------------------------------
+#ifndef RR_ARTIFACT_CORRECTION
+#define RR_ARTIFACT_CORRECTION 1
+#endif
+#define RR_ARTIFACT_WINDOW 9  // raw intervals in the running median
+#define RR_ARTIFACT_BOOT 5    // intervals buffered before the first decision
+#define RR_ARTIFACT_TOL_PCT 25 // Kubios 'medium' (0.25 s at 60 BPM)
+
+class RRArtifactFilter
+{
+   uint32_t window[RR_ARTIFACT_WINDOW]; // ring of raw intervals
+   uint8_t head;
+   uint8_t filled;
+   bool booted;
+   bool haveShort;
+   uint32_t shortUs; // short interval waiting for its successor
+   uint16_t corrected; // beats inserted (missed) or removed (split)
+   uint16_t rejected;  // ectopic or unclassifiable beats dropped
+
+   uint32_t median() const
+   {
+      uint32_t sorted[RR_ARTIFACT_WINDOW];
+      for (uint8_t i = 0; i < filled; i++)
+      {
+         uint32_t v = window[i];
+         int8_t j = i - 1;
+         for (; j >= 0 && sorted[j] > v; j--)
+            sorted[j + 1] = sorted[j];
+         sorted[j + 1] = v;
+      }
+      return sorted[filled / 2];
+   }
+
+   static bool near(uint32_t v, uint32_t target, uint32_t tol)
+   {
+      return (v > target ? v - target : target - v) <= tol;
+   }
+
+   void drop(RRStats &out, uint32_t skippedUs)
+   {
+      rejected++;
+      out.gap(skippedUs);
+   }
+
+   void classify(uint32_t rrUs, RRStats &out)
+   {
+      uint32_t m = median();
+      uint32_t tol = m * RR_ARTIFACT_TOL_PCT / 100;
+
+      if (haveShort)
+      {
+         haveShort = false;
+         uint32_t sum = shortUs + rrUs;
+         if (near(sum, m, tol))
+         {
+            out.add(sum); // split beat
+            corrected++;
+            return;
+         }
+         if (near(sum, 2 * m, tol) && rrUs > m)
+         {
+            drop(out, sum); // premature beat + compensatory pause
+            return;
+         }
+         drop(out, shortUs);
+      }
+
+      if (near(rrUs, m, tol))
+      {
+         out.add(rrUs);
+      }
+      else if (rrUs < m)
+      {
+         haveShort = true;
+         shortUs = rrUs;
+      }
+      else
+      {
+         uint32_t k = (rrUs + m / 2) / m;
+         if (k >= 2 && k <= 3 && near(rrUs, k * m, tol))
+         {
+            for (uint32_t i = 0; i < k; i++)
+               out.add(rrUs / k); // missed beat(s), interpolated
+            corrected += k - 1;
+         }
+         else
+         {
+            drop(out, rrUs);
+         }
+      }
+   }
+
+   // Classify the buffered intervals against their own median.
+   void endBoot(RRStats &out)
+   {
+      booted = true;
+      for (uint8_t i = 0; i < filled; i++)
+         classify(window[i], out);
+   }
+
+public:
+   RRArtifactFilter() { reset(); }
+
+   void reset()
+   {
+      head = filled = 0;
+      booted = haveShort = false;
+      shortUs = 0;
+      corrected = rejected = 0;
+   }
+
+   // Feed one raw interval; corrected intervals go to out.
+   void push(uint32_t rrUs, RRStats &out)
+   {
+#if RR_ARTIFACT_CORRECTION
+      window[head] = rrUs;
+      head = (head + 1) % RR_ARTIFACT_WINDOW;
+      if (filled < RR_ARTIFACT_WINDOW)
+         filled++;
+
+      if (booted)
+         classify(rrUs, out);
+      else if (filled == RR_ARTIFACT_BOOT)
+         endBoot(out);
+#else
+      out.add(rrUs);
+#endif
+   }
+
+   // Decide buffered boot intervals and a held short one at the end of the
+   // session.
+   void finish(RRStats &out)
+   {
+      if (!booted)
+         endBoot(out);
+      if (haveShort)
+      {
+         haveShort = false;
+         drop(out, shortUs);
+      }
+   }
+
+   uint16_t correctedBeats() const { return corrected; }
+   uint16_t rejectedBeats() const { return rejected; }
+};
+
+#endif // DSPCORE_H
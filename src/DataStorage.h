@@ -1,200 +1,500 @@
 #ifndef DATASTORAGE_H
 #define DATASTORAGE_H
 
-#include <Preferences.h>
+#include <Arduino.h>
+#include <esp_rom_crc.h>
+#include <esp_sleep.h>
+#include <nvs.h>
+#include "HistoryLog.h"
 
 /*
- * TieredHRStorage — three-tier circular ring buffer stored in NVS.
+ * TieredHRStorage — three-tier circular ring buffer over an append-only log.
  *
- * T1 (5-min resolution, 24 h):  288 samples for HR and HRV
- * T2 (30-min resolution, 7 d):  336 samples for HR and HRV
- * T3 (2-h resolution,  30 d):  360 samples for HR and HRV
+ * T1 (5-min resolution, 24 h):  288 samples for HR, HRV and respiration
+ * T2 (30-min resolution, 7 d):  336 samples for HR, HRV and respiration
+ * T3 (2-h resolution,  30 d):  360 samples for HR, HRV and respiration
  *
  * Promotion: every 6 T1 entries the mean is pushed to T2;
  *            every 4 T2 entries the mean is pushed to T3.
  *
- * Total NVS footprint: 1 608 bytes of blob data + 13 small keys
- * well within the default 24 KB NVS partition.
+ * Every sample is appended to the "history" partition as one 16-byte record
+ * (HistoryLog.h); T1 is the last 288 records of that log. T2/T3 are derived
+ * from it and checkpointed in NVS at each promotion: the dirty
+ * HIST_CHUNK_BYTES chunks of the T2/T3 series under "<key>.<n>", then
+ * "hckpt" naming the newest log record they contain, then one nvs_commit().
+ *
+ * begin() redoes the promotions of the records after the checkpoint. A
+ * promotion is a pure function of the T1 records, so redoing one that
+ * already reached some chunks writes the same bytes again: no undo record
+ * is needed, whatever point a reset cut the checkpoint off at.
+ *
+ * The T1 ring is cached in RTC memory (histT1) behind a CRC. A timer wake
+ * whose cache matches the log tail skips reading the log; otherwise T1 is
+ * rebuilt from the last 288 records (4.6 KB of reads).
+ *
+ * History in the NVS-only layout of older firmware ("hidx", T1 chunks or
+ * single blobs, per-key indices) is migrated on the first begin(): its T1
+ * ring is appended to the log, T2/T3 are checkpointed, the old keys removed.
+ *
+ * Flash writes are behind RAM: addSample() only updates the tiers and counts
+ * the sample as pending. A persistence pass, run by a background job,
+ * copies what is pending under the caller's lock (preparePersist()), writes
+ * it without the lock (writePersist()) and settles the result under the
+ * lock again (finishPersist()). A checkpoint goes out only in the pass that
+ * appends the last pending record, so it never names records the log lacks.
+ *
+ * Readers take no lock. The tiers are guarded by a seqlock: a writer makes
+ * 'version' odd for the length of an update, including its promotions, and
+ * getLastN() and friends copy, then retry if the version moved. A graph
+ * never waits on flash and never sees a half-promoted tier.
+ *
+ * NVS footprint: 2 088 bytes of T2/T3 data in 36 chunks + "hckpt", about
+ * 5 KB of NVS entries. Without the partition T1 survives deep sleep only.
  */
+
+#define HIST_CHUNK_BYTES 64 // 4 NVS entries per chunk with its headers
+#ifndef HIST_RTC_T1
+#define HIST_RTC_T1 1 // 0: rebuild T1 from the log at every wake
+#endif
+#define HIST_T1_SIZE 288
+#define HIST_PERSIST_BATCH 24 // log records appended per persistence pass
+
+// "hckpt": T2/T3 ring state as of a log record
+struct HistCheckpoint
+{
+   uint32_t logSeq;   // newest log record folded into T2/T3
+   uint32_t firstSeq; // oldest log record belonging to T1 (clear() moves it)
+   uint16_t t2Idx, t2Count, t3Idx, t3Count;
+   uint8_t t1PromoCount, t2PromoCount; // as of logSeq
+};
+
+// "hidx" and "hundo" of older firmware, read by the migration only
+struct HistIndex
+{
+   uint32_t seq;
+   uint16_t t1Idx, t1Count, t2Idx, t2Count, t3Idx, t3Count;
+   uint8_t t1PromoCount, t2PromoCount;
+};
+
+struct HistUndo
+{
+   uint32_t seq;
+   uint16_t t1Pos;
+   uint8_t t1Slots;
+   uint8_t tiers;
+   uint16_t pos[2];
+   uint8_t t1Old[6][4];
+   uint8_t old[2][3];
+};
+
+// T1 ring, kept across deep sleep
+struct HistT1
+{
+   uint32_t crc;      // over the rest of the struct
+   uint32_t logSeq;   // newest log record in the ring
+   uint32_t firstSeq; // checkpoint's firstSeq the ring was built with
+   uint16_t idx, count;
+   uint8_t promoCount; // used only without the log partition
+   uint8_t hr[HIST_T1_SIZE], hrv[HIST_T1_SIZE], resp[HIST_T1_SIZE], sleep[HIST_T1_SIZE];
+};
+
+#if HIST_RTC_T1
+RTC_DATA_ATTR HistT1 histT1;
+#else
+HistT1 histT1;
+#endif
+
 class TieredHRStorage
 {
 public:
-   static constexpr uint16_t T1_SIZE = 288; // 5-min, 24 h
+   static constexpr uint16_t T1_SIZE = HIST_T1_SIZE; // 5-min, 24 h
    static constexpr uint16_t T2_SIZE = 336; // 30-min, 7 d
-   static constexpr uint16_t T3_SIZE = 360; // 2-h, 30 d (HR and HRV)
+   static constexpr uint16_t T3_SIZE = 360; // 2-h, 30 d (HR, HRV, respiration)
 
 private:
-   Preferences prefs;
+   // One persisted array with a dirty bit per chunk
+   struct Series
+   {
+      const char *key;
+      uint8_t *data;
+      uint16_t size;
+      uint16_t dirty;
+   };
+   // T1 series are only read (and removed) by the migration
+   static constexpr uint8_t S_T1HR = 0, S_T1HRV = 1, S_T1RESP = 2, S_T1SLEEP = 3;
+   static constexpr uint8_t S_T2HR = 4, S_T2HRV = 5, S_T2RESP = 6;
+   static constexpr uint8_t S_T3HR = 7, S_T3HRV = 8, S_T3RESP = 9;
+   static constexpr uint8_t SERIES_COUNT = 10;
+
+   nvs_handle_t nvs;
    bool initialized;
+#ifdef ESP_PLATFORM
+   PartitionLogFlash partition;
+#endif
+   HistoryLog sampleLog;
+   bool logReady;
+   uint32_t firstSeq; // see HistCheckpoint
+   Series series[SERIES_COUNT];
 
-   // T1 (5-min, 24 h)
-   uint8_t t1HR[T1_SIZE];
-   uint8_t t1HRV[T1_SIZE];
-   uint8_t t1Sleep[T1_SIZE]; // 0=awake, 1=asleep, parallel to t1HR
-   uint16_t t1Idx;           // next write position
-   uint16_t t1Count;         // valid entries (max T1_SIZE)
-   uint8_t t1PromoCount;     // T1 entries since last T2 promotion (0-5)
+   // T1 (5-min, 24 h), in histT1
+   uint8_t (&t1HR)[T1_SIZE];
+   uint8_t (&t1HRV)[T1_SIZE];
+   uint8_t (&t1Resp)[T1_SIZE];  // breaths/min, 0=no reading
+   uint8_t (&t1Sleep)[T1_SIZE]; // 0=awake, 1=asleep, parallel to t1HR
+   uint16_t &t1Idx;             // next write position
+   uint16_t &t1Count;           // valid entries (max T1_SIZE)
+   uint8_t &t1PromoCount;       // T1 entries since last T2 promotion (0-5)
 
    // T2 (30-min, 7 d)
    uint8_t t2HR[T2_SIZE];
    uint8_t t2HRV[T2_SIZE];
+   uint8_t t2Resp[T2_SIZE];
    uint16_t t2Idx;
    uint16_t t2Count;
    uint8_t t2PromoCount; // T2 entries since last T3 promotion (0-3)
 
-   // T3 (2-h, 30 d, HR and HRV)
+   // T3 (2-h, 30 d, HR, HRV and respiration)
    uint8_t t3HR[T3_SIZE];
    uint8_t t3HRV[T3_SIZE];
+   uint8_t t3Resp[T3_SIZE];
    uint16_t t3Idx;
    uint16_t t3Count;
 
+   uint32_t bytesWritten; // NVS payload bytes since begin()
+
+   // Write-behind state; changed under the caller's lock
+   uint16_t pending; // newest T1 samples not yet in the log
+   bool ckptPending; // T2/T3 changed since the last checkpoint
+   bool jobBusy;     // preparePersist() handed out a job, finishPersist() pending
+   bool clearBusy;   // clear() ran while that job was out
+   uint32_t version; // seqlock, odd while the tiers change
+
+   // One persistence pass, copied out by preparePersist()
+   struct PersistJob
+   {
+      uint8_t rec[HIST_PERSIST_BATCH][4]; // HR, HRV, respiration, sleep
+      uint16_t records, appended;
+      bool ckpt;
+      HistCheckpoint ck;
+      uint16_t dirty[SERIES_COUNT];
+      uint8_t data[SERIES_COUNT - S_T2HR][T3_SIZE]; // T2/T3 series
+   } job;
+
 public:
    TieredHRStorage()
-       : initialized(false),
-         t1Idx(0), t1Count(0), t1PromoCount(0),
+       : nvs(0), initialized(false), logReady(false), firstSeq(1),
+         t1HR(histT1.hr), t1HRV(histT1.hrv), t1Resp(histT1.resp), t1Sleep(histT1.sleep),
+         t1Idx(histT1.idx), t1Count(histT1.count), t1PromoCount(histT1.promoCount),
          t2Idx(0), t2Count(0), t2PromoCount(0),
-         t3Idx(0), t3Count(0)
+         t3Idx(0), t3Count(0),
+         bytesWritten(0), pending(0), ckptPending(false), jobBusy(false), clearBusy(false), version(0)
    {
-      memset(t1HR, 0, T1_SIZE);
-      memset(t1HRV, 0, T1_SIZE);
+      // T1 is left alone: it may hold the ring cached before deep sleep
       memset(t2HR, 0, T2_SIZE);
       memset(t2HRV, 0, T2_SIZE);
+      memset(t2Resp, 0, T2_SIZE);
       memset(t3HR, 0, T3_SIZE);
       memset(t3HRV, 0, T3_SIZE);
+      memset(t3Resp, 0, T3_SIZE);
+      series[S_T1HR] = {"hr5m", t1HR, T1_SIZE, 0};
+      series[S_T1HRV] = {"hrv5m", t1HRV, T1_SIZE, 0};
+      series[S_T1RESP] = {"rsp5m", t1Resp, T1_SIZE, 0};
+      series[S_T1SLEEP] = {"slp5m", t1Sleep, T1_SIZE, 0};
+      series[S_T2HR] = {"hr30m", t2HR, T2_SIZE, 0};
+      series[S_T2HRV] = {"hrv30m", t2HRV, T2_SIZE, 0};
+      series[S_T2RESP] = {"rsp30m", t2Resp, T2_SIZE, 0};
+      series[S_T3HR] = {"hr2h", t3HR, T3_SIZE, 0};
+      series[S_T3HRV] = {"hrv2h", t3HRV, T3_SIZE, 0};
+      series[S_T3RESP] = {"rsp2h", t3Resp, T3_SIZE, 0};
    }
 
-   bool begin()
+   // logFlash: flash behind the sample log; nullptr = the "history" partition.
+   bool begin(LogFlash *logFlash = nullptr)
    {
-      if (!prefs.begin("trakk", false))
+      if (nvs_open("trakk", NVS_READWRITE, &nvs) != ESP_OK)
       {
          Serial.println("ERROR: Failed to open NVS namespace 'trakk'");
          return false;
       }
+#ifdef ESP_PLATFORM
+      if (logFlash == nullptr && partition.begin())
+         logFlash = &partition;
+#endif
+      logReady = logFlash != nullptr && sampleLog.begin(*logFlash);
+      if (!logReady)
+         Serial.println("ERROR: No 'history' partition, T1 kept in RTC memory only");
+      uint32_t last = sampleLog.lastSeq();
 
-      // Load T1
-      bool t1OK = (prefs.getBytes("hr5m", t1HR, T1_SIZE) == T1_SIZE &&
-                   prefs.getBytes("hrv5m", t1HRV, T1_SIZE) == T1_SIZE);
-      prefs.getBytes("slp5m", t1Sleep, T1_SIZE); // tolerate absence (first boot)
-      t1Idx = prefs.getUShort("t1idx", 0);
-      t1Count = prefs.getUShort("t1cnt", 0);
-      t1PromoCount = prefs.getUChar("t1prom", 0);
-
-      // Load T2
-      bool t2OK = (prefs.getBytes("hr30m", t2HR, T2_SIZE) == T2_SIZE &&
-                   prefs.getBytes("hrv30m", t2HRV, T2_SIZE) == T2_SIZE);
-      t2Idx = prefs.getUShort("t2idx", 0);
-      t2Count = prefs.getUShort("t2cnt", 0);
-      t2PromoCount = prefs.getUChar("t2prom", 0);
-
-      // Load T3
-      bool t3OK = (prefs.getBytes("hr2h", t3HR, T3_SIZE) == T3_SIZE &&
-                   prefs.getBytes("hrv2h", t3HRV, T3_SIZE) == T3_SIZE);
-      t3Idx = prefs.getUShort("t3idx", 0);
-      t3Count = prefs.getUShort("t3cnt", 0);
+      bool migrated = false;
+      bool t2OK = true, t3OK = true;
+      HistCheckpoint ck;
+      if (getBlob("hckpt", &ck, sizeof(ck)))
+      {
+         t2OK = loadSeries(series[S_T2HR]);
+         t2OK = loadSeries(series[S_T2HRV]) && t2OK;
+         loadSeries(series[S_T2RESP]);
+         t3OK = loadSeries(series[S_T3HR]);
+         t3OK = loadSeries(series[S_T3HRV]) && t3OK;
+         loadSeries(series[S_T3RESP]);
+         t2Idx = ck.t2Idx;
+         t2Count = ck.t2Count;
+         t2PromoCount = ck.t2PromoCount;
+         t3Idx = ck.t3Idx;
+         t3Count = ck.t3Count;
+         firstSeq = ck.firstSeq;
+         if (logReady && (ck.logSeq > last || ck.firstSeq > ck.logSeq + 1))
+         {
+            // Log erased or replaced: keep T2/T3, start T1 over
+            Serial.println("TieredHRStorage: log does not match the checkpoint, T1 restarts");
+            firstSeq = last + 1;
+            ck.logSeq = last;
+            ck.t1PromoCount = 0;
+            ckptPending = true;
+         }
+         loadT1(ck);
+         if (logReady)
+            ckptPending = replay(ck) || ckptPending;
+      }
+      else if (migrateOld())
+      {
+         migrated = true;
+         ckptPending = true;
+      }
+      else
+      {
+         firstSeq = last + 1;
+         memset(&ck, 0, sizeof(ck));
+         loadT1(ck);
+         touchTier(2); // the checkpoint must not precede its chunks
+         touchTier(3);
+         ckptPending = true;
+      }
 
       // Validate; reset corrupted tiers
-      if (!t1OK || t1Idx >= T1_SIZE || t1Count > T1_SIZE)
+      if (t1Idx >= T1_SIZE || t1Count > T1_SIZE || t1PromoCount >= 6)
       {
          Serial.println("Initializing T1 (5-min) buffer");
          memset(t1HR, 0, T1_SIZE);
          memset(t1HRV, 0, T1_SIZE);
+         memset(t1Resp, 0, T1_SIZE);
          memset(t1Sleep, 0, T1_SIZE);
          t1Idx = 0;
          t1Count = 0;
          t1PromoCount = 0;
+         firstSeq = last + 1;
+         ckptPending = true;
       }
-      if (!t2OK || t2Idx >= T2_SIZE || t2Count > T2_SIZE)
+      if (!t2OK || t2Idx >= T2_SIZE || t2Count > T2_SIZE || t2PromoCount >= 4)
       {
          Serial.println("Initializing T2 (30-min) buffer");
          memset(t2HR, 0, T2_SIZE);
          memset(t2HRV, 0, T2_SIZE);
+         memset(t2Resp, 0, T2_SIZE);
          t2Idx = 0;
          t2Count = 0;
          t2PromoCount = 0;
+         touchTier(2); // overwrite whatever chunks are left
+         ckptPending = true;
       }
       if (!t3OK || t3Idx >= T3_SIZE || t3Count > T3_SIZE)
       {
          Serial.println("Initializing T3 (2-h) buffer");
          memset(t3HR, 0, T3_SIZE);
          memset(t3HRV, 0, T3_SIZE);
+         memset(t3Resp, 0, T3_SIZE);
          t3Idx = 0;
          t3Count = 0;
+         touchTier(3);
+         ckptPending = true;
       }
 
-      Serial.printf("TieredHRStorage: T1=%d/288, T2=%d/336, T3=%d/360\n",
-                    t1Count, t2Count, t3Count);
+      Serial.printf("TieredHRStorage: T1=%d/288, T2=%d/336, T3=%d/360, log seq %lu\n",
+                    t1Count, t2Count, t3Count, (unsigned long)sampleLog.lastSeq());
       initialized = true;
+
+      // Old keys go once the checkpoint stands; found again if cut off
+      if (persist() && (migrated || oldLayoutLeft()))
+      {
+         removeOldKeys();
+         if (migrated)
+            Serial.println("TieredHRStorage: migrated NVS history to the log partition");
+      }
       return true;
    }
 
-   // Store a 5-min measurement. hr: BPM (0=no reading), hrv: SDNN ms clamped to uint8_t.
+   // Store one 5-min sample. hr: BPM (0=no reading), hrv: SDNN ms clamped
+   // to uint8_t (0=no HRV, e.g. spectral-only HR; left out of the tier
+   // averages), resp: breaths/min (0=no reading, also left out), sleep:
+   // SLEEP_STATE_AWAKE/ASLEEP.
    // Automatically promotes averaged values to T2 (every 6 calls) and T3 (every 4 T2 entries).
-   // Call addSleepState() immediately after addMeasurement() to keep indices aligned.
-   void addMeasurement(uint8_t hr, uint8_t hrv)
+   // RAM only; the next persistence pass writes the log record and, after
+   // a promotion, the T2/T3 checkpoint. Call under the writers' lock.
+   bool addSample(uint8_t hr, uint8_t hrv, uint8_t resp, uint8_t sleep)
    {
       if (!initialized)
-         return;
+         return false;
+      writeBegin();
 
       // --- T1 write ---
       t1HR[t1Idx] = hr;
       t1HRV[t1Idx] = hrv;
-      // t1Sleep will be updated by addSleepState() BEFORE t1Idx advances,
-      // so we leave it unchanged here; addSleepState() writes to current t1Idx.
-      uint16_t writtenIdx = t1Idx; // capture before advance
+      t1Resp[t1Idx] = resp;
+      t1Sleep[t1Idx] = sleep;
       t1Idx = (t1Idx + 1) % T1_SIZE;
       if (t1Count < T1_SIZE)
          t1Count++;
       t1PromoCount++;
-      (void)writtenIdx; // used logically; sleep state written separately
 
       // --- Promote to T2 every 6 T1 entries (= 30-min interval) ---
       if (t1PromoCount >= 6)
       {
          t1PromoCount = 0;
-         uint16_t sumHR = 0, sumHRV = 0;
-         uint8_t n = 0;
-         for (uint8_t i = 0; i < 6; i++)
+         promote(t1Idx);
+         ckptPending = true;
+      }
+      writeEnd();
+
+      // Oldest pending samples are lost once the ring laps them
+      if (logReady && pending < T1_SIZE)
+         pending++;
+      return true;
+   }
+
+   // Persistence pass, step 1 (under the writers' lock): copy up to
+   // HIST_PERSIST_BATCH pending samples and, with the last of them, the
+   // changed T2/T3 chunks. False when there is nothing to write.
+   bool preparePersist()
+   {
+      if (!initialized)
+         return false;
+      job.records = pending < HIST_PERSIST_BATCH ? pending : HIST_PERSIST_BATCH;
+      job.appended = 0;
+      for (uint16_t i = 0; i < job.records; i++)
+      {
+         uint16_t pos = (t1Idx - pending + i + T1_SIZE) % T1_SIZE;
+         job.rec[i][0] = t1HR[pos];
+         job.rec[i][1] = t1HRV[pos];
+         job.rec[i][2] = t1Resp[pos];
+         job.rec[i][3] = t1Sleep[pos];
+      }
+      job.ckpt = ckptPending && job.records == pending;
+      if (job.ckpt)
+      {
+         ckptPending = false;
+         for (uint8_t i = S_T2HR; i < SERIES_COUNT; i++)
          {
-            uint16_t pos = (t1Idx - 6u + i + T1_SIZE) % T1_SIZE;
-            if (t1HR[pos] > 0)
-            {
-               sumHR += t1HR[pos];
-               sumHRV += t1HRV[pos];
-               n++;
-            }
+            memcpy(job.data[i - S_T2HR], series[i].data, series[i].size);
+            job.dirty[i] = series[i].dirty;
+            series[i].dirty = 0;
          }
-         t2HR[t2Idx] = (n > 0) ? (uint8_t)(sumHR / n) : 0;
-         t2HRV[t2Idx] = (n > 0) ? (uint8_t)(sumHRV / n) : 0;
-         t2Idx = (t2Idx + 1) % T2_SIZE;
-         if (t2Count < T2_SIZE)
-            t2Count++;
-         t2PromoCount++;
-
-         // --- Promote to T3 every 4 T2 entries (= 2-h interval) ---
-         if (t2PromoCount >= 4)
+         memset(&job.ck, 0, sizeof(job.ck));
+         job.ck.firstSeq = firstSeq;
+         job.ck.t1PromoCount = t1PromoCount;
+         job.ck.t2Idx = t2Idx;
+         job.ck.t2Count = t2Count;
+         job.ck.t2PromoCount = t2PromoCount;
+         job.ck.t3Idx = t3Idx;
+         job.ck.t3Count = t3Count;
+      }
+      if (job.records == 0 && !job.ckpt)
+      {
+         rtcSeal(); // T1 is all in the log (or, without one, RTC only)
+         return false;
+      }
+      jobBusy = true;
+      return true;
+   }
+
+   // Step 2 (without the lock, from one task at a time): append the records,
+   // then write the dirty chunks and the checkpoint and commit once. A chunk
+   // that fails stays dirty and the checkpoint is not written; the next
+   // boot replays the log from the previous one.
+   bool writePersist()
+   {
+      bool ok = true;
+      for (uint16_t i = 0; i < job.records; i++)
+      {
+         LogRecord r;
+         r.hr = job.rec[i][0];
+         r.hrv = job.rec[i][1];
+         r.resp = job.rec[i][2];
+         r.sleep = job.rec[i][3];
+         if (!sampleLog.append(r))
          {
-            t2PromoCount = 0;
-            uint16_t sumHR3 = 0, sumHRV3 = 0;
-            uint8_t n3 = 0;
-            for (uint8_t i = 0; i < 4; i++)
-            {
-               uint16_t pos = (t2Idx - 4u + i + T2_SIZE) % T2_SIZE;
-               if (t2HR[pos] > 0)
-               {
-                  sumHR3 += t2HR[pos];
-                  sumHRV3 += t2HRV[pos];
-                  n3++;
-               }
-            }
-            t3HR[t3Idx] = (n3 > 0) ? (uint8_t)(sumHR3 / n3) : 0;
-            t3HRV[t3Idx] = (n3 > 0) ? (uint8_t)(sumHRV3 / n3) : 0;
-            t3Idx = (t3Idx + 1) % T3_SIZE;
-            if (t3Count < T3_SIZE)
-               t3Count++;
+            Serial.println("ERROR: History log append failed");
+            ok = false;
+            break;
+         }
+         job.appended++;
+      }
+      if (!job.ckpt || !ok)
+         return ok;
+
+      char key[16];
+      for (uint8_t i = S_T2HR; i < SERIES_COUNT; i++)
+      {
+         const Series &s = series[i];
+         uint16_t dirty = job.dirty[i], failed = 0;
+         for (uint8_t c = 0; dirty; c++, dirty >>= 1)
+         {
+            if (!(dirty & 1))
+               continue;
+            uint16_t off = c * HIST_CHUNK_BYTES;
+            uint16_t len = (s.size - off < HIST_CHUNK_BYTES) ? s.size - off : HIST_CHUNK_BYTES;
+            chunkKey(key, s, c);
+            if (!putBlob(key, job.data[i - S_T2HR] + off, len))
+               failed |= 1u << c;
          }
+         job.dirty[i] = failed;
+         ok = ok && !failed;
       }
+      if (ok)
+      {
+         job.ck.logSeq = sampleLog.lastSeq();
+         ok = putBlob("hckpt", &job.ck, sizeof(job.ck));
+      }
+      if (nvs_commit(nvs) != ESP_OK)
+         ok = false;
+      if (!ok)
+         Serial.println("ERROR: History checkpoint not committed");
+      return ok;
+   }
 
-      save();
+   // Step 3 (under the lock): drop what reached flash, keep the rest
+   // pending. RTC memory is sealed once T1 matches the log tail.
+   void finishPersist(bool ok)
+   {
+      jobBusy = false;
+      if (clearBusy)
+      {
+         // The job held samples from before clear(); T1 starts after them
+         clearBusy = false;
+         firstSeq = sampleLog.lastSeq() + 1;
+      }
+      else
+         pending -= job.appended < pending ? job.appended : pending;
+      if (job.ckpt && !ok)
+      {
+         for (uint8_t i = S_T2HR; i < SERIES_COUNT; i++)
+            series[i].dirty |= job.dirty[i];
+         ckptPending = true;
+      }
+      if (pending == 0)
+         rtcSeal();
+   }
+
+   // All three steps in a row, until nothing is pending or a write fails.
+   // For begin() and single-task callers.
+   bool persist()
+   {
+      while (preparePersist())
+      {
+         bool ok = writePersist();
+         finishPersist(ok);
+         if (!ok)
+            return false;
+      }
+      return true;
    }
 
    // Returns the last 'n' samples (chronological: oldest → newest).
@@ -205,40 +505,100 @@ public:
    {
       if (!initialized || buf == nullptr)
          return 0;
-      uint8_t *src = nullptr;
-      uint16_t size = 0, idx = 0, count = 0;
+      const uint8_t *src = nullptr;
+      const uint16_t *idxRef = nullptr, *countRef = nullptr;
+      uint16_t size = 0, idx, count;
 
       if (tier == 1)
       {
          src = isHRV ? t1HRV : t1HR;
          size = T1_SIZE;
-         idx = t1Idx;
-         count = t1Count;
+         idxRef = &t1Idx;
+         countRef = &t1Count;
       }
       else if (tier == 2)
       {
          src = isHRV ? t2HRV : t2HR;
          size = T2_SIZE;
-         idx = t2Idx;
-         count = t2Count;
+         idxRef = &t2Idx;
+         countRef = &t2Count;
       }
       else if (tier == 3)
       {
          src = isHRV ? t3HRV : t3HR;
          size = T3_SIZE;
-         idx = t3Idx;
-         count = t3Count;
+         idxRef = &t3Idx;
+         countRef = &t3Count;
       }
       else
       {
          return 0;
       }
 
-      uint16_t actual = (n < count) ? n : count;
-      for (uint16_t i = 0; i < actual; i++)
+      uint16_t actual;
+      uint32_t v;
+      do
       {
-         buf[i] = src[(idx - actual + i + size) % size];
+         v = readBegin();
+         idx = *idxRef;
+         count = *countRef;
+         actual = (n < count) ? n : count;
+         for (uint16_t i = 0; i < actual; i++)
+         {
+            buf[i] = src[(idx - actual + i + size) % size];
+         }
+      } while (readRetry(v));
+      return actual;
+   }
+
+   // Respiration counterpart of getLastN(): breaths/min, 0 = no reading.
+   uint16_t getLastNResp(uint8_t tier, uint8_t *buf, uint16_t n)
+   {
+      if (!initialized || buf == nullptr)
+         return 0;
+      const uint8_t *src = nullptr;
+      const uint16_t *idxRef = nullptr, *countRef = nullptr;
+      uint16_t size = 0, idx, count;
+
+      if (tier == 1)
+      {
+         src = t1Resp;
+         size = T1_SIZE;
+         idxRef = &t1Idx;
+         countRef = &t1Count;
       }
+      else if (tier == 2)
+      {
+         src = t2Resp;
+         size = T2_SIZE;
+         idxRef = &t2Idx;
+         countRef = &t2Count;
+      }
+      else if (tier == 3)
+      {
+         src = t3Resp;
+         size = T3_SIZE;
+         idxRef = &t3Idx;
+         countRef = &t3Count;
+      }
+      else
+      {
+         return 0;
+      }
+
+      uint16_t actual;
+      uint32_t v;
+      do
+      {
+         v = readBegin();
+         idx = *idxRef;
+         count = *countRef;
+         actual = (n < count) ? n : count;
+         for (uint16_t i = 0; i < actual; i++)
+         {
+            buf[i] = src[(idx - actual + i + size) % size];
+         }
+      } while (readRetry(v));
       return actual;
    }
 
@@ -250,43 +610,48 @@ public:
       return getLastN(tier, isHRV, buf, maxN);
    }
 
-   // Write sleep state (SLEEP_STATE_AWAKE/ASLEEP) for the measurement just stored.
-   // Must be called AFTER addMeasurement() to fill the same slot.
-   void addSleepState(uint8_t state)
-   {
-      if (!initialized)
-         return;
-      // t1Idx already advanced by addMeasurement(); the slot we just wrote is (t1Idx-1)
-      uint16_t lastIdx = (t1Idx == 0) ? (T1_SIZE - 1) : (t1Idx - 1);
-      t1Sleep[lastIdx] = state;
-      prefs.putBytes("slp5m", t1Sleep, T1_SIZE);
-   }
-
    // Return the last 'n' T1 sleep-state entries in chronological order.
    uint16_t getLastNSleep(uint8_t *buf, uint16_t n)
    {
       if (!initialized || buf == nullptr)
          return 0;
-      uint16_t actual = (n < t1Count) ? n : t1Count;
-      for (uint16_t i = 0; i < actual; i++)
+      uint16_t actual;
+      uint32_t v;
+      do
       {
-         buf[i] = t1Sleep[(t1Idx - actual + i + T1_SIZE) % T1_SIZE];
-      }
+         v = readBegin();
+         actual = (n < t1Count) ? n : t1Count;
+         for (uint16_t i = 0; i < actual; i++)
+         {
+            buf[i] = t1Sleep[(t1Idx - actual + i + T1_SIZE) % T1_SIZE];
+         }
+      } while (readRetry(v));
       return actual;
    }
 
    // T1 fill count — used for status/debug output.
    uint16_t getCount() const { return t1Count; }
 
+   // Flash bytes written since begin() (log records + NVS payload) — status/debug output.
+   uint32_t getBytesWritten() const { return bytesWritten + sampleLog.getBytesWritten(); }
+
+   // Drops all tiers. The log keeps its records; T1 starts after them. Call
+   // under the writers' lock; the next persistence pass writes it. A job
+   // written meanwhile still appends its older samples, so with one out T1
+   // starts after them, in finishPersist().
    void clear()
    {
+      writeBegin();
       memset(t1HR, 0, T1_SIZE);
       memset(t1HRV, 0, T1_SIZE);
+      memset(t1Resp, 0, T1_SIZE);
       memset(t1Sleep, 0, T1_SIZE);
       memset(t2HR, 0, T2_SIZE);
       memset(t2HRV, 0, T2_SIZE);
+      memset(t2Resp, 0, T2_SIZE);
       memset(t3HR, 0, T3_SIZE);
       memset(t3HRV, 0, T3_SIZE);
+      memset(t3Resp, 0, T3_SIZE);
       t1Idx = 0;
       t1Count = 0;
       t1PromoCount = 0;
@@ -295,30 +660,362 @@ public:
       t2PromoCount = 0;
       t3Idx = 0;
       t3Count = 0;
-      save();
+      writeEnd();
+      if (jobBusy)
+         clearBusy = true;
+      else
+         firstSeq = sampleLog.lastSeq() + 1;
+      pending = 0;
+      touchTier(2);
+      touchTier(3);
+      ckptPending = true;
       Serial.println("TieredHRStorage cleared");
    }
 
 private:
-   void save()
+   static uint8_t chunkCount(uint16_t size) { return (size + HIST_CHUNK_BYTES - 1) / HIST_CHUNK_BYTES; }
+
+   static void chunkKey(char *key, const Series &s, uint8_t chunk) { snprintf(key, 16, "%s.%u", s.key, chunk); }
+
+   static uint16_t tierSize(uint8_t tier) { return tier == 1 ? T1_SIZE : tier == 2 ? T2_SIZE : T3_SIZE; }
+
+   void touch(uint8_t s, uint16_t idx) { series[s].dirty |= 1u << (idx / HIST_CHUNK_BYTES); }
+
+   // Mark every chunk of a tier for the next checkpoint
+   void touchTier(uint8_t tier)
    {
-      if (!initialized)
+      uint8_t first = tier == 1 ? S_T1HR : tier == 2 ? S_T2HR : S_T3HR;
+      uint8_t last = tier == 1 ? S_T1SLEEP : first + 2;
+      for (uint8_t i = first; i <= last; i++)
+         series[i].dirty = (1u << chunkCount(series[i].size)) - 1;
+   }
+
+   void writeBegin()
+   {
+      __atomic_store_n(&version, version + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+   }
+
+   void writeEnd() { __atomic_store_n(&version, version + 1, __ATOMIC_RELEASE); }
+
+   uint32_t readBegin() const
+   {
+      uint32_t v;
+      while ((v = __atomic_load_n(&version, __ATOMIC_ACQUIRE)) & 1)
+         delay(1); // let a preempted writer finish
+      return v;
+   }
+
+   // True when a writer got in between readBegin() and now
+   bool readRetry(uint32_t v) const
+   {
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      return __atomic_load_n(&version, __ATOMIC_RELAXED) != v;
+   }
+
+   // Push the mean of the 6 T1 entries before 'end' to T2, and every 4th
+   // T2 entry on to T3.
+   void promote(uint16_t end)
+   {
+      uint16_t sumHR = 0, sumHRV = 0, sumResp = 0;
+      uint8_t n = 0, nHRV = 0, nResp = 0;
+      for (uint8_t i = 0; i < 6; i++)
+      {
+         uint16_t pos = (end - 6u + i + T1_SIZE) % T1_SIZE;
+         if (t1HR[pos] > 0)
+         {
+            sumHR += t1HR[pos];
+            n++;
+         }
+         if (t1HRV[pos] > 0)
+         {
+            sumHRV += t1HRV[pos];
+            nHRV++;
+         }
+         if (t1Resp[pos] > 0)
+         {
+            sumResp += t1Resp[pos];
+            nResp++;
+         }
+      }
+      t2HR[t2Idx] = (n > 0) ? (uint8_t)(sumHR / n) : 0;
+      t2HRV[t2Idx] = (nHRV > 0) ? (uint8_t)(sumHRV / nHRV) : 0;
+      t2Resp[t2Idx] = (nResp > 0) ? (uint8_t)(sumResp / nResp) : 0;
+      touch(S_T2HR, t2Idx);
+      touch(S_T2HRV, t2Idx);
+      touch(S_T2RESP, t2Idx);
+      t2Idx = (t2Idx + 1) % T2_SIZE;
+      if (t2Count < T2_SIZE)
+         t2Count++;
+      t2PromoCount++;
+
+      // --- Promote to T3 every 4 T2 entries (= 2-h interval) ---
+      if (t2PromoCount >= 4)
+      {
+         t2PromoCount = 0;
+         uint16_t sumHR3 = 0, sumHRV3 = 0, sumResp3 = 0;
+         uint8_t n3 = 0, nHRV3 = 0, nResp3 = 0;
+         for (uint8_t i = 0; i < 4; i++)
+         {
+            uint16_t pos = (t2Idx - 4u + i + T2_SIZE) % T2_SIZE;
+            if (t2HR[pos] > 0)
+            {
+               sumHR3 += t2HR[pos];
+               n3++;
+            }
+            if (t2HRV[pos] > 0)
+            {
+               sumHRV3 += t2HRV[pos];
+               nHRV3++;
+            }
+            if (t2Resp[pos] > 0)
+            {
+               sumResp3 += t2Resp[pos];
+               nResp3++;
+            }
+         }
+         t3HR[t3Idx] = (n3 > 0) ? (uint8_t)(sumHR3 / n3) : 0;
+         t3HRV[t3Idx] = (nHRV3 > 0) ? (uint8_t)(sumHRV3 / nHRV3) : 0;
+         t3Resp[t3Idx] = (nResp3 > 0) ? (uint8_t)(sumResp3 / nResp3) : 0;
+         touch(S_T3HR, t3Idx);
+         touch(S_T3HRV, t3Idx);
+         touch(S_T3RESP, t3Idx);
+         t3Idx = (t3Idx + 1) % T3_SIZE;
+         if (t3Count < T3_SIZE)
+            t3Count++;
+      }
+   }
+
+   // T1 from RTC memory when it matches the log tail, else from the log.
+   // Without the log only RTC memory holds it.
+   void loadT1(const HistCheckpoint &ck)
+   {
+      uint32_t last = sampleLog.lastSeq();
+      bool rtcOK = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && histT1.crc == rtcCrc();
+      if (!logReady)
+      {
+         if (!rtcOK)
+         {
+            memset(&histT1, 0, sizeof(histT1));
+            t1PromoCount = ck.t1PromoCount;
+         }
          return;
-      prefs.putBytes("hr5m", t1HR, T1_SIZE);
-      prefs.putBytes("hrv5m", t1HRV, T1_SIZE);
-      prefs.putBytes("slp5m", t1Sleep, T1_SIZE);
-      prefs.putUShort("t1idx", t1Idx);
-      prefs.putUShort("t1cnt", t1Count);
-      prefs.putUChar("t1prom", t1PromoCount);
-      prefs.putBytes("hr30m", t2HR, T2_SIZE);
-      prefs.putBytes("hrv30m", t2HRV, T2_SIZE);
-      prefs.putUShort("t2idx", t2Idx);
-      prefs.putUShort("t2cnt", t2Count);
-      prefs.putUChar("t2prom", t2PromoCount);
-      prefs.putBytes("hr2h", t3HR, T3_SIZE);
-      prefs.putBytes("hrv2h", t3HRV, T3_SIZE);
-      prefs.putUShort("t3idx", t3Idx);
-      prefs.putUShort("t3cnt", t3Count);
+      }
+      if (HIST_RTC_T1 && rtcOK && histT1.logSeq == last && histT1.firstSeq == firstSeq)
+      {
+         Serial.println("TieredHRStorage: T1 from RTC");
+         return;
+      }
+
+      // Newest record lands in the last slot, so t1Idx = 0 continues the ring
+      memset(&histT1, 0, sizeof(histT1));
+      uint16_t want = last >= firstSeq ? (last - firstSeq + 1 < T1_SIZE ? last - firstSeq + 1 : T1_SIZE) : 0;
+      LogCursor c = sampleLog.tail();
+      LogRecord r;
+      uint16_t n = 0;
+      while (n < want && sampleLog.prev(c, r) && r.seq <= last && last - r.seq < want)
+      {
+         uint16_t pos = T1_SIZE - 1 - (last - r.seq);
+         t1HR[pos] = r.hr;
+         t1HRV[pos] = r.hrv;
+         t1Resp[pos] = r.resp;
+         t1Sleep[pos] = r.sleep;
+         n++;
+      }
+      t1Idx = 0;
+      t1Count = want;
+      Serial.printf("TieredHRStorage: T1 rebuilt from %d log records\n", n);
+   }
+
+   // Redo the promotions of the records after the checkpoint. True when
+   // there were any (the checkpoint needs rewriting).
+   bool replay(const HistCheckpoint &ck)
+   {
+      uint32_t last = sampleLog.lastSeq();
+      uint32_t from = ck.logSeq + 1;
+      uint8_t promo = ck.t1PromoCount;
+      if (last - ck.logSeq > t1Count)
+      {
+         // Older records have left T1 and cannot be promoted any more
+         uint32_t skip = last - ck.logSeq - t1Count;
+         promo = (promo + skip) % 6;
+         from += skip;
+      }
+      bool promoted = false;
+      for (uint32_t s = from; s <= last; s++)
+      {
+         if (++promo >= 6)
+         {
+            promo = 0;
+            promote((t1Idx + T1_SIZE - (last - s)) % T1_SIZE);
+            promoted = true;
+         }
+      }
+      t1PromoCount = promo;
+      if (promoted)
+         Serial.printf("TieredHRStorage: replayed %lu samples after checkpoint\n", (unsigned long)(last - ck.logSeq));
+      return promoted;
+   }
+
+   // Load the NVS-only history of older firmware and move T1 into the log.
+   // False when there is none.
+   bool migrateOld()
+   {
+      HistIndex ix;
+      if (!getBlob("hidx", &ix, sizeof(ix)))
+      {
+         memset(&ix, 0, sizeof(ix));
+         nvs_get_u16(nvs, "t1idx", &ix.t1Idx);
+         nvs_get_u16(nvs, "t1cnt", &ix.t1Count);
+         nvs_get_u8(nvs, "t1prom", &ix.t1PromoCount);
+         nvs_get_u16(nvs, "t2idx", &ix.t2Idx);
+         nvs_get_u16(nvs, "t2cnt", &ix.t2Count);
+         nvs_get_u8(nvs, "t2prom", &ix.t2PromoCount);
+         nvs_get_u16(nvs, "t3idx", &ix.t3Idx);
+         nvs_get_u16(nvs, "t3cnt", &ix.t3Count);
+         if (!ix.t1Count && !ix.t2Count && !ix.t3Count)
+            return false;
+      }
+      // Missing sleep or respiration data loads as zeros
+      bool t1OK = loadSeries(series[S_T1HR]);
+      t1OK = loadSeries(series[S_T1HRV]) && t1OK;
+      loadSeries(series[S_T1SLEEP]);
+      loadSeries(series[S_T1RESP]);
+      for (uint8_t k = S_T2HR; k <= S_T3RESP; k++)
+         loadSeries(series[k]);
+
+      // An update the old firmware did not finish: put the old bytes back
+      HistUndo undo;
+      if (getBlob("hundo", &undo, sizeof(undo)) && undo.seq == ix.seq + 1)
+      {
+         for (uint8_t i = 0; i < undo.t1Slots && i < 6; i++)
+            for (uint8_t k = S_T1HR; k <= S_T1SLEEP; k++)
+               series[k].data[(undo.t1Pos + i) % T1_SIZE] = undo.t1Old[i][k - S_T1HR];
+         for (uint8_t t = 0; t < 2; t++)
+         {
+            if (!(undo.tiers & (2 << t)) || undo.pos[t] >= tierSize(t + 2))
+               continue;
+            uint8_t first = t == 0 ? S_T2HR : S_T3HR;
+            for (uint8_t k = first; k <= first + 2; k++)
+               series[k].data[undo.pos[t]] = undo.old[t][k - first];
+         }
+      }
+      t1Idx = ix.t1Idx;
+      t1Count = ix.t1Count;
+      t1PromoCount = ix.t1PromoCount;
+      t2Idx = ix.t2Idx;
+      t2Count = ix.t2Count;
+      t2PromoCount = ix.t2PromoCount;
+      t3Idx = ix.t3Idx;
+      t3Count = ix.t3Count;
+      if (!t1OK || t1Idx >= T1_SIZE || t1Count > T1_SIZE)
+         t1Count = 0;
+
+      // Records left by a migration that was cut off stay outside T1
+      firstSeq = sampleLog.lastSeq() + 1;
+      if (logReady)
+      {
+         for (uint16_t i = 0; i < t1Count; i++)
+         {
+            uint16_t pos = (t1Idx - t1Count + i + T1_SIZE) % T1_SIZE;
+            LogRecord r;
+            r.hr = t1HR[pos];
+            r.hrv = t1HRV[pos];
+            r.resp = t1Resp[pos];
+            r.sleep = t1Sleep[pos];
+            if (!sampleLog.append(r))
+            {
+               Serial.println("ERROR: History log append failed");
+               break;
+            }
+         }
+      }
+      for (uint8_t k = S_T1HR; k <= S_T1SLEEP; k++)
+         series[k].dirty = 0;
+      touchTier(2);
+      touchTier(3);
+      return true;
+   }
+
+   // Keys of the NVS-only layout left after its migration
+   bool oldLayoutLeft()
+   {
+      HistIndex ix;
+      uint16_t cnt;
+      return getBlob("hidx", &ix, sizeof(ix)) || nvs_get_u16(nvs, "t1cnt", &cnt) == ESP_OK;
+   }
+
+   // "hidx" and "t1cnt" go last, so a cut-off cleanup is found and redone
+   void removeOldKeys()
+   {
+      static const char *const oldKeys[] = {"hundo", "t1idx", "t1prom", "t2idx", "t2cnt",
+                                            "t2prom", "t3idx", "t3cnt", "t1cnt", "hidx"};
+      char key[16];
+      for (uint8_t i = S_T1HR; i <= S_T1SLEEP; i++)
+         for (uint8_t c = 0; c < chunkCount(series[i].size); c++)
+         {
+            chunkKey(key, series[i], c);
+            nvs_erase_key(nvs, key);
+         }
+      for (uint8_t i = 0; i < SERIES_COUNT; i++)
+         nvs_erase_key(nvs, series[i].key);
+      for (uint8_t i = 0; i < sizeof(oldKeys) / sizeof(oldKeys[0]); i++)
+         nvs_erase_key(nvs, oldKeys[i]);
+      nvs_commit(nvs);
+   }
+
+   // Blob of exactly len bytes; false when absent or of another size
+   bool getBlob(const char *key, void *buf, size_t len)
+   {
+      size_t got = len;
+      return nvs_get_blob(nvs, key, buf, &got) == ESP_OK && got == len;
+   }
+
+   bool putBlob(const char *key, const void *buf, size_t len)
+   {
+      if (nvs_set_blob(nvs, key, buf, len) != ESP_OK)
+         return false;
+      bytesWritten += len;
+      return true;
+   }
+
+   uint32_t rtcCrc() const
+   {
+      return esp_rom_crc32_le(0, (const uint8_t *)&histT1 + sizeof(histT1.crc), sizeof(histT1) - sizeof(histT1.crc));
+   }
+
+   // Mark histT1 valid for the next wake, matching the current log tail
+   void rtcSeal()
+   {
+      histT1.logSeq = sampleLog.lastSeq();
+      histT1.firstSeq = firstSeq;
+      histT1.crc = rtcCrc();
+   }
+
+   // Load a series from its chunks, or from the single blob of older
+   // firmware (marked dirty). Zeroed and false when not stored.
+   bool loadSeries(Series &s)
+   {
+      char key[16];
+      uint8_t chunks = chunkCount(s.size);
+      uint8_t c = 0;
+      for (; c < chunks; c++)
+      {
+         uint16_t off = c * HIST_CHUNK_BYTES;
+         uint16_t len = (s.size - off < HIST_CHUNK_BYTES) ? s.size - off : HIST_CHUNK_BYTES;
+         chunkKey(key, s, c);
+         if (!getBlob(key, s.data + off, len))
+            break;
+      }
+      if (c == chunks)
+         return true;
+      if (getBlob(s.key, s.data, s.size))
+      {
+         s.dirty = (1u << chunks) - 1;
+         return true;
+      }
+      memset(s.data, 0, s.size);
+      return false;
    }
 };
 
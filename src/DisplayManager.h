@@ -16,6 +16,9 @@
 GxEPD2_BW<GxEPD2_154_D67, GxEPD2_154_D67::HEIGHT> display(
     GxEPD2_154_D67(DISPLAY_CS_PIN, DISPLAY_DC_PIN, DISPLAY_RES_PIN, DISPLAY_BUSY_PIN));
 
+// Panel current while a refresh runs (SSD1681, typical); for power estimates
+#define EPD_REFRESH_UA 3000
+
 // Small status badge in the bottom-right corner.
 #define STATUS_BADGE_W 32
 #define STATUS_BADGE_H 20
@@ -533,6 +536,71 @@ void renderSleepSummary(uint8_t sleepState, uint32_t sleepCycles,
    Serial.println("Sleep summary rendered");
 }
 
+// Workout screen. running: the workout has started (otherwise it is armed and
+// starts when the screen is kept). The HR number is then refreshed on its own
+// by updateWorkoutHrPartial().
+#define WORKOUT_HR_AREA_X 20
+#define WORKOUT_HR_AREA_Y 66
+#define WORKOUT_HR_AREA_W 160
+#define WORKOUT_HR_AREA_H 44
+
+static void drawWorkoutHr(uint8_t hr)
+{
+   char hrText[8];
+   if (hr > 0)
+      sprintf(hrText, "%d", hr);
+   else
+      strcpy(hrText, "--");
+   int16_t tbx, tby;
+   uint16_t tbw, tbh;
+   display.setFont(&FreeMonoBold18pt7b);
+   display.setTextColor(GxEPD_BLACK);
+   display.getTextBounds(hrText, 0, 0, &tbx, &tby, &tbw, &tbh);
+   display.setCursor(((display.width() - tbw) / 2) - tbx, 100);
+   display.print(hrText);
+}
+
+void renderWorkout(uint8_t hr, bool running)
+{
+   Serial.println("Rendering WORKOUT...");
+
+   display.setPartialWindow(0, 0, display.width(), display.height());
+   display.firstPage();
+   do
+   {
+      display.fillScreen(GxEPD_WHITE);
+      display.setFont(&FreeMonoBold9pt7b);
+      display.setTextColor(GxEPD_BLACK);
+      display.setCursor(10, 20);
+      display.print("Workout");
+
+      drawWorkoutHr(running ? hr : 0);
+
+      const char *label = running ? "BPM" : "Starting...";
+      int16_t tbx, tby;
+      uint16_t tbw, tbh;
+      display.setFont(running ? &FreeMonoBold12pt7b : &FreeMonoBold9pt7b);
+      display.getTextBounds(label, 0, 0, &tbx, &tby, &tbw, &tbh);
+      display.setCursor(((display.width() - tbw) / 2) - tbx, 130);
+      display.print(label);
+
+      drawStatusBadge(display.width() - STATUS_BADGE_W,
+                      display.height() - STATUS_BADGE_H, true);
+   } while (display.nextPage());
+}
+
+// Refresh only the HR number of the workout screen.
+void updateWorkoutHrPartial(uint8_t hr)
+{
+   display.setPartialWindow(WORKOUT_HR_AREA_X, WORKOUT_HR_AREA_Y, WORKOUT_HR_AREA_W, WORKOUT_HR_AREA_H);
+   display.firstPage();
+   do
+   {
+      display.fillRect(WORKOUT_HR_AREA_X, WORKOUT_HR_AREA_Y, WORKOUT_HR_AREA_W, WORKOUT_HR_AREA_H, GxEPD_WHITE);
+      drawWorkoutHr(hr);
+   } while (display.nextPage());
+}
+
 // Put display in low power hibernate mode
 void hibernateDisplay()
 {
@@ -0,0 +1,195 @@
+#ifndef FILTERDESIGN_H
+#define FILTERDESIGN_H
+
+#include <stdint.h>
+
+/*
+ * Compile-time Butterworth bandpass design (SOS form).
+ *
+ * Follows scipy.signal.butter(order, [lo, hi], btype='band', fs=fs,
+ * output='sos') step by step: analog prototype, pre-warped lp2bp transform,
+ * bilinear transform and zpk2sos with 'nearest' pole/zero pairing, gain in the
+ * first section. All arithmetic is constexpr double, so the tables are plain
+ * constants in flash and agree with scipy to float precision.
+ *
+ *   ButterworthBandpass<4, 50, 500, 5000>::table.sos   // order 4, fs 50 Hz, 0.5-5 Hz
+ *
+ * Needs C++17 (see build_unflags/build_flags in platformio.ini).
+ */
+
+namespace filter_design
+{
+constexpr double PI = 3.14159265358979323846;
+
+constexpr double cabs2(double re, double im) { return re * re + im * im; }
+
+constexpr double csqrt_real(double v)
+{
+   if (v <= 0.0)
+      return 0.0;
+   double x = v > 1.0 ? v : 1.0;
+   for (int i = 0; i < 100; i++)
+   {
+      double next = 0.5 * (x + v / x);
+      if (next == x)
+         break;
+      x = next;
+   }
+   return x;
+}
+
+// sin/cos by Taylor series after reduction to [-pi, pi]
+constexpr double csin(double x)
+{
+   while (x > PI)
+      x -= 2.0 * PI;
+   while (x < -PI)
+      x += 2.0 * PI;
+   double term = x, sum = x;
+   for (int n = 1; n < 30; n++)
+   {
+      term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+      sum += term;
+   }
+   return sum;
+}
+
+constexpr double ccos(double x) { return csin(x + PI / 2.0); }
+
+struct Complex
+{
+   double re, im;
+};
+
+constexpr Complex cadd(Complex a, Complex b) { return {a.re + b.re, a.im + b.im}; }
+constexpr Complex csub(Complex a, Complex b) { return {a.re - b.re, a.im - b.im}; }
+constexpr Complex cmul(Complex a, Complex b) { return {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re}; }
+constexpr Complex cdiv(Complex a, Complex b)
+{
+   double d = cabs2(b.re, b.im);
+   return {(a.re * b.re + a.im * b.im) / d, (a.im * b.re - a.re * b.im) / d};
+}
+
+// Principal square root (same branch as numpy)
+constexpr Complex csqrt(Complex z)
+{
+   double r = csqrt_real(cabs2(z.re, z.im));
+   double re = csqrt_real((r + z.re) / 2.0);
+   double im = csqrt_real((r - z.re) / 2.0);
+   return {re, z.im < 0.0 ? -im : im};
+}
+} // namespace filter_design
+
+template <int Sections>
+struct SosTable
+{
+   float sos[Sections][6]; // b0 b1 b2 a0 a1 a2 per section, a0 == 1
+};
+
+template <int Order>
+constexpr SosTable<Order> designButterworthBandpass(double fsHz, double loHz, double hiHz)
+{
+   using namespace filter_design;
+   constexpr int NP = 2 * Order; // digital poles, Order conjugate pairs
+
+   // Pre-warped band edges (scipy designs at fs = 2)
+   double wl = 4.0 * csin(PI * loHz / fsHz) / ccos(PI * loHz / fsHz);
+   double wh = 4.0 * csin(PI * hiHz / fsHz) / ccos(PI * hiHz / fsHz);
+   double bw = wh - wl;
+   double wo2 = wl * wh;
+
+   // Analog lowpass prototype -> bandpass -> bilinear
+   Complex poles[NP] = {};
+   Complex num = {1.0, 0.0}; // prod(4 - z) over the Order analog zeros at 0
+   Complex den = {1.0, 0.0}; // prod(4 - p)
+   for (int k = 0; k < Order; k++)
+   {
+      double theta = PI * (2 * k - Order + 1) / (2.0 * Order);
+      Complex plp = {-ccos(theta) * bw / 2.0, -csin(theta) * bw / 2.0};
+      Complex root = csqrt(csub(cmul(plp, plp), {wo2, 0.0}));
+      Complex pa[2] = {cadd(plp, root), csub(plp, root)};
+      for (int j = 0; j < 2; j++)
+      {
+         Complex four = {4.0, 0.0};
+         poles[2 * k + j] = cdiv(cadd(four, pa[j]), csub(four, pa[j]));
+         den = cmul(den, csub(four, pa[j]));
+      }
+      num = cmul(num, {4.0, 0.0});
+   }
+   double gain = 1.0;
+   for (int k = 0; k < Order; k++)
+      gain *= bw;
+   gain *= cdiv(num, den).re;
+
+   // Digital zeros: Order at z = +1 (from s = 0), Order at z = -1 (degree excess)
+   int zerosPos = Order, zerosNeg = Order;
+
+   // zpk2sos, pairing='nearest': the pole pair closest to the unit circle
+   // goes into the last section, together with the nearest remaining zeros.
+   SosTable<Order> out = {};
+   bool used[NP] = {};
+   for (int s = Order - 1; s >= 0; s--)
+   {
+      int best = -1;
+      double bestDist = 0.0;
+      for (int i = 0; i < NP; i++)
+      {
+         if (used[i] || poles[i].im < 0.0)
+            continue;
+         double mag = csqrt_real(cabs2(poles[i].re, poles[i].im));
+         double dist = mag > 1.0 ? mag - 1.0 : 1.0 - mag;
+         if (best < 0 || dist < bestDist)
+         {
+            best = i;
+            bestDist = dist;
+         }
+      }
+      used[best] = true;
+      Complex p = poles[best];
+      for (int i = 0; i < NP; i++)
+      {
+         if (!used[i] && poles[i].re == p.re && poles[i].im == -p.im)
+         {
+            used[i] = true;
+            break;
+         }
+      }
+
+      double zsum = 0.0; // z1 + z2
+      for (int j = 0; j < 2; j++)
+      {
+         bool pos = cabs2(p.re - 1.0, p.im) <= cabs2(p.re + 1.0, p.im);
+         if ((pos && zerosPos > 0) || zerosNeg == 0)
+         {
+            zerosPos--;
+            zsum += 1.0;
+         }
+         else
+         {
+            zerosNeg--;
+            zsum -= 1.0;
+         }
+      }
+      double zprod = (zsum == 0.0) ? -1.0 : 1.0;
+
+      double k = (s == 0) ? gain : 1.0;
+      out.sos[s][0] = (float)k;
+      out.sos[s][1] = (float)(-zsum * k);
+      out.sos[s][2] = (float)(zprod * k);
+      out.sos[s][3] = 1.0f;
+      out.sos[s][4] = (float)(-2.0 * p.re);
+      out.sos[s][5] = (float)cabs2(p.re, p.im);
+   }
+   return out;
+}
+
+// Band edges in mHz so they can be template arguments.
+template <int Order, int FsHz, int LoMilliHz, int HiMilliHz>
+struct ButterworthBandpass
+{
+   static_assert(HiMilliHz < FsHz * 500, "upper band edge must be below Nyquist");
+   static constexpr SosTable<Order> table =
+       designButterworthBandpass<Order>((double)FsHz, LoMilliHz / 1000.0, HiMilliHz / 1000.0);
+};
+
+#endif // FILTERDESIGN_H
@@ -0,0 +1,109 @@
+#ifndef HRVSPECTRUM_H
+#define HRVSPECTRUM_H
+
+#include <math.h>
+#include <stdint.h>
+#include "DSPCore.h"
+
+/*
+ * Frequency-domain HRV: LF (0.04-0.15 Hz) and HF (0.15-0.4 Hz) power of the
+ * RR tachogram.
+ *
+ * The Lomb-Scargle periodogram is evaluated directly on the uneven beat
+ * times, so there is no resampling, no interpolation across dropped beats
+ * and no FFT buffer. Memory is the tachogram plus 5 sums per frequency bin.
+ * Beats are the outer loop: each one costs a single sinf/cosf pair, and its
+ * phasor is rotated from bin to bin with a complex multiply. The per-bin time
+ * shift tau comes out of the same sums in closed form, so one pass over the
+ * beats is enough. Result = scipy.signal.lombscargle(t, rr - mean(rr), w)
+ * scaled to a one-sided PSD (2·P·T/N, ms²/Hz) and summed per band.
+ *
+ * Float arithmetic, once per session: 36 bins × ~60-170 beats.
+ */
+
+#define HRV_SPECTRUM_F0_HZ 0.04f    // first bin (LF lower edge)
+#define HRV_SPECTRUM_STEP_HZ 0.01f  // ~1/2 of the resolution of a 56 s window
+#define HRV_SPECTRUM_BINS 36        // 0.04 .. 0.39 Hz
+#define HRV_SPECTRUM_HF_BIN 11      // first HF bin (0.15 Hz)
+#define HRV_SPECTRUM_MIN_SPAN_MS 25000 // one full cycle at the LF lower edge
+#define HRV_SPECTRUM_MIN_BEATS 16
+
+struct HRVSpectrum
+{
+   float lfMs2; // LF band power
+   float hfMs2; // HF band power
+   bool valid;  // tachogram long enough for the LF band
+};
+
+// Band powers of the tachogram; valid only when it spans at least
+// HRV_SPECTRUM_MIN_SPAN_MS.
+static HRVSpectrum computeHRVSpectrum(const RRTachogram &tach)
+{
+   HRVSpectrum result = {0.0f, 0.0f, false};
+   uint16_t n = tach.count();
+   if (n < HRV_SPECTRUM_MIN_BEATS)
+      return result;
+   uint32_t spanUs = tach.beatTimeUs(n - 1) - tach.beatTimeUs(0);
+   if (spanUs < HRV_SPECTRUM_MIN_SPAN_MS * 1000UL)
+      return result;
+
+   float mean = 0.0f;
+   for (uint16_t i = 0; i < n; i++)
+      mean += tach.intervalUs(i) / 1000.0f;
+   mean /= n;
+
+   // Per bin: sum cos², sin², cos·sin, y·cos, y·sin
+   static float acc[HRV_SPECTRUM_BINS][5];
+   for (int k = 0; k < HRV_SPECTRUM_BINS; k++)
+      for (int j = 0; j < 5; j++)
+         acc[k][j] = 0.0f;
+
+   const float TWO_PI = 6.28318530718f;
+   for (uint16_t i = 0; i < n; i++)
+   {
+      // Time relative to the first beat keeps the phase arguments small
+      float t = (tach.beatTimeUs(i) - tach.beatTimeUs(0)) / 1e6f;
+      float y = tach.intervalUs(i) / 1000.0f - mean;
+      float c = cosf(TWO_PI * HRV_SPECTRUM_F0_HZ * t);
+      float s = sinf(TWO_PI * HRV_SPECTRUM_F0_HZ * t);
+      float stepC = cosf(TWO_PI * HRV_SPECTRUM_STEP_HZ * t);
+      float stepS = sinf(TWO_PI * HRV_SPECTRUM_STEP_HZ * t);
+      for (int k = 0; k < HRV_SPECTRUM_BINS; k++)
+      {
+         acc[k][0] += c * c;
+         acc[k][1] += s * s;
+         acc[k][2] += c * s;
+         acc[k][3] += y * c;
+         acc[k][4] += y * s;
+         float next = c * stepC - s * stepS;
+         s = s * stepC + c * stepS;
+         c = next;
+      }
+   }
+
+   // One-sided PSD scale: P ≈ |X|²/N for even sampling at N/T
+   float scale = 2.0f * (spanUs / 1e6f) / n * HRV_SPECTRUM_STEP_HZ;
+   for (int k = 0; k < HRV_SPECTRUM_BINS; k++)
+   {
+      float cc = acc[k][0], ss = acc[k][1], cs = acc[k][2];
+      float yc = acc[k][3], ys = acc[k][4];
+
+      // Rotate by omega·tau, tan(2·omega·tau) = 2·cs / (cc - ss)
+      float half = 0.5f * atan2f(2.0f * cs, cc - ss);
+      float ct = cosf(half), st = sinf(half);
+      float ycT = ct * yc + st * ys;
+      float ysT = ct * ys - st * yc;
+      float ccT = ct * ct * cc + 2.0f * ct * st * cs + st * st * ss;
+      float ssT = ct * ct * ss - 2.0f * ct * st * cs + st * st * cc;
+      float p = 0.5f * (ycT * ycT / ccT + ysT * ysT / ssT);
+
+      if (k < HRV_SPECTRUM_HF_BIN)
+         result.lfMs2 += p * scale;
+      else
+         result.hfMs2 += p * scale;
+   }
+   result.valid = true;
+   return result;
+}
+
+#endif // HRVSPECTRUM_H
@@ -0,0 +1,358 @@
+#ifndef HISTORYLOG_H
+#define HISTORYLOG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef ESP_PLATFORM
+#include <esp_rom_crc.h>
+#include <esp_partition.h>
+#endif
+
+/*
+ * Append-only sample log in a dedicated flash partition.
+ *
+ * The partition is a ring of 4 KB sectors, used strictly in order, so every
+ * sector is erased once per trip around the ring (wear levelling by
+ * rotation). Each sector starts with a 16-byte header followed by 255
+ * fixed-size 16-byte records:
+ *
+ *   header: sector sequence, seq of its first record, erase count, CRC
+ *   record: sample seq, HR, HRV, respiration, sleep, 4 spare bytes, CRC
+ *
+ * Both CRCs are seeded with LOG_MAGIC, so erased or foreign data never
+ * passes. A record is one flash write; a power cut leaves it either erased,
+ * complete, or torn with a bad CRC, which readers skip. An interrupted
+ * sector switch leaves an erased or CRC-less header, and the sector simply
+ * counts as free.
+ *
+ * Recovery reads the sector headers (64 reads of 16 bytes for 256 KB) and
+ * binary-searches the write position inside the newest sector; nothing
+ * older is touched. Readers walk backwards from the tail with a LogCursor.
+ *
+ * Flash access goes through LogFlash: PartitionLogFlash on the device,
+ * RamLogFlash (NOR semantics: writes only clear bits) on a host build, see
+ * test/test_history_log.
+ */
+
+#define LOG_SECTOR_SIZE 4096
+#define LOG_RECORD_SIZE 16
+#define LOG_RECORDS_PER_SECTOR (LOG_SECTOR_SIZE / LOG_RECORD_SIZE - 1) // slot 0 is the header
+#define LOG_MAGIC 0x484C4F47u // "HLOG"
+#define LOG_PARTITION_LABEL "history"
+#define LOG_PARTITION_SUBTYPE 0x40 // custom data subtype, see partitions.csv
+
+struct LogRecord
+{
+   uint32_t seq; // 1, 2, ... ; 0 = none
+   uint8_t hr, hrv, resp, sleep;
+   uint8_t spare[4]; // written as 0xFF
+   uint32_t crc;
+};
+
+struct LogSectorHeader
+{
+   uint32_t sectorSeq; // increases by one per sector opened
+   uint32_t firstSeq;  // seq of the sector's first record
+   uint32_t eraseCount;
+   uint32_t crc;
+};
+
+static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "log record layout");
+static_assert(sizeof(LogSectorHeader) == LOG_RECORD_SIZE, "log header layout");
+
+// CRC-32 (IEEE, reflected): the ROM routine on the device, the same
+// polynomial bit by bit elsewhere.
+static inline uint32_t logCrc32(uint32_t crc, const uint8_t *p, uint32_t len)
+{
+#ifdef ESP_PLATFORM
+   return esp_rom_crc32_le(crc, p, len);
+#else
+   crc = ~crc;
+   while (len--)
+   {
+      crc ^= *p++;
+      for (uint8_t k = 0; k < 8; k++)
+         crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+   }
+   return ~crc;
+#endif
+}
+
+// Flash behind the log: byte addresses relative to the partition start.
+class LogFlash
+{
+public:
+   virtual ~LogFlash() {}
+   virtual uint32_t size() const = 0;
+   virtual bool read(uint32_t addr, void *buf, uint32_t len) = 0;
+   virtual bool write(uint32_t addr, const void *buf, uint32_t len) = 0;
+   virtual bool eraseSector(uint32_t addr) = 0;
+};
+
+#ifdef ESP_PLATFORM
+class PartitionLogFlash : public LogFlash
+{
+   const esp_partition_t *part = nullptr;
+
+public:
+   bool begin()
+   {
+      part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)LOG_PARTITION_SUBTYPE,
+                                      LOG_PARTITION_LABEL);
+      return part != nullptr;
+   }
+   uint32_t size() const override { return part ? part->size : 0; }
+   bool read(uint32_t addr, void *buf, uint32_t len) override { return esp_partition_read(part, addr, buf, len) == ESP_OK; }
+   bool write(uint32_t addr, const void *buf, uint32_t len) override { return esp_partition_write(part, addr, buf, len) == ESP_OK; }
+   bool eraseSector(uint32_t addr) override { return esp_partition_erase_range(part, addr, LOG_SECTOR_SIZE) == ESP_OK; }
+};
+#endif
+
+class RamLogFlash : public LogFlash
+{
+   uint8_t *mem;
+   uint32_t bytes;
+
+public:
+   explicit RamLogFlash(uint32_t sectors) : bytes(sectors * LOG_SECTOR_SIZE)
+   {
+      mem = (uint8_t *)malloc(bytes);
+      if (mem)
+         memset(mem, 0xFF, bytes);
+      else
+         bytes = 0;
+   }
+   ~RamLogFlash() override { free(mem); }
+   uint32_t size() const override { return bytes; }
+   bool read(uint32_t addr, void *buf, uint32_t len) override
+   {
+      if (addr + len > bytes)
+         return false;
+      memcpy(buf, mem + addr, len);
+      return true;
+   }
+   bool write(uint32_t addr, const void *buf, uint32_t len) override
+   {
+      if (addr + len > bytes)
+         return false;
+      for (uint32_t i = 0; i < len; i++)
+         mem[addr + i] &= ((const uint8_t *)buf)[i];
+      return true;
+   }
+   bool eraseSector(uint32_t addr) override
+   {
+      if (addr % LOG_SECTOR_SIZE || addr >= bytes)
+         return false;
+      memset(mem + addr, 0xFF, LOG_SECTOR_SIZE);
+      return true;
+   }
+};
+
+// Read position for walking the log backwards.
+struct LogCursor
+{
+   uint16_t sector;
+   uint16_t slot; // next record to return is slot - 1
+   uint32_t sectorSeq;
+};
+
+class HistoryLog
+{
+   LogFlash *flash;
+   uint16_t sectors;
+   int32_t head;           // sector being written, -1 = none yet
+   uint32_t headSectorSeq;
+   uint16_t writeSlot;     // next free record slot in head (1-based, slot 0 = header)
+   uint32_t nextSeq;
+   uint32_t bytesWritten;
+   uint32_t maxErase;      // highest erase count on any sector
+
+   static uint32_t crcOf(const void *p, uint32_t len) { return logCrc32(LOG_MAGIC, (const uint8_t *)p, len); }
+
+   uint32_t addr(uint16_t sector, uint16_t slot) const { return (uint32_t)sector * LOG_SECTOR_SIZE + slot * LOG_RECORD_SIZE; }
+
+   bool readHeader(uint16_t sector, LogSectorHeader &h)
+   {
+      return flash->read(addr(sector, 0), &h, sizeof(h)) && h.crc == crcOf(&h, sizeof(h) - sizeof(h.crc));
+   }
+
+   bool slotErased(uint16_t sector, uint16_t slot)
+   {
+      uint32_t w[LOG_RECORD_SIZE / 4];
+      if (!flash->read(addr(sector, slot), w, sizeof(w)))
+         return false;
+      for (uint8_t i = 0; i < LOG_RECORD_SIZE / 4; i++)
+         if (w[i] != 0xFFFFFFFFu)
+            return false;
+      return true;
+   }
+
+   // Erase the sector after head and make it the new head. Sectors open in
+   // ring order, so one whose header was lost to a torn write has been
+   // erased once less than head, or as often when it starts a new lap.
+   bool openSector()
+   {
+      uint16_t s = head < 0 ? 0 : (uint16_t)((head + 1) % sectors);
+      LogSectorHeader h;
+      uint32_t erases = 0;
+      if (readHeader(s, h))
+         erases = h.eraseCount;
+      else if (head >= 0 && readHeader(head, h))
+         erases = s == 0 ? h.eraseCount : h.eraseCount - 1;
+      if (!flash->eraseSector(addr(s, 0)))
+         return false;
+      h.sectorSeq = head < 0 ? 1 : headSectorSeq + 1;
+      h.firstSeq = nextSeq;
+      h.eraseCount = erases + 1;
+      h.crc = crcOf(&h, sizeof(h) - sizeof(h.crc));
+      if (!flash->write(addr(s, 0), &h, sizeof(h)))
+         return false;
+      bytesWritten += sizeof(h);
+      if (h.eraseCount > maxErase)
+         maxErase = h.eraseCount;
+      head = s;
+      headSectorSeq = h.sectorSeq;
+      writeSlot = 1;
+      return true;
+   }
+
+public:
+   HistoryLog() : flash(nullptr), sectors(0), head(-1), headSectorSeq(0), writeSlot(1), nextSeq(1), bytesWritten(0), maxErase(0) {}
+
+   // Find the tail: newest valid sector header, then the first erased slot in
+   // that sector. False when the flash is missing or holds under 2 sectors.
+   bool begin(LogFlash &f)
+   {
+      flash = &f;
+      sectors = f.size() / LOG_SECTOR_SIZE;
+      head = -1;
+      headSectorSeq = 0;
+      writeSlot = 1;
+      nextSeq = 1;
+      maxErase = 0;
+      if (sectors < 2)
+         return false;
+
+      LogSectorHeader h;
+      uint32_t headFirstSeq = 1;
+      for (uint16_t s = 0; s < sectors; s++)
+      {
+         if (!readHeader(s, h))
+            continue;
+         if (h.eraseCount > maxErase)
+            maxErase = h.eraseCount;
+         if (head < 0 || (int32_t)(h.sectorSeq - headSectorSeq) > 0)
+         {
+            head = s;
+            headSectorSeq = h.sectorSeq;
+            headFirstSeq = h.firstSeq;
+         }
+      }
+      if (head < 0)
+         return true; // empty: the first append formats sector 0
+
+      // Slots fill in order, so "erased" flips once: binary search for it
+      uint16_t lo = 1, hi = LOG_RECORDS_PER_SECTOR + 1;
+      while (lo < hi)
+      {
+         uint16_t mid = (lo + hi) / 2;
+         if (slotErased(head, mid))
+            hi = mid;
+         else
+            lo = mid + 1;
+      }
+      writeSlot = lo;
+
+      // Next seq follows the newest intact record (a torn one is skipped)
+      nextSeq = headFirstSeq;
+      for (uint16_t slot = writeSlot; slot > 1; slot--)
+      {
+         LogRecord r;
+         if (readRecord(head, slot - 1, r))
+         {
+            nextSeq = r.seq + 1;
+            break;
+         }
+      }
+      return true;
+   }
+
+   bool ready() const { return flash != nullptr && sectors >= 2; }
+
+   // Seq of the newest record, 0 when empty.
+   uint32_t lastSeq() const { return nextSeq - 1; }
+
+   uint32_t getBytesWritten() const { return bytesWritten; }
+
+   // Append one sample; assigns and returns its seq in rec.seq.
+   bool append(LogRecord &rec)
+   {
+      if (!ready())
+         return false;
+      if (head < 0 || writeSlot > LOG_RECORDS_PER_SECTOR)
+      {
+         if (!openSector())
+            return false;
+      }
+      rec.seq = nextSeq;
+      memset(rec.spare, 0xFF, sizeof(rec.spare));
+      rec.crc = crcOf(&rec, sizeof(rec) - sizeof(rec.crc));
+      // A failed write that left bits programmed uses up its slot
+      if (!flash->write(addr(head, writeSlot), &rec, sizeof(rec)))
+      {
+         if (!slotErased(head, writeSlot))
+            writeSlot++;
+         return false;
+      }
+      writeSlot++;
+      bytesWritten += sizeof(rec);
+      nextSeq++;
+      return true;
+   }
+
+   // Intact record in a slot (1-based).
+   bool readRecord(uint16_t sector, uint16_t slot, LogRecord &r)
+   {
+      return flash->read(addr(sector, slot), &r, sizeof(r)) && r.crc == crcOf(&r, sizeof(r) - sizeof(r.crc)) && r.seq != 0;
+   }
+
+   // Cursor just past the newest record.
+   LogCursor tail() const
+   {
+      LogCursor c;
+      c.sector = head < 0 ? 0 : (uint16_t)head;
+      c.slot = head < 0 ? 1 : writeSlot;
+      c.sectorSeq = headSectorSeq;
+      return c;
+   }
+
+   // Step back to the previous intact record; false at the start of the log.
+   bool prev(LogCursor &c, LogRecord &r)
+   {
+      if (head < 0)
+         return false;
+      while (true)
+      {
+         while (c.slot > 1)
+         {
+            c.slot--;
+            if (readRecord(c.sector, c.slot, r))
+               return true;
+         }
+         // Previous sector in the ring, if it still holds the sector before
+         uint16_t s = (c.sector + sectors - 1) % sectors;
+         LogSectorHeader h;
+         if (s == (uint16_t)head || !readHeader(s, h) || h.sectorSeq != c.sectorSeq - 1)
+            return false;
+         c.sector = s;
+         c.slot = LOG_RECORDS_PER_SECTOR + 1;
+         c.sectorSeq = h.sectorSeq;
+      }
+   }
+
+   // Erase count of the most worn sector (wear report).
+   uint32_t maxEraseCount() const { return maxErase; }
+};
+
+#endif // HISTORYLOG_H
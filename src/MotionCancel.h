@@ -0,0 +1,187 @@
+#ifndef MOTIONCANCEL_H
+#define MOTIONCANCEL_H
+
+#include <stdint.h>
+#include "DSPCore.h"
+
+/*
+ * Motion-artifact cancellation with the accelerometer as noise reference.
+ *
+ * Wrist motion reaches the PPG through a short, slowly changing path (sensor
+ * and tissue displacement). Each accel axis goes through the same bandpass as
+ * the PPG, so both carry the same phase delay. An RLS filter (MOTION_TAPS
+ * taps per axis) then learns the path from the three references to the
+ * bandpassed PPG, and its prediction is subtracted before peak detection.
+ *
+ * RLS rather than NLMS: the pulse is the "noise" the filter must not fit, and
+ * NLMS with a step size fast enough to follow a change of gait left a residual
+ * of about half the pulse amplitude; RLS settles within a second with a
+ * misadjustment set by its forgetting window.
+ *
+ * Adaptation is gated twice. While the reference is below the gate (at rest)
+ * the filter is frozen, which also stops the inverse correlation matrix from
+ * growing without excitation. While moving, it adapts only when the PPG is
+ * clearly louder than at rest; otherwise there is no artifact to remove and
+ * the filter would only learn to cancel the pulse.
+ *
+ * Float arithmetic in both DSP modes: 9 weights, ~250 flops per sample.
+ */
+
+#define MOTION_AXES 3
+#define MOTION_TAPS 3 // per axis; 60 ms at 50 Hz
+#define MOTION_WEIGHTS (MOTION_AXES * MOTION_TAPS)
+#define MOTION_RLS_WINDOW 200 // forgetting time constant, samples (4 s at 50 Hz)
+#define MOTION_RLS_DELTA 1e-2f // initial inverse correlation (1/counts²), also its trace limit
+#define MOTION_PPG_RISE 3.0f   // PPG power over its resting level to adapt
+#define MOTION_RECENT_SHIFT 6 // PPG power EMA, 1.3 s at 50 Hz
+#define MOTION_REST_SHIFT 8   // resting PPG power EMA, 5 s at 50 Hz
+
+class MotionCanceller
+{
+   DspBiquad coeffs[DSP_MAX_SECTIONS]; // one bandpass, shared by the axes
+   DspBiquadState state[MOTION_AXES][DSP_MAX_SECTIONS];
+   bool anchored;
+   int16_t anchor[MOTION_AXES]; // first sample; keeps gravity out of the filter
+
+   float u[MOTION_WEIGHTS]; // delay lines, axis-major, newest first (counts)
+   float w[MOTION_WEIGHTS];
+   float P[MOTION_WEIGHTS][MOTION_WEIGHTS]; // inverse reference correlation
+   float gatePower; // reference power below which the filter is frozen
+
+   float restPower;   // PPG power while the reference is below the gate
+   float recentPower; // PPG power over the last ~1 s
+   bool haveRest;
+
+   uint32_t samples;
+   uint32_t motionSamples;
+   float inPower, outPower; // PPG power before/after cancellation, while adapting
+
+   void adapt(float e)
+   {
+      // Forget only while P is bounded: directions the references do not
+      // excite (a periodic swing spans few of them) would otherwise grow
+      // without limit and break the float update.
+      float trace = 0.0f;
+      for (uint8_t i = 0; i < MOTION_WEIGHTS; i++)
+         trace += P[i][i];
+      const float lambda = trace < MOTION_WEIGHTS / MOTION_RLS_DELTA ? 1.0f - 1.0f / MOTION_RLS_WINDOW : 1.0f;
+
+      float Pu[MOTION_WEIGHTS];
+      float den = lambda; // lambda + u'Pu
+      for (uint8_t i = 0; i < MOTION_WEIGHTS; i++)
+      {
+         float s = 0.0f;
+         for (uint8_t j = 0; j < MOTION_WEIGHTS; j++)
+            s += P[i][j] * u[j];
+         Pu[i] = s;
+         den += u[i] * s;
+      }
+      for (uint8_t i = 0; i < MOTION_WEIGHTS; i++)
+      {
+         float k = Pu[i] / den;
+         w[i] += k * e;
+         // P = (P - k Pu') / lambda, kept exactly symmetric
+         for (uint8_t j = i; j < MOTION_WEIGHTS; j++)
+         {
+            float v = (P[i][j] - k * Pu[j]) / lambda;
+            P[i][j] = P[j][i] = v;
+         }
+      }
+   }
+
+public:
+   // sos: the PPG bandpass. gateCounts: bandpassed accel RMS (counts, per
+   // axis) above which the filter adapts.
+   MotionCanceller(const float (*sos)[6], float gateCounts)
+   {
+      dspLoadSOS(sos, DSP_MAX_SECTIONS, coeffs);
+      gatePower = MOTION_WEIGHTS * gateCounts * gateCounts;
+      reset();
+   }
+
+   void reset()
+   {
+      for (uint8_t a = 0; a < MOTION_AXES; a++)
+         for (uint8_t s = 0; s < DSP_MAX_SECTIONS; s++)
+            dspBiquadReset(state[a][s]);
+      for (uint8_t i = 0; i < MOTION_WEIGHTS; i++)
+      {
+         u[i] = w[i] = 0.0f;
+         for (uint8_t j = 0; j < MOTION_WEIGHTS; j++)
+            P[i][j] = (i == j) ? 1.0f / MOTION_RLS_DELTA : 0.0f;
+      }
+      anchored = false;
+      restPower = recentPower = 0.0f;
+      haveRest = false;
+      samples = motionSamples = 0;
+      inPower = outPower = 0.0f;
+   }
+
+   // y: bandpassed PPG sample; accel: raw counts per axis taken at the same
+   // time. Returns y minus the motion-correlated part.
+   dsp_sample_t process(dsp_sample_t y, const int16_t accel[MOTION_AXES])
+   {
+      if (!anchored)
+      {
+         for (uint8_t a = 0; a < MOTION_AXES; a++)
+            anchor[a] = accel[a];
+         anchored = true;
+      }
+
+      for (uint8_t a = 0; a < MOTION_AXES; a++)
+      {
+         dsp_sample_t x = dspFromCounts(accel[a] - anchor[a]);
+         for (uint8_t s = 0; s < DSP_MAX_SECTIONS; s++)
+            x = dspBiquadStep(coeffs[s], state[a][s], x);
+         float *line = u + a * MOTION_TAPS;
+         for (uint8_t k = MOTION_TAPS - 1; k > 0; k--)
+            line[k] = line[k - 1];
+         line[0] = dspToCounts(x);
+      }
+      float pred = 0.0f, power = 0.0f;
+      for (uint8_t i = 0; i < MOTION_WEIGHTS; i++)
+      {
+         pred += w[i] * u[i];
+         power += u[i] * u[i];
+      }
+      samples++;
+
+      float yc = dspToCounts(y);
+      float e = yc - pred;
+#if DSP_FIXED_POINT
+      dsp_sample_t out = y - (dsp_sample_t)(pred * (1 << DSP_FRAC_BITS));
+#else
+      dsp_sample_t out = e;
+#endif
+      recentPower += (yc * yc - recentPower) * (1.0f / (1 << MOTION_RECENT_SHIFT));
+
+      if (power <= gatePower)
+      {
+         // At rest: track the pulse-only power level
+         if (!haveRest)
+            restPower = yc * yc;
+         restPower += (yc * yc - restPower) * (1.0f / (1 << MOTION_REST_SHIFT));
+         haveRest = true;
+         return out;
+      }
+      motionSamples++;
+      if (haveRest && recentPower <= MOTION_PPG_RISE * restPower)
+         return out;
+
+      adapt(e);
+      inPower += yc * yc;
+      outPower += e * e;
+      return out;
+   }
+
+   // Share of samples with the reference above the gate, percent.
+   uint8_t motionPct() const
+   {
+      return samples ? (uint8_t)((uint64_t)motionSamples * 100 / samples) : 0;
+   }
+
+   // PPG power left after cancellation while adapting, percent of the input.
+   float residualPct() const { return inPower > 0.0f ? 100.0f * outPower / inPower : 100.0f; }
+};
+
+#endif // MOTIONCANCEL_H
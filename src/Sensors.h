@@ -4,8 +4,16 @@
 #include <Wire.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include "MAX30105.h"
 #include "SparkFun_BMA400_Arduino_Library.h"
+#include "DSPCore.h"
+#include "FilterDesign.h"
+#include "HRVSpectrum.h"
+#include "SignalQuality.h"
+#include "SpO2.h"
+#include "SpectralHR.h"
+#include "StreamingHR.h"
 
 // Pin definitions
 #define BATTERY_PIN A0
@@ -23,30 +31,233 @@
 
 // Heart rate thresholds
 #define IR_WRIST_THRESHOLD 50000
+
+// Wrist presence check at wake (detectWristPresence()): a short IR read
+// decides whether the session runs at all.
+#ifndef WRIST_PRESENCE_CHECK
+#define WRIST_PRESENCE_CHECK 1
+#endif
+#define PRESENCE_CHECK_MS 100                   // ~10 FIFO samples
+#define PRESENCE_MIN_DC (IR_WRIST_THRESHOLD / 4) // lenient: the session re-checks
 #define MIN_BPM 40
 #define MAX_BPM 180
 
+// Acquisition profile: the MAX30102 ADC runs at PPG_ADC_RATE_HZ and averages
+// PPG_SAMPLE_AVERAGE conversions on chip, so the FIFO delivers
+// PPG_OUTPUT_RATE_HZ. A CIC stage then decimates by PPG_DECIMATION, and the
+// bandpass and peak detection run at FILTER_FS. Beat times are refined by
+// parabolic interpolation, so RR resolution is not tied to the sample period.
+#ifndef PPG_SAMPLE_AVERAGE
+#define PPG_SAMPLE_AVERAGE 4 // 1 = 400 Hz, 4 = 100 Hz, 8 = 50 Hz
+#endif
+#ifndef PPG_DECIMATION
+#define PPG_DECIMATION 2 // power of two; 100 Hz FIFO → 50 Hz DSP
+#endif
+#define PPG_ADC_RATE_HZ 400
+#define PPG_OUTPUT_RATE_HZ (PPG_ADC_RATE_HZ / PPG_SAMPLE_AVERAGE)
+
+// LED configuration, chosen per session (measureHeartRate()). IR only drives
+// one LED, half the LED energy of Red + IR. SpO2 reads both channels in the
+// same FIFO burst and adds a ratio-of-ratios estimate (SpO2.h, streaming
+// pipeline only).
+#define PPG_MODE_IR_ONLY 0
+#define PPG_MODE_SPO2 1
+#ifndef PPG_SPO2_SESSION_INTERVAL
+#define PPG_SPO2_SESSION_INTERVAL 6 // every 6th session reads SpO2 (0 = never)
+#endif
+#define PPG_LED_AMPLITUDE 0x1F // 0 = off to 255 = 50 mA; first session's setting
+#define PPG_PULSE_WIDTH_US 411  // LED on time per conversion (69, 118, 215, 411)
+
+// LED current control (AGC): before each session the LED amplitudes, and the
+// ADC range at the amplitude limits, are steered until the DC level sits in a
+// target window. Sessions start from the previous session's setting and DC
+// level, kept in RTC memory, so most need a single check.
+#ifndef PPG_LED_AGC
+#define PPG_LED_AGC 1
+#endif
+#define AGC_SETTLE_MS 1000     // time limit per session
+#define AGC_MEASURE_MS 80      // DC average per step (8 FIFO samples)
+#define AGC_MIN_AC_COUNTS 256  // pulse amplitude (peak to peak) to aim for
+#define AGC_DC_MIN 80000       // target DC window; 18-bit ADC, full scale 262143
+#define AGC_DC_MAX 200000      // headroom below saturation for motion swings
+#define AGC_DC_TOL_PCT 20      // settled within this distance of the target
+#define AGC_NO_SKIN_DC 5000    // nothing reflects: leave the LEDs as they are
+#define AGC_MIN_AMPLITUDE 0x04 // 0.8 mA
+#define AGC_MAX_AMPLITUDE 0xFF
+#define AGC_UA_PER_STEP 200    // LED current per amplitude step
+
 // Sampling and filter constants
-#define SAMPLE_INTERVAL_MS 2  // 400 Hz sample rate
-#define FILTER_FS 400         // Must match 1000/SAMPLE_INTERVAL_MS
-#define PEAK_MIN_DISTANCE 160 // 0.4s at 400 Hz (max ~150 BPM)
-#define PEAK_MAX_COUNT 300    // Max peaks in one measurement window
+#define FILTER_FS (PPG_OUTPUT_RATE_HZ / PPG_DECIMATION)
+#define HR_MS_TO_SAMPLES(ms) ((uint32_t)(ms) * FILTER_FS / 1000)
+#define PEAK_MIN_DISTANCE HR_MS_TO_SAMPLES(400) // 0.4 s (max ~150 BPM)
+#define PEAK_MAX_COUNT 512    // Max local maxima (peak candidates) in one measurement window
+#define PEAK_STACK_DEPTH 64   // Pending maxima in detectPeaks() (descending run of peaks)
+
+// HR pipeline selection: 1 = streaming (filter + peak detection per sample,
+// constant memory), 0 = batch (buffer whole window, zero-phase filtfilt).
+#ifndef HR_STREAMING_PIPELINE
+#define HR_STREAMING_PIPELINE 1
+#endif
+#define STREAM_WARMUP_MS 2000     // Filter settle time before peaks are accepted
+#define STREAM_VAR_WINDOW_MS 4000 // Time constant of the running stddev threshold
+
+// Analysed window per session (what the former 60 s batch capture kept after
+// trimming 2 s filter edges on each side). Batch filtfilt now starts from
+// steady state and uses every sample; streaming adds its warmup on top.
+#define HR_ANALYSIS_WINDOW_MS 56000UL
+#if HR_STREAMING_PIPELINE
+#define HR_MEASUREMENT_MS (HR_ANALYSIS_WINDOW_MS + STREAM_WARMUP_MS)
+#else
+#define HR_MEASUREMENT_MS HR_ANALYSIS_WINDOW_MS
+#endif
+
+// Adaptive session length: HR_MEASUREMENT_MS becomes the upper bound and the
+// capture ends as soon as the running mean RR and SDRR are known well enough
+// (95% CI half-widths below the given fraction of each estimate).
+#ifndef HR_ADAPTIVE_DURATION
+#define HR_ADAPTIVE_DURATION 1
+#endif
+#define HR_MIN_MEASUREMENT_MS 20000UL // never stop before this
+#define HR_CONVERGE_MIN_RR 15         // RR intervals required before testing
+#define HR_CONVERGE_MEAN_TOL_PCT 3    // mean RR CI half-width, % of mean RR
+#define HR_CONVERGE_SDRR_TOL_PCT 25   // SDRR CI half-width, % of SDRR
+
+// Spectral HR (Goertzel bank, SpectralHR.h): replaces the BPM when peak
+// detection fails and flags sessions where the two estimates disagree.
+#ifndef HR_SPECTRAL_FALLBACK
+#define HR_SPECTRAL_FALLBACK 1
+#endif
+#define HR_SPECTRAL_MIN_PEAK_RATIO 6.0f // peak bin power / mean bin power to trust it
+#define HR_SPECTRAL_SEGMENT_MS 8000     // Goertzel segment; spectra averaged per segment
+#define HR_SPECTRAL_AGREE_BPM 5         // larger difference sets bpmDisagree
+
+// Respiration from the PPG baseline (0.1-0.5 Hz band of the same input,
+// StreamingRespiration): one peak per breath.
+#ifndef HR_RESPIRATION
+#define HR_RESPIRATION 1
+#endif
+#define RESP_MIN_BRPM 6
+#define RESP_MAX_BRPM 30
+#define RESP_MIN_BREATH_MS 2000   // peak distance, 30 breaths/min
+#define RESP_WARMUP_MS 4000       // band settle time
+#define RESP_VAR_WINDOW_MS 15000  // time constant of the breath threshold
+
+// Windowed signal quality (SignalQuality.h): HR/HRV come only from the RR
+// intervals inside good windows, and a first window without a pulse ends the
+// session early.
+#ifndef HR_SIGNAL_QUALITY
+#define HR_SIGNAL_QUALITY 1
+#endif
+#define SQI_WINDOW_MS 4000       // 3-8 beats per window
+#define SQI_MIN_GOOD_RR 10       // fewer good intervals: keep the whole session
+
+// Motion-artifact cancellation (MotionCancel.h): the BMA400 FIFO is read
+// alongside the PPG and an RLS filter removes the accel-correlated part of
+// the bandpassed signal. Streaming pipeline only; batch keeps plain filtfilt.
+#ifndef HR_MOTION_CANCEL
+#define HR_MOTION_CANCEL 1
+#endif
+#define ACCEL_RANGE_G 16                        // must match setRange() in initIMU()
+#define ACCEL_COUNTS_PER_G (2048 / ACCEL_RANGE_G) // 12-bit samples
+#define MOTION_GATE_MG 20                       // adapt while bandpassed accel RMS exceeds this
+
+// Workout mode (runWorkout()): the streaming pipeline without a time limit,
+// HR from a sliding window of RR intervals published every WORKOUT_UPDATE_MS.
+#define WORKOUT_WINDOW_MS 8000   // RR intervals spanning this make one estimate
+#define WORKOUT_UPDATE_MS 3000   // publish interval
+#define WORKOUT_MIN_RR 4         // fewer intervals in the window: no estimate
+#define WORKOUT_MAX_MS (2UL * 60UL * 60UL * 1000UL)
+#define WORKOUT_MAX_SECONDS (WORKOUT_MAX_MS / 1000)
+
+// BMA400 FIFO acquisition (registers not wrapped by the SparkFun library)
+#define BMA400_I2C_ADDR 0x14
+#define BMA400_REG_FIFO_LENGTH0 0x12
+#define BMA400_REG_FIFO_DATA 0x14
+#define BMA400_REG_FIFO_CONFIG0 0x26
+#define BMA400_REG_CMD 0x7E
+#define BMA400_FIFO_XYZ_FILT2 0xE8      // x/y/z, 12 bit, source acc_filt2
+#define BMA400_CMD_FIFO_FLUSH 0xB0
+#define BMA400_FIFO_HEADER_XYZ 0x8E
+#define BMA400_FIFO_HEADER_CONTROL 0x48 // one payload byte
+#define BMA400_FIFO_FRAME_BYTES 7       // header + 3 × 2 bytes
+#define BMA400_FIFO_RATE_HZ 100         // acc_filt2 rate
+
+// MAX30102 FIFO acquisition
+#define MAX30102_I2C_ADDR 0x57
+#define MAX30102_REG_FIFO_WR_PTR 0x04 // followed by OVF_COUNTER (0x05), FIFO_RD_PTR (0x06)
+#define MAX30102_REG_FIFO_DATA 0x07
+#define MAX30102_FIFO_DEPTH 32
+// LED mode and slot values (private to the SparkFun library)
+#define MAX30102_REG_MODE_SPO2 0x03 // Red (slot 1) + IR (slot 2)
+#define MAX30102_REG_MODE_MULTI_LED 0x07
+#define MAX30102_SLOT_IR 0x02
+#define MAX30102_ADC_RANGE(r) ((uint8_t)((r) << 5)) // full scale 2048 nA << r, r = 0..3
+#define MAX30102_ADC_RANGE_MAX 3
+#define FIFO_DRAIN_INTERVAL_MS (16 * 1000 / PPG_OUTPUT_RATE_HZ) // 16 samples per burst; FIFO holds 32
 
 // Result struct for heart rate + HRV measurement
 struct HRVResult
 {
-   uint8_t bpm;      // Mean heart rate (0 = no reading)
-   uint16_t sdrr_ms; // SDRR in milliseconds (std dev of all RR intervals, no ectopic filtering)
-   bool valid;       // True when wrist was detected and enough peaks found
+   uint8_t bpm;             // Mean heart rate (0 = no reading)
+   uint16_t sdrr_ms;        // SDRR in milliseconds (std dev of the artifact-corrected RR intervals)
+   uint16_t rmssd_ms;       // RMSSD: root mean square of successive RR differences
+   uint8_t pnn50_pct;       // pNN50: successive differences > 50 ms, percent
+   uint16_t sd1_ms;         // Poincaré SD1 (short-term variability)
+   uint16_t sd2_ms;         // Poincaré SD2 (long-term variability)
+   uint16_t correctedBeats; // missed beats interpolated + split beats merged
+   uint16_t rejectedBeats;  // ectopic/artifact beats dropped
+   uint32_t lf_ms2;         // LF power 0.04-0.15 Hz (0 when the session is too short)
+   uint32_t hf_ms2;         // HF power 0.15-0.4 Hz
+   uint16_t lf_hf_x100;     // LF/HF ratio x 100
+   uint8_t spectralBpm;     // Goertzel HR estimate (0 = none or not trusted)
+   bool spectralFallback;   // bpm is spectralBpm; peaks unusable, no HRV metrics
+   bool bpmDisagree;        // peak and spectral BPM differ by > HR_SPECTRAL_AGREE_BPM
+   bool hrvPoorSignal;      // too few RR intervals in good SQI windows: bpm kept, no HRV metrics
+   uint8_t resp_brpm;       // Respiration rate, breaths/min (0 = too few breaths)
+   uint8_t motion_pct;      // Share of the session with wrist motion (accel above MOTION_GATE_MG)
+   uint8_t spo2_pct;        // SpO2 from the Red/IR ratio of ratios (0 = not measured)
+   uint32_t led_ua;         // LED drive current of the session, IR + Red, µA
+   uint8_t sqi_pct;         // Share of the SQI windows with good signal quality
+   bool poorContact;        // Aborted after the first window: no pulse under the sensor
+   bool valid;              // True when wrist was detected and enough peaks found
+   uint32_t durationMs;     // Capture time actually used (adaptive stop may end it early)
 };
 
-// Butterworth bandpass 0.5-5 Hz, order 4, fs=400 Hz  (SOS form, 4 sections × 6 coeffs)
-// Generated with: scipy.signal.butter(4, [0.5, 5.0], btype='band', fs=400, output='sos')
-static const float BANDPASS_SOS[4][6] = {
-    {1.4249966321e-06f, 2.8499932642e-06f, 1.4249966321e-06f, 1.0f, -1.8881015656f, 0.8921266839f},
-    {1.0f, 2.0f, 1.0f, 1.0f, -1.9464478276f, 0.9522195618f},
-    {1.0f, -2.0f, 1.0f, 1.0f, -1.9835071373f, 0.9835958332f},
-    {1.0f, -2.0f, 1.0f, 1.0f, -1.9948397875f, 0.9949039447f}};
+// Butterworth bandpass 0.5-5 Hz, order 4 (4 SOS sections), designed at compile
+// time for each DSP rate the acquisition profile can produce: 400 Hz ADC
+// divided by on-chip averaging and CIC decimation, 25-400 Hz.
+template <int FsHz>
+using HRBandpass = ButterworthBandpass<4, FsHz, 500, 5000>;
+
+static_assert(FILTER_FS >= 25 && FILTER_FS <= 400, "FILTER_FS outside the designed bandpass tables");
+static const float (*const BANDPASS_SOS)[6] = HRBandpass<FILTER_FS>::table.sos;
+static const float (*const RESP_SOS)[6] = ButterworthBandpass<4, FILTER_FS, 100, 500>::table.sos;
+
+#define BANDPASS_TABLE_COUNT 5
+static const uint16_t BANDPASS_RATES_HZ[BANDPASS_TABLE_COUNT] = {25, 50, 100, 200, 400};
+static const float (*const BANDPASS_TABLES[BANDPASS_TABLE_COUNT])[6] = {
+    HRBandpass<25>::table.sos, HRBandpass<50>::table.sos, HRBandpass<100>::table.sos,
+    HRBandpass<200>::table.sos, HRBandpass<400>::table.sos};
+
+// Table designed for the rate nearest (by ratio) to a measured sample rate
+static const float (*pickBandpassSOS(float fsHz, uint16_t &designFsHz))[6]
+{
+   int best = 0;
+   float bestRatio = 0.0f;
+   for (int i = 0; i < BANDPASS_TABLE_COUNT; i++)
+   {
+      float r = fsHz / BANDPASS_RATES_HZ[i];
+      if (r < 1.0f)
+         r = 1.0f / r;
+      if (i == 0 || r < bestRatio)
+      {
+         best = i;
+         bestRatio = r;
+      }
+   }
+   designFsHz = BANDPASS_RATES_HZ[best];
+   return BANDPASS_TABLES[best];
+}
 
 // Global sensor objects
 MAX30105 particleSensor;
@@ -81,12 +292,12 @@ bool initHeartRateSensor()
       return false;
    }
 
-   byte ledBrightness = 0x1F; // Options: 0=Off to 255=50mA
-   byte sampleAverage = 1;    // Options: 1, 2, 4, 8, 16, 32
-   byte ledMode = 2;          // Options: 1 = Red only, 2 = Red + IR, 3 = Red + IR + Green
-   int sampleRate = 400;      // Options: 50, 100, 200, 400, 800, 1000, 1600, 3200
-   int pulseWidth = 411;      // Options: 69, 118, 215, 411
-   int adcRange = 4096;       // Options: 2048, 4096, 8192, 16384
+   byte ledBrightness = PPG_LED_AMPLITUDE;  // Options: 0=Off to 255=50mA
+   byte sampleAverage = PPG_SAMPLE_AVERAGE; // Options: 1, 2, 4, 8, 16, 32
+   byte ledMode = 2;                        // Options: 1 = Red only, 2 = Red + IR, 3 = Red + IR + Green
+   int sampleRate = PPG_ADC_RATE_HZ;        // Options: 50, 100, 200, 400, 800, 1000, 1600, 3200
+   int pulseWidth = PPG_PULSE_WIDTH_US;     // Options: 69, 118, 215, 411
+   int adcRange = 4096;                     // Options: 2048, 4096, 8192, 16384
 
    particleSensor.setup(ledBrightness, sampleAverage, ledMode, sampleRate, pulseWidth, adcRange);
 
@@ -94,6 +305,626 @@ bool initHeartRateSensor()
    return true;
 }
 
+// LED mode of the session with the given number: SpO2 every
+// PPG_SPO2_SESSION_INTERVAL sessions, IR only otherwise.
+uint8_t ppgModeForSession(uint32_t session)
+{
+#if HR_STREAMING_PIPELINE
+   if (PPG_SPO2_SESSION_INTERVAL > 0 && session % PPG_SPO2_SESSION_INTERVAL == 0)
+      return PPG_MODE_SPO2;
+#else
+   (void)session;
+#endif
+   return PPG_MODE_IR_ONLY;
+}
+
+// LED setting of the previous session and the levels it gave (RTC memory,
+// survives deep sleep). Index PPG_LED_RED / PPG_LED_IR.
+#define PPG_LED_RED 0
+#define PPG_LED_IR 1
+RTC_DATA_ATTR uint8_t ppgLedAmplitude[2] = {PPG_LED_AMPLITUDE, PPG_LED_AMPLITUDE};
+RTC_DATA_ATTR uint8_t ppgAdcRange = 1;         // 4096 nA, as set up in initHeartRateSensor()
+RTC_DATA_ATTR uint32_t ppgLastDc[2] = {0, 0};  // mean raw level (0 = not measured)
+RTC_DATA_ATTR uint16_t ppgLastPiX1000 = 0;     // perfusion index, percent x 1000 (0 = unknown)
+
+// Write the stored amplitudes and ADC range; Red only when channels == 2.
+static void applyLedSettings(uint8_t channels)
+{
+   particleSensor.setADCRange(MAX30102_ADC_RANGE(ppgAdcRange));
+   particleSensor.setPulseAmplitudeIR(ppgLedAmplitude[PPG_LED_IR]);
+   particleSensor.setPulseAmplitudeRed(channels == 2 ? ppgLedAmplitude[PPG_LED_RED] : 0);
+}
+
+// LED drive current for the given FIFO slots, µA.
+static uint32_t ledCurrentUa(uint8_t channels)
+{
+   uint32_t steps = ppgLedAmplitude[PPG_LED_IR] + (channels == 2 ? ppgLedAmplitude[PPG_LED_RED] : 0);
+   return steps * AGC_UA_PER_STEP;
+}
+
+// Average LED current for the given FIFO slots, µA: the drive current times
+// the duty cycle (one PPG_PULSE_WIDTH_US pulse per conversion). 64-bit: the
+// product passes 2^32 above ~26 mA of drive.
+static uint32_t ledAverageUa(uint8_t channels)
+{
+   return (uint32_t)((uint64_t)ledCurrentUa(channels) * PPG_ADC_RATE_HZ * PPG_PULSE_WIDTH_US / 1000000UL);
+}
+
+// Switch the LEDs for one session. Returns the FIFO slots in use.
+static uint8_t setPPGMode(uint8_t mode)
+{
+   if (mode == PPG_MODE_SPO2)
+   {
+      applyLedSettings(2);
+      particleSensor.setLEDMode(MAX30102_REG_MODE_SPO2);
+      return 2;
+   }
+   // Multi-LED mode with IR alone in slot 1 (the single-LED mode drives Red)
+   particleSensor.disableSlots();
+   particleSensor.enableSlot(1, MAX30102_SLOT_IR);
+   applyLedSettings(1);
+   particleSensor.setLEDMode(MAX30102_REG_MODE_MULTI_LED);
+   return 1;
+}
+
+// ---------------------------------------------------------------------------
+// MAX30102 FIFO burst acquisition
+//
+// Instead of one getIR() call (pointer reads + data read) per sample, the
+// FIFO is left to fill and drained every FIFO_DRAIN_INTERVAL_MS in a single
+// burst. Each sample gets a timestamp reconstructed from the sensor's own
+// sample clock: sample k was taken at anchorUs + k * period, where period is
+// fitted from drain times over the session. This removes the loop-timing
+// jitter of the polled path, and lost samples (FIFO overflow) still advance
+// the clock.
+// ---------------------------------------------------------------------------
+// Timestamps from a sensor's own sample clock, shared by the FIFO readers.
+class FifoSampleClock
+{
+   uint32_t nominalPeriodUs;
+   uint32_t periodQ8; // sample period in 1/256 µs
+   bool anchored;
+   uint32_t anchorUs;
+   uint32_t produced; // samples produced by the sensor since begin(), incl. dropped
+
+public:
+   FifoSampleClock()
+       : nominalPeriodUs(2500), periodQ8(2500u << 8),
+         anchored(false), anchorUs(0), produced(0) {}
+
+   void begin(uint32_t periodUs)
+   {
+      nominalPeriodUs = periodUs;
+      periodQ8 = periodUs << 8;
+      anchored = false;
+      anchorUs = 0;
+      produced = 0;
+   }
+
+   // Account for n samples leaving the FIFO, read or lost to an overflow.
+   void advance(uint32_t n) { produced += n; }
+
+   // Called when avail samples were found in the FIFO at nowUs; anchors the
+   // clock on the first call and refits the period afterwards.
+   void sync(uint32_t nowUs, uint32_t avail)
+   {
+      // The newest sample was converted within the last period before nowUs.
+      uint32_t newestIdx = produced + avail - 1;
+      uint32_t newestUs = nowUs - nominalPeriodUs / 2;
+      if (!anchored)
+      {
+         anchorUs = newestUs - (uint32_t)(((uint64_t)newestIdx * periodQ8) >> 8);
+         anchored = true;
+      }
+      else if (newestUs - anchorUs >= 1000000UL)
+      {
+         // Refit the period from the whole session so far; endpoint jitter
+         // (< 1 period) is spread over all samples.
+         periodQ8 = (uint32_t)(((uint64_t)(newestUs - anchorUs) << 8) / newestIdx);
+      }
+   }
+
+   // Acquisition time of the i-th sample still waiting in the FIFO.
+   uint32_t timeUs(uint32_t i) const
+   {
+      return anchorUs + (uint32_t)(((uint64_t)(produced + i) * periodQ8) >> 8);
+   }
+
+   uint32_t periodUsQ8() const { return periodQ8; }
+   bool isAnchored() const { return anchored; }
+};
+
+struct PPGSample
+{
+   uint32_t ir;
+   uint32_t red;   // 0 when only the IR slot is enabled
+   uint32_t timeUs; // reconstructed acquisition time (micros() timebase)
+};
+
+class MAX30102Fifo
+{
+   uint8_t bytesPerSample;
+   FifoSampleClock clock;
+
+   uint32_t dropped;
+   uint32_t bursts;
+   uint32_t transactions;
+   uint32_t lastDrainUs;
+   uint8_t left; // samples still in the FIFO after the last drain
+
+   bool readPointers(uint8_t &wr, uint8_t &ovf, uint8_t &rd)
+   {
+      Wire.beginTransmission(MAX30102_I2C_ADDR);
+      Wire.write(MAX30102_REG_FIFO_WR_PTR);
+      if (Wire.endTransmission(false) != 0)
+         return false;
+      // WR_PTR, OVF_COUNTER and RD_PTR are consecutive registers.
+      if (Wire.requestFrom(MAX30102_I2C_ADDR, 3) != 3)
+         return false;
+      wr = Wire.read() & 0x1F;
+      ovf = Wire.read() & 0x1F;
+      rd = Wire.read() & 0x1F;
+      transactions++;
+      return true;
+   }
+
+   static uint32_t read18(const uint8_t *p)
+   {
+      return (((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]) & 0x3FFFF;
+   }
+
+public:
+   MAX30102Fifo()
+       : bytesPerSample(6), dropped(0), bursts(0), transactions(0), lastDrainUs(0), left(0) {}
+
+   // sampleRateHz: rate configured in initHeartRateSensor().
+   // channels: active LED slots (2 = Red + IR, 1 = IR only).
+   void begin(uint16_t sampleRateHz, uint8_t channels)
+   {
+      bytesPerSample = 3 * channels;
+      clock.begin(1000000UL / sampleRateHz);
+      dropped = 0;
+      bursts = 0;
+      transactions = 0;
+      left = 0;
+      particleSensor.clearFIFO();
+      lastDrainUs = micros();
+   }
+
+   // Read everything currently in the FIFO (up to maxSamples) in one burst.
+   // Returns the number of samples written to out.
+   uint8_t drain(PPGSample *out, uint8_t maxSamples)
+   {
+      uint8_t wr, ovf, rd;
+      if (!readPointers(wr, ovf, rd))
+         return 0;
+      uint32_t nowUs = micros();
+
+      uint8_t avail = (wr - rd) & (MAX30102_FIFO_DEPTH - 1);
+      if (ovf > 0)
+      {
+         // FIFO rolled over: it is full and ovf older samples were lost.
+         avail = MAX30102_FIFO_DEPTH;
+         dropped += ovf;
+         clock.advance(ovf);
+      }
+      else if (avail == 0)
+      {
+         // WR_PTR == RD_PTR is also a full FIFO without an overflow yet: we
+         // left samples behind, or 31 more came since the last drain. Less
+         // time than that (less 1/16 for the clock) means empty or stalled.
+         uint32_t fullUs = (MAX30102_FIFO_DEPTH - 1) * (clock.periodUsQ8() >> 8);
+         if (left > 0 || nowUs - lastDrainUs >= fullUs - fullUs / 16)
+            avail = MAX30102_FIFO_DEPTH;
+      }
+      if (avail == 0)
+         return 0;
+      lastDrainUs = nowUs;
+      // Timestamps fit to the newest sample, so sync only on a complete drain
+      // (or to anchor the clock at all).
+      if (avail <= maxSamples || !clock.isAnchored())
+         clock.sync(nowUs, avail);
+      left = avail > maxSamples ? avail - maxSamples : 0;
+      avail -= left;
+
+      // Burst read, chunked to whole samples that fit the I2C buffer.
+      const uint8_t samplesPerChunk = I2C_BUFFER_LENGTH / bytesPerSample;
+      Wire.beginTransmission(MAX30102_I2C_ADDR);
+      Wire.write(MAX30102_REG_FIFO_DATA);
+      Wire.endTransmission();
+      transactions++;
+
+      uint8_t got = 0;
+      uint8_t raw[6];
+      while (got < avail)
+      {
+         uint8_t chunk = avail - got;
+         if (chunk > samplesPerChunk)
+            chunk = samplesPerChunk;
+         Wire.requestFrom(MAX30102_I2C_ADDR, (int)(chunk * bytesPerSample));
+         transactions++;
+         for (uint8_t i = 0; i < chunk; i++)
+         {
+            for (uint8_t b = 0; b < bytesPerSample; b++)
+               raw[b] = Wire.read();
+            PPGSample &s = out[got + i];
+            // Slot 1 = Red, slot 2 = IR (ledMode 2); a single slot carries IR.
+            if (bytesPerSample == 6)
+            {
+               s.red = read18(raw);
+               s.ir = read18(raw + 3);
+            }
+            else
+            {
+               s.red = 0;
+               s.ir = read18(raw);
+            }
+            s.timeUs = clock.timeUs(got + i);
+         }
+         got += chunk;
+      }
+
+      clock.advance(got);
+      bursts++;
+      return got;
+   }
+
+   // Sample period recovered from the sensor clock.
+   float periodMs() const { return (float)clock.periodUsQ8() / 256000.0f; }
+   uint32_t periodUsQ8() const { return clock.periodUsQ8(); }
+   uint32_t droppedSamples() const { return dropped; }
+   uint32_t burstCount() const { return bursts; }
+   uint32_t i2cTransactions() const { return transactions; }
+};
+
+MAX30102Fifo ppgFifo;
+
+// ---------------------------------------------------------------------------
+// LED current control (AGC)
+//
+// The pulse amplitude in counts scales with the LED current; the perfusion
+// index (AC/DC) does not. The DC level that gives AGC_MIN_AC_COUNTS of pulse
+// therefore follows from the last session's PI, and the AGC settles on the
+// lowest current that reaches it: dark skin or a loose strap get more
+// current, a tight fit less, and never enough to saturate.
+//
+// The AGC runs before the session instead of inside the pipeline warmup: a
+// DC step rings through the 0.5 Hz bandpass for seconds.
+// ---------------------------------------------------------------------------
+static_assert((uint64_t)AGC_DC_MIN * (100 - AGC_DC_TOL_PCT) / 100 > IR_WRIST_THRESHOLD,
+              "AGC window would drop the DC below the wrist threshold");
+
+static uint32_t agcTargetDc()
+{
+   uint32_t target = (AGC_DC_MIN + AGC_DC_MAX) / 2; // PI not known yet
+   if (ppgLastPiX1000 > 0)
+      target = (uint32_t)AGC_MIN_AC_COUNTS * 100000UL / ppgLastPiX1000;
+   return target < AGC_DC_MIN ? AGC_DC_MIN : target > AGC_DC_MAX ? AGC_DC_MAX : target;
+}
+
+// Scale the amplitudes of channels first..PPG_LED_IR from level dc to the
+// target (a channel with dc 0 keeps its amplitude). The ADC range moves when
+// the amplitudes leave their limits: half the full scale gives twice the
+// counts per mA. Returns false when the setting does not change.
+static bool agcRescale(uint8_t first, const uint32_t dc[2], uint32_t target)
+{
+   float want[2];
+   float most = 0.0f;
+   for (uint8_t c = first; c <= PPG_LED_IR; c++)
+   {
+      want[c] = ppgLedAmplitude[c];
+      if (dc[c] > 0)
+         want[c] *= (float)target / dc[c];
+      if (want[c] > most)
+         most = want[c];
+   }
+   uint8_t range = ppgAdcRange;
+   for (; most > AGC_MAX_AMPLITUDE && range > 0; range--)
+   {
+      most *= 0.5f;
+      for (uint8_t c = first; c <= PPG_LED_IR; c++)
+         want[c] *= 0.5f;
+   }
+   for (; want[PPG_LED_IR] < AGC_MIN_AMPLITUDE && 2.0f * most <= AGC_MAX_AMPLITUDE && range < MAX30102_ADC_RANGE_MAX; range++)
+   {
+      most *= 2.0f;
+      for (uint8_t c = first; c <= PPG_LED_IR; c++)
+         want[c] *= 2.0f;
+   }
+
+   bool changed = range != ppgAdcRange;
+   ppgAdcRange = range;
+   for (uint8_t c = first; c <= PPG_LED_IR; c++)
+   {
+      float w = want[c] < AGC_MIN_AMPLITUDE ? AGC_MIN_AMPLITUDE : want[c] > AGC_MAX_AMPLITUDE ? AGC_MAX_AMPLITUDE : want[c];
+      uint8_t amplitude = (uint8_t)(w + 0.5f);
+      changed |= amplitude != ppgLedAmplitude[c];
+      ppgLedAmplitude[c] = amplitude;
+   }
+   return changed;
+}
+
+// Settle the LEDs for a session in the mode set by setPPGMode() (channels:
+// its return value). One AGC_MEASURE_MS step when the previous setting still
+// fits, at most AGC_SETTLE_MS. The caller restarts the FIFO afterwards.
+static void runLedAgc(uint8_t channels)
+{
+#if PPG_LED_AGC
+   const uint8_t first = channels == 2 ? PPG_LED_RED : PPG_LED_IR;
+   uint32_t target = agcTargetDc();
+
+   // Between sessions: start from the last session's level (used once; it no
+   // longer matches the setting afterwards)
+   if (ppgLastDc[PPG_LED_IR] >= AGC_NO_SKIN_DC && agcRescale(first, ppgLastDc, target))
+   {
+      applyLedSettings(channels);
+      for (uint8_t c = first; c <= PPG_LED_IR; c++)
+         ppgLastDc[c] = 0;
+   }
+
+   PPGSample burst[MAX30102_FIFO_DEPTH];
+   uint32_t dc[2] = {0, 0};
+   uint8_t steps = 0;
+   uint32_t start = millis();
+   while (millis() - start < AGC_SETTLE_MS)
+   {
+      ppgFifo.begin(PPG_OUTPUT_RATE_HZ, channels);
+      delay(AGC_MEASURE_MS);
+      uint8_t n = ppgFifo.drain(burst, MAX30102_FIFO_DEPTH);
+      if (n < 2)
+      {
+         Serial.println("WARNING: no samples for the LED AGC");
+         break;
+      }
+      // The first sample may have been converted before the last change
+      uint64_t sum[2] = {0, 0};
+      for (uint8_t i = 1; i < n; i++)
+      {
+         sum[PPG_LED_RED] += burst[i].red;
+         sum[PPG_LED_IR] += burst[i].ir;
+      }
+      for (uint8_t c = 0; c < 2; c++)
+         dc[c] = (uint32_t)(sum[c] / (n - 1));
+      steps++;
+      if (dc[PPG_LED_IR] < AGC_NO_SKIN_DC)
+         break; // nothing on the sensor
+
+      bool settled = true;
+      for (uint8_t c = first; c <= PPG_LED_IR; c++)
+         if (dc[c] * 100 < target * (100 - AGC_DC_TOL_PCT) || dc[c] * 100 > target * (100 + AGC_DC_TOL_PCT))
+            settled = false;
+      if (settled || !agcRescale(first, dc, target))
+         break;
+      applyLedSettings(channels);
+   }
+
+   if (channels == 2)
+      Serial.printf("LED: IR %.1f mA, Red %.1f mA, ADC range %u nA, DC %lu / %lu (target %lu, %u steps)\n",
+                    ppgLedAmplitude[PPG_LED_IR] * AGC_UA_PER_STEP / 1000.0f,
+                    ppgLedAmplitude[PPG_LED_RED] * AGC_UA_PER_STEP / 1000.0f,
+                    2048u << ppgAdcRange, dc[PPG_LED_IR], dc[PPG_LED_RED], target, steps);
+   else
+      Serial.printf("LED: IR %.1f mA, ADC range %u nA, DC %lu (target %lu, %u steps)\n",
+                    ppgLedAmplitude[PPG_LED_IR] * AGC_UA_PER_STEP / 1000.0f,
+                    2048u << ppgAdcRange, dc[PPG_LED_IR], target, steps);
+#else
+   (void)channels;
+   Serial.printf("LED: IR %.1f mA\n", ppgLedAmplitude[PPG_LED_IR] * AGC_UA_PER_STEP / 1000.0f);
+#endif
+}
+
+// Wrist presence in PRESENCE_CHECK_MS: one IR-only FIFO read at the stored
+// LED setting. The MAX30102 has no proximity engine of its own (that is the
+// MAX30105's pilot LED), so this short read stands in for it. Returns true
+// when unsure, leaving the decision to the session's own wrist check.
+bool detectWristPresence()
+{
+   setPPGMode(PPG_MODE_IR_ONLY);
+   ppgFifo.begin(PPG_OUTPUT_RATE_HZ, 1);
+   delay(PRESENCE_CHECK_MS);
+   PPGSample burst[MAX30102_FIFO_DEPTH];
+   uint8_t n = ppgFifo.drain(burst, MAX30102_FIFO_DEPTH);
+   if (n < 2)
+   {
+      Serial.println("WARNING: no samples for the wrist check");
+      return true;
+   }
+   // The first sample may have been converted before the LED setting
+   uint64_t sum = 0;
+   for (uint8_t i = 1; i < n; i++)
+      sum += burst[i].ir;
+   uint32_t dc = (uint32_t)(sum / (n - 1));
+   bool present = dc >= PRESENCE_MIN_DC;
+   Serial.printf("Wrist check: IR %lu over %u samples -> %s\n", dc, n - 1, present ? "worn" : "not worn");
+   return present;
+}
+
+// Keep the session's levels for the next one. dc: mean raw Red / IR (Red 0
+// when not read); piPct: perfusion index, 0 when not measured.
+static void storeLedState(const uint32_t dc[2], float piPct)
+{
+   if (dc[PPG_LED_IR] < AGC_NO_SKIN_DC)
+      return; // off the wrist: nothing learned
+   ppgLastDc[PPG_LED_IR] = dc[PPG_LED_IR];
+   if (dc[PPG_LED_RED] > 0)
+      ppgLastDc[PPG_LED_RED] = dc[PPG_LED_RED];
+   if (piPct > 0.0f)
+      ppgLastPiX1000 = piPct >= 65.0f ? 65000 : (uint16_t)(piPct * 1000.0f + 0.5f);
+}
+
+// ---------------------------------------------------------------------------
+// BMA400 FIFO acquisition (motion reference for MotionCanceller)
+//
+// The accel FIFO is filled from acc_filt2, a fixed 100 Hz stream that is
+// independent of the 200 Hz ODR the tap detection runs on. It is drained
+// together with the MAX30102 FIFO and timestamped the same way.
+// ---------------------------------------------------------------------------
+struct AccelSample
+{
+   int16_t axis[3]; // x, y, z in counts (ACCEL_COUNTS_PER_G)
+   uint32_t timeUs;
+};
+
+class BMA400Fifo
+{
+   FifoSampleClock clock;
+   uint8_t frame[BMA400_FIFO_FRAME_BYTES]; // frame split across I2C chunks
+   uint8_t frameLen;
+   uint8_t frameNeed;
+   bool active;
+
+   bool writeRegister(uint8_t reg, uint8_t value)
+   {
+      Wire.beginTransmission(BMA400_I2C_ADDR);
+      Wire.write(reg);
+      Wire.write(value);
+      return Wire.endTransmission() == 0;
+   }
+
+   static int16_t read12(const uint8_t *p)
+   {
+      int16_t v = (int16_t)(((p[1] & 0x0F) << 8) | p[0]);
+      return v > 2047 ? v - 4096 : v;
+   }
+
+public:
+   BMA400Fifo() : frameLen(0), frameNeed(0), active(false) {}
+
+   bool begin()
+   {
+      frameLen = frameNeed = 0;
+      clock.begin(1000000UL / BMA400_FIFO_RATE_HZ);
+      active = writeRegister(BMA400_REG_FIFO_CONFIG0, BMA400_FIFO_XYZ_FILT2) &&
+               writeRegister(BMA400_REG_CMD, BMA400_CMD_FIFO_FLUSH);
+      return active;
+   }
+
+   void end()
+   {
+      if (active)
+         writeRegister(BMA400_REG_FIFO_CONFIG0, 0);
+      active = false;
+   }
+
+   // Read the FIFO (up to maxSamples data frames). Returns the number of
+   // samples written to out.
+   uint8_t drain(AccelSample *out, uint8_t maxSamples)
+   {
+      if (!active)
+         return 0;
+      Wire.beginTransmission(BMA400_I2C_ADDR);
+      Wire.write(BMA400_REG_FIFO_LENGTH0);
+      if (Wire.endTransmission(false) != 0 || Wire.requestFrom(BMA400_I2C_ADDR, 2) != 2)
+         return 0;
+      uint32_t nowUs = micros();
+      uint16_t bytes = Wire.read();
+      bytes |= (uint16_t)(Wire.read() & 0x07) << 8;
+      if (bytes > maxSamples * BMA400_FIFO_FRAME_BYTES)
+         bytes = maxSamples * BMA400_FIFO_FRAME_BYTES;
+      if (bytes == 0)
+         return 0;
+      clock.sync(nowUs, bytes / BMA400_FIFO_FRAME_BYTES);
+
+      Wire.beginTransmission(BMA400_I2C_ADDR);
+      Wire.write(BMA400_REG_FIFO_DATA);
+      Wire.endTransmission();
+
+      // Whole data frames per chunk; a control frame (config change) shifts
+      // the alignment, so frames are assembled byte by byte.
+      const uint16_t chunkBytes = (I2C_BUFFER_LENGTH / BMA400_FIFO_FRAME_BYTES) * BMA400_FIFO_FRAME_BYTES;
+      uint8_t got = 0;
+      while (bytes > 0)
+      {
+         uint16_t chunk = bytes > chunkBytes ? chunkBytes : bytes;
+         Wire.requestFrom(BMA400_I2C_ADDR, (int)chunk);
+         bytes -= chunk;
+         for (uint16_t b = 0; b < chunk; b++)
+         {
+            uint8_t v = Wire.read();
+            if (frameLen == 0)
+            {
+               if (v == BMA400_FIFO_HEADER_XYZ)
+                  frameNeed = BMA400_FIFO_FRAME_BYTES;
+               else if (v == BMA400_FIFO_HEADER_CONTROL)
+                  frameNeed = 2;
+               else
+                  continue; // empty frame: FIFO drained
+            }
+            frame[frameLen++] = v;
+            if (frameLen < frameNeed)
+               continue;
+            if (frameNeed == BMA400_FIFO_FRAME_BYTES && got < maxSamples)
+            {
+               AccelSample &s = out[got];
+               for (uint8_t k = 0; k < 3; k++)
+                  s.axis[k] = read12(frame + 1 + 2 * k);
+               s.timeUs = clock.timeUs(got);
+               got++;
+            }
+            frameLen = 0;
+         }
+      }
+      clock.advance(got);
+      return got;
+   }
+};
+
+// Accel samples resampled onto the PPG sample times. The two sensor clocks
+// are independent: each PPG sample gets the mean of the accel samples taken
+// up to its time, or the previous value when none arrived since.
+class AccelAligner
+{
+   AccelSample queue[2 * MAX30102_FIFO_DEPTH];
+   uint8_t head;
+   uint8_t count;
+   int16_t last[3];
+
+public:
+   AccelAligner() { reset(); }
+
+   void reset()
+   {
+      head = count = 0;
+      last[0] = last[1] = last[2] = 0;
+   }
+
+   // Queue freshly drained samples; the oldest are dropped when full.
+   void push(const AccelSample *s, uint8_t n)
+   {
+      const uint8_t size = sizeof(queue) / sizeof(queue[0]);
+      for (uint8_t i = 0; i < n; i++)
+      {
+         queue[(head + count) % size] = s[i];
+         if (count < size)
+            count++;
+         else
+            head = (head + 1) % size;
+      }
+   }
+
+   const int16_t *at(uint32_t timeUs)
+   {
+      const uint8_t size = sizeof(queue) / sizeof(queue[0]);
+      int32_t sum[3] = {0, 0, 0};
+      uint8_t n = 0;
+      while (count > 0 && (int32_t)(queue[head].timeUs - timeUs) <= 0)
+      {
+         for (uint8_t k = 0; k < 3; k++)
+            sum[k] += queue[head].axis[k];
+         n++;
+         head = (head + 1) % size;
+         count--;
+      }
+      if (n > 0)
+         for (uint8_t k = 0; k < 3; k++)
+            last[k] = (int16_t)(sum[k] / n);
+      return last;
+   }
+};
+
+BMA400Fifo accelFifo;
+static bool imuReady = false;
+
 bool initIMU()
 {
    Serial.println("Initializing BMA400...");
@@ -134,6 +965,7 @@ bool initIMU()
    attachInterrupt(digitalPinToInterrupt(IMU_INTERRUPT_PIN), imuInterruptHandler, RISING);
 
    Serial.println("BMA400 initialized with double-tap detection");
+   imuReady = true;
    return true;
 }
 
@@ -141,118 +973,467 @@ bool initIMU()
 // DSP helpers (translated from hrv_analysis.ipynb)
 // ---------------------------------------------------------------------------
 
-// Single forward SOS filter pass (Direct-Form II Transposed)
-static void applySOSFilterPass(const float *x, float *y, int n)
-{
-   for (int i = 0; i < n; i++)
-      y[i] = x[i];
+// Bandpass sections in the active number format (filled by measureHeartRateBatch)
+static DspBiquad bandpassBiquads[4];
+
+// scipy.signal.sosfiltfilt default padding: 3 * (2 * sections + 1)
+#define FILTFILT_PADLEN (3 * (2 * 4 + 1))
 
+// Start every section in the steady state for a constant input x0 (sosfilt_zi × x0)
+static void initSOSSteadyState(DspBiquadState *st, dsp_sample_t x0)
+{
    for (int s = 0; s < 4; s++)
-   {
-      float b0 = BANDPASS_SOS[s][0], b1 = BANDPASS_SOS[s][1], b2 = BANDPASS_SOS[s][2];
-      float a1 = BANDPASS_SOS[s][4], a2 = BANDPASS_SOS[s][5];
-      float w1 = 0.0f, w2 = 0.0f;
+      x0 = dspBiquadSteadyState(bandpassBiquads[s], st[s], x0);
+}
 
-      for (int i = 0; i < n; i++)
-      {
-         float w0 = y[i] - a1 * w1 - a2 * w2;
-         y[i] = b0 * w0 + b1 * w1 + b2 * w2;
-         w2 = w1;
-         w1 = w0;
-      }
-   }
+// One sample through all sections
+static inline dsp_sample_t stepSOS(DspBiquadState *st, dsp_sample_t x)
+{
+   for (int s = 0; s < 4; s++)
+      x = dspBiquadStep(bandpassBiquads[s], st[s], x);
+   return x;
 }
 
-// In-place filtfilt (forward-backward filtering, matches scipy.signal.filtfilt)
-static void applyBandpassFiltfilt(float *data, int n)
+// In-place zero-phase filtering, equivalent to scipy.signal.sosfiltfilt:
+// odd extension of FILTFILT_PADLEN samples at each end, each pass started
+// from steady-state initial conditions. The backward pass walks the array
+// from the end, so no full-length buffer or reversal is needed; only the
+// right-hand padding (forward outputs) is kept on the stack.
+static void applyBandpassFiltfilt(dsp_sample_t *data, int n)
 {
-   float *tmp = (float *)malloc(n * sizeof(float));
-   if (!tmp)
-   {
-      Serial.println("ERROR: filtfilt malloc failed");
+   if (n < 2)
       return;
-   }
+   int pad = (n > FILTFILT_PADLEN) ? FILTFILT_PADLEN : n - 1;
+   dsp_sample_t tail[FILTFILT_PADLEN];
+   DspBiquadState st[4];
+
+   // Right extension 2*x[n-1] - x[n-1-k] must be taken before the forward
+   // pass overwrites the end of the array.
+   for (int k = 1; k <= pad; k++)
+      tail[k - 1] = 2 * data[n - 1] - data[n - 1 - k];
+
+   // Forward pass: left extension (outputs discarded), data, right extension
+   dsp_sample_t x0 = data[0];
+   initSOSSteadyState(st, 2 * x0 - data[pad]);
+   for (int k = pad; k >= 1; k--)
+      stepSOS(st, 2 * x0 - data[k]);
+   for (int i = 0; i < n; i++)
+      data[i] = stepSOS(st, data[i]);
+   for (int k = 0; k < pad; k++)
+      tail[k] = stepSOS(st, tail[k]);
+
+   // Backward pass: right extension (outputs discarded), then data in reverse
+   initSOSSteadyState(st, tail[pad - 1]);
+   for (int k = pad - 1; k >= 0; k--)
+      stepSOS(st, tail[k]);
+   for (int i = n - 1; i >= 0; i--)
+      data[i] = stepSOS(st, data[i]);
+}
 
-   // Forward pass
-   applySOSFilterPass(data, tmp, n);
+// Peak detection equivalent to scipy.signal.find_peaks(x, distance=minDist,
+// prominence=minProminence), as used in hrv_analysis.ipynb:
+//   1. local maxima (flat tops resolve to their middle sample),
+//   2. distance suppression, tallest peak first, over all maxima,
+//   3. prominence filter on the survivors.
+// Maxima and their prominences come from a single pass over the data. A stack
+// holds the maxima whose right base is still open; it never rises, so each
+// sample pops (finalises) only maxima lower than itself and every maximum is
+// pushed and popped once. Suppression heap-sorts the k maxima by height, so
+// the whole detector is O(n + k log k). The maxima are collected into
+// peakIndices (at most maxPeaks, and never more than PEAK_MAX_COUNT), which
+// also receives the result in ascending index order; maxima beyond that are
+// dropped and counted in peaksDropped. Returns the number of peaks.
+#define PEAK_PROMINENT 0x01
+#define PEAK_SUPPRESSED 0x02
+
+struct PeakStackEntry
+{
+   dsp_sample_t val;      // height of the pending maximum
+   dsp_sample_t leftMin;  // lowest sample back to the nearest higher one
+   dsp_sample_t minAfter; // lowest sample between this entry and the next one up
+   int slot;              // index into peakIndices, -1 for the bottom sentinel
+};
 
-   // Reverse
-   for (int i = 0; i < n / 2; i++)
-   {
-      float t = tmp[i];
-      tmp[i] = tmp[n - 1 - i];
-      tmp[n - 1 - i] = t;
-   }
+static PeakStackEntry peakStack[PEAK_STACK_DEPTH];
+static uint16_t peakOrder[PEAK_MAX_COUNT];
+static uint8_t peakFlags[PEAK_MAX_COUNT];
+static int peaksDropped; // local maxima past the buffer in the last detectPeaks()
 
-   // Second forward pass (equivalent to backward pass on original)
-   applySOSFilterPass(tmp, data, n);
+static inline dsp_sample_t dspMin(dsp_sample_t a, dsp_sample_t b) { return a < b ? a : b; }
+static inline dsp_sample_t dspMax(dsp_sample_t a, dsp_sample_t b) { return a > b ? a : b; }
 
-   // Reverse back to original order
-   for (int i = 0; i < n / 2; i++)
+// Height order of two maxima; equal heights by position, so the later one is
+// taken first (scipy's argsort leaves that order unspecified)
+static inline bool peakBelow(const dsp_sample_t *data, const int *peakIndices, int a, int b)
+{
+   dsp_sample_t ha = data[peakIndices[a]], hb = data[peakIndices[b]];
+   return ha < hb || (ha == hb && a < b);
+}
+
+static void peakSiftDown(const dsp_sample_t *data, const int *peakIndices, int root, int size)
+{
+   while (2 * root + 1 < size)
    {
-      float t = data[i];
-      data[i] = data[n - 1 - i];
-      data[n - 1 - i] = t;
+      int child = 2 * root + 1;
+      if (child + 1 < size && peakBelow(data, peakIndices, peakOrder[child], peakOrder[child + 1]))
+         child++;
+      if (!peakBelow(data, peakIndices, peakOrder[root], peakOrder[child]))
+         return;
+      uint16_t t = peakOrder[root];
+      peakOrder[root] = peakOrder[child];
+      peakOrder[child] = t;
+      root = child;
    }
+}
 
-   free(tmp);
+static inline void finalizePeak(const PeakStackEntry &e, dsp_sample_t minProminence)
+{
+   if (e.val - dspMax(e.leftMin, e.minAfter) >= minProminence)
+      peakFlags[e.slot] |= PEAK_PROMINENT;
 }
 
-// Peak detection with minimum distance and prominence threshold
-// Returns count of detected peaks; indices stored in peakIndices[]
-static int detectPeaks(const float *data, int n, int minDist, float threshold,
+static int detectPeaks(const dsp_sample_t *data, int n, int minDist, dsp_sample_t minProminence,
                        int *peakIndices, int maxPeaks)
 {
+   if (maxPeaks > PEAK_MAX_COUNT)
+      maxPeaks = PEAK_MAX_COUNT;
    int count = 0;
+   int depth = 1;
+   peaksDropped = 0;
+   peakStack[0] = {DSP_SAMPLE_MAX, 0, DSP_SAMPLE_MAX, -1};
 
-   // Step 1: find all local maxima above threshold
-   for (int i = 1; i < n - 1 && count < maxPeaks; i++)
+   // --- Pass over the samples: maxima and prominences ---
+   for (int i = 0; i < n; i++)
    {
-      if (data[i] > data[i - 1] && data[i] >= data[i + 1] && data[i] > threshold)
+      dsp_sample_t x = data[i];
+
+      // x closes the right base of every pending maximum lower than itself
+      while (peakStack[depth - 1].val < x)
       {
-         peakIndices[count++] = i;
+         const PeakStackEntry &top = peakStack[--depth];
+         finalizePeak(top, minProminence);
+         peakStack[depth - 1].minAfter = dspMin(peakStack[depth - 1].minAfter, top.minAfter);
       }
-   }
-
-   // Step 2: enforce minimum distance – keep the taller peak when two are too close
-   for (int i = 1; i < count;)
-   {
-      if (peakIndices[i] - peakIndices[i - 1] < minDist)
+      peakStack[depth - 1].minAfter = dspMin(peakStack[depth - 1].minAfter, x);
+
+      // Rising edge at i: a maximum if the following flat run drops again
+      if (i == 0 || i >= n - 1 || !(data[i - 1] < x))
+         continue;
+      int ahead = i + 1;
+      while (ahead < n - 1 && data[ahead] == x)
+         ahead++;
+      if (!(data[ahead] < x))
+         continue;
+      if (count < maxPeaks)
       {
-         // Remove the smaller peak
-         int removeIdx = (data[peakIndices[i]] >= data[peakIndices[i - 1]]) ? i - 1 : i;
-         for (int j = removeIdx; j < count - 1; j++)
+         // The left search passes over equal maxima, so inherit their base
+         const PeakStackEntry &top = peakStack[depth - 1];
+         dsp_sample_t leftMin = (top.val == x) ? dspMin(top.minAfter, top.leftMin) : top.minAfter;
+         if (depth == PEAK_STACK_DEPTH)
          {
-            peakIndices[j] = peakIndices[j + 1];
+            // Out of stack: close the oldest maximum early (never hit on PPG data)
+            finalizePeak(peakStack[1], minProminence);
+            peakStack[0].minAfter = dspMin(peakStack[0].minAfter, peakStack[1].minAfter);
+            memmove(&peakStack[1], &peakStack[2], (PEAK_STACK_DEPTH - 2) * sizeof(PeakStackEntry));
+            depth--;
          }
-         count--;
-         if (removeIdx < i)
-            i = removeIdx + 1; // re-check from same position
+         peakFlags[count] = 0;
+         peakIndices[count] = (i + ahead - 1) / 2;
+         peakStack[depth++] = {x, leftMin, x, count};
+         count++;
       }
       else
-      {
-         i++;
-      }
+         peaksDropped++;
+      // Plateau samples equal x and cannot change any minimum; skip them.
+      i = ahead - 1;
+   }
+   while (depth > 1)
+   {
+      const PeakStackEntry &top = peakStack[--depth];
+      finalizePeak(top, minProminence);
+      peakStack[depth - 1].minAfter = dspMin(peakStack[depth - 1].minAfter, top.minAfter);
    }
 
-   return count;
+   // --- Distance suppression, tallest first (heap sort into ascending height) ---
+   for (int k = 0; k < count; k++)
+      peakOrder[k] = (uint16_t)k;
+   for (int k = count / 2 - 1; k >= 0; k--)
+      peakSiftDown(data, peakIndices, k, count);
+   for (int end = count - 1; end > 0; end--)
+   {
+      uint16_t t = peakOrder[0];
+      peakOrder[0] = peakOrder[end];
+      peakOrder[end] = t;
+      peakSiftDown(data, peakIndices, 0, end);
+   }
+   for (int r = count - 1; r >= 0; r--)
+   {
+      int k = peakOrder[r];
+      if (peakFlags[k] & PEAK_SUPPRESSED)
+         continue;
+      for (int j = k - 1; j >= 0 && peakIndices[k] - peakIndices[j] < minDist; j--)
+         peakFlags[j] |= PEAK_SUPPRESSED;
+      for (int j = k + 1; j < count && peakIndices[j] - peakIndices[k] < minDist; j++)
+         peakFlags[j] |= PEAK_SUPPRESSED;
+   }
+
+   // --- Compact the survivors that pass the prominence threshold ---
+   int kept = 0;
+   for (int k = 0; k < count; k++)
+   {
+      if (peakFlags[k] == PEAK_PROMINENT)
+         peakIndices[kept++] = peakIndices[k];
+   }
+   return kept;
+}
+
+// True when an adaptive session may stop: minimum time reached and both
+// confidence intervals inside their tolerances.
+static bool hrConverged(const RRStats &rr, uint32_t elapsedMs)
+{
+#if HR_ADAPTIVE_DURATION
+   if (elapsedMs < HR_MIN_MEASUREMENT_MS || rr.count() < HR_CONVERGE_MIN_RR)
+      return false;
+   return rr.meanCiUs() * 100 <= rr.meanUs() * HR_CONVERGE_MEAN_TOL_PCT &&
+          rr.sdrrCiUs() * 100 <= rr.sdrrUs() * HR_CONVERGE_SDRR_TOL_PCT;
+#else
+   (void)rr;
+   (void)elapsedMs;
+   return false;
+#endif
+}
+
+static void logConvergence(const RRStats &rr, uint32_t elapsedMs)
+{
+   Serial.printf("Converged after %lu ms: mean RR %lu ± %lu us, SDRR %lu ± %lu us (%d RR)\n",
+                 elapsedMs, rr.meanUs(), rr.meanCiUs(), rr.sdrrUs(), rr.sdrrCiUs(), rr.count());
+}
+
+// Corrected RR series of the current session, for the spectral metrics.
+static RRTachogram hrvTachogram;
+
+// Respiratory band of the current session (same input as the cardiac band).
+static StreamingRespiration respiration(RESP_SOS,
+                                        HR_MS_TO_SAMPLES(RESP_MIN_BREATH_MS),
+                                        HR_MS_TO_SAMPLES(RESP_WARMUP_MS),
+                                        HR_MS_TO_SAMPLES(RESP_VAR_WINDOW_MS));
+
+static void applyRespiration(HRVResult &result)
+{
+#if HR_RESPIRATION
+   uint16_t rateX10 = respiration.rateX10();
+   Serial.printf("Respiration: %d breaths, %.1f breaths/min\n",
+                 respiration.breathCount(), rateX10 / 10.0f);
+   if (result.valid && rateX10 >= 10 * RESP_MIN_BRPM && rateX10 <= 10 * RESP_MAX_BRPM)
+      result.resp_brpm = (uint8_t)((rateX10 + 5) / 10);
+#else
+   (void)result;
+#endif
+}
+
+// Accel-referenced artifact cancellation of the current session.
+static MotionCanceller motionCanceller(BANDPASS_SOS, MOTION_GATE_MG * ACCEL_COUNTS_PER_G / 1000.0f);
+static AccelAligner accelAligner;
+
+static void applyMotion(HRVResult &result)
+{
+#if HR_MOTION_CANCEL
+   if (!imuReady)
+      return;
+   result.motion_pct = motionCanceller.motionPct();
+   Serial.printf("Motion: %d%% of the session, %.0f%% of the PPG power left after cancellation\n",
+                 result.motion_pct, motionCanceller.residualPct());
+#else
+   (void)result;
+#endif
+}
+
+// Windowed SQI of the current session; template points 20 ms apart.
+#if HR_SIGNAL_QUALITY
+static_assert(FILTER_FS % 50 == 0, "SQI template needs a 20 ms sample grid; build with HR_SIGNAL_QUALITY=0");
+#endif
+static SignalQuality signalQuality(HR_MS_TO_SAMPLES(SQI_WINDOW_MS), FILTER_FS >= 50 ? FILTER_FS / 50 : 1);
+
+// Keep only the RR intervals whose two beats lie in good SQI windows:
+// hrvTachogram is cut down to them and out recomputed from it. Returns false
+// (nothing changed) when every window is good, and the whole session is
+// used; also when too few intervals would be left, which sets
+// result.hrvPoorSignal: the BPM of the whole session stands, its HRV not.
+static bool applySignalQuality(HRVResult &result, const StreamingHRPipeline &pipeline, RRStats &out)
+{
+#if HR_SIGNAL_QUALITY
+   for (uint8_t i = 0; i < signalQuality.windowCount(); i++)
+   {
+      const SqiWindow &w = signalQuality.window(i);
+      Serial.printf("  SQI %2d-%2ds: PI %.2f%%, corr %.2f, kurtosis %.1f, %d beats %s\n",
+                    (int)((w.startUs - signalQuality.window(0).startUs) / 1000000),
+                    (int)((w.endUs - signalQuality.window(0).startUs) / 1000000),
+                    w.pi, w.corr, w.kurtosis, w.beats, w.good ? "" : "(bad)");
+   }
+   result.sqi_pct = signalQuality.goodPct();
+   if (result.sqi_pct == 100 || pipeline.rrStats().count() != hrvTachogram.count())
+      return false;
+
+   uint32_t t0 = pipeline.firstBeatUs();
+   auto inGoodWindows = [t0](uint32_t beatUs, uint32_t rrUs)
+   {
+      return signalQuality.good(t0 + beatUs - rrUs) && signalQuality.good(t0 + beatUs);
+   };
+   uint16_t good = 0;
+   for (uint16_t i = 0; i < hrvTachogram.count(); i++)
+      good += inGoodWindows(hrvTachogram.beatTimeUs(i), hrvTachogram.intervalUs(i));
+   Serial.printf("Signal quality: %d%% of the windows good, %d of %d RR intervals inside them\n",
+                 result.sqi_pct, good, hrvTachogram.count());
+   if (good < SQI_MIN_GOOD_RR)
+   {
+      Serial.println("Too few good intervals: BPM from the whole session, no HRV");
+      result.hrvPoorSignal = true;
+      return false;
+   }
+
+   hrvTachogram.retain(inGoodWindows);
+   out.reset();
+   for (uint16_t i = 0; i < hrvTachogram.count(); i++)
+   {
+      uint32_t rrUs = hrvTachogram.intervalUs(i);
+      if (i > 0 && hrvTachogram.beatTimeUs(i) - rrUs != hrvTachogram.beatTimeUs(i - 1))
+         out.gap(0);
+      out.add(rrUs);
+   }
+   return true;
+#else
+   (void)result;
+   (void)pipeline;
+   (void)out;
+   return false;
+#endif
+}
+
+// Red/IR ratio of ratios of the current session (SpO2 mode only).
+static SpO2Estimator spo2Estimator(BANDPASS_SOS, HR_MS_TO_SAMPLES(STREAM_WARMUP_MS));
+
+static void applySpO2(HRVResult &result, uint8_t mode)
+{
+   if (mode != PPG_MODE_SPO2)
+      return;
+   uint16_t beats = spo2Estimator.beatCount();
+   float r = spo2Estimator.ratio();
+   if (result.valid)
+      result.spo2_pct = spo2Estimator.spo2Pct();
+   Serial.printf("SpO2: %d%% (R %.3f over %d beats)\n", result.spo2_pct, r, beats);
+}
+
+// Goertzel bank over the filtered signal of the current session.
+static GoertzelHRBank spectralHR(GoertzelHRTable<FILTER_FS>::table, HR_MS_TO_SAMPLES(HR_SPECTRAL_SEGMENT_MS));
+
+// Zero the HRV metrics of a session whose RR intervals cannot be trusted.
+static void clearHRVMetrics(HRVResult &result)
+{
+   result.sdrr_ms = result.rmssd_ms = result.sd1_ms = result.sd2_ms = 0;
+   result.pnn50_pct = 0;
+   result.lf_ms2 = result.hf_ms2 = 0;
+   result.lf_hf_x100 = 0;
+}
+
+// Cross-check the peak-based BPM against the spectral estimate, or fall back
+// to the spectral BPM when the peaks gave no valid result.
+static void applySpectralHR(HRVResult &result, float actualFsHz)
+{
+   float peakRatio;
+   spectralHR.finish();
+   float bpm = spectralHR.peakBpm((float)FILTER_FS, actualFsHz, peakRatio);
+   Serial.printf("Spectral HR: %.1f BPM (peak %.1fx mean, %lu samples)\n",
+                 bpm, peakRatio, spectralHR.count());
+   if (peakRatio < HR_SPECTRAL_MIN_PEAK_RATIO || bpm < MIN_BPM || bpm > MAX_BPM)
+      return;
+   result.spectralBpm = (uint8_t)(bpm + 0.5f);
+
+   if (result.valid)
+   {
+      int diff = (int)result.bpm - (int)result.spectralBpm;
+      result.bpmDisagree = diff > HR_SPECTRAL_AGREE_BPM || diff < -HR_SPECTRAL_AGREE_BPM;
+      if (result.bpmDisagree)
+         Serial.printf("WARNING: peak BPM %d disagrees with spectral BPM %d\n",
+                       result.bpm, result.spectralBpm);
+   }
+#if HR_SPECTRAL_FALLBACK
+   else
+   {
+      // HR/HRV fields only: LED current, SQI and the rest of the session stay
+      result.bpm = result.spectralBpm;
+      result.spectralFallback = true;
+      result.valid = true;
+      clearHRVMetrics(result);
+      Serial.printf("Using spectral HR %d BPM (no HRV for this session)\n", result.bpm);
+   }
+#endif
+}
+
+// HR and HRV metrics from the accumulated RR statistics and hrvTachogram;
+// leaves result invalid when the mean rate is outside [MIN_BPM, MAX_BPM].
+static void fillHRVResult(HRVResult &result, const RRStats &rr, const RRArtifactFilter &artifacts)
+{
+   result.correctedBeats = artifacts.correctedBeats();
+   result.rejectedBeats = artifacts.rejectedBeats();
+   Serial.printf("RR artifacts: %d beats corrected, %d rejected\n",
+                 result.correctedBeats, result.rejectedBeats);
+   if (rr.count() < 1)
+   {
+      Serial.println("No RR intervals left after artifact correction");
+      return;
+   }
+
+   uint32_t bpm = 60000000UL / rr.meanUs();
+   if (bpm < MIN_BPM || bpm > MAX_BPM)
+   {
+      Serial.printf("Computed BPM %lu out of range [%d-%d]\n", bpm, MIN_BPM, MAX_BPM);
+      return;
+   }
+
+   result.bpm = (uint8_t)bpm;
+   result.sdrr_ms = (uint16_t)(rr.sdrrUs() / 1000);
+   result.rmssd_ms = (uint16_t)(rr.rmssdUs() / 1000);
+   result.pnn50_pct = rr.pnn50Pct();
+   result.sd1_ms = (uint16_t)(rr.sd1Us() / 1000);
+   result.sd2_ms = (uint16_t)(rr.sd2Us() / 1000);
+   result.valid = true;
+
+   Serial.printf("Heart rate: %d BPM, SDRR: %d ms (%d RR intervals)\n",
+                 result.bpm, result.sdrr_ms, rr.count());
+   Serial.printf("HRV: RMSSD %d ms, pNN50 %d%%, SD1 %d ms, SD2 %d ms\n",
+                 result.rmssd_ms, result.pnn50_pct, result.sd1_ms, result.sd2_ms);
+
+   HRVSpectrum spectrum = computeHRVSpectrum(hrvTachogram);
+   if (!spectrum.valid)
+   {
+      Serial.println("HRV spectrum: session too short for LF/HF");
+      return;
+   }
+   result.lf_ms2 = (uint32_t)(spectrum.lfMs2 + 0.5f);
+   result.hf_ms2 = (uint32_t)(spectrum.hfMs2 + 0.5f);
+   float ratio = spectrum.hfMs2 > 0.0f ? 100.0f * spectrum.lfMs2 / spectrum.hfMs2 : 0.0f;
+   result.lf_hf_x100 = ratio > 65535.0f ? 65535 : (uint16_t)(ratio + 0.5f);
+   Serial.printf("HRV spectrum: LF %lu ms², HF %lu ms², LF/HF %.2f\n",
+                 result.lf_ms2, result.hf_ms2, result.lf_hf_x100 / 100.0f);
 }
 
 // ---------------------------------------------------------------------------
-// Measure heart rate + HRV over specified duration
-// Collects raw IR at 100 Hz, then applies bandpass filter + peak detection
+// Batch measurement: buffers the raw IR window, then applies bandpass
+// filtfilt + peak detection. Needs ~8 bytes per sample of heap.
 // ---------------------------------------------------------------------------
-HRVResult measureHeartRate(uint32_t durationMs)
+HRVResult measureHeartRateBatch(uint32_t durationMs, uint8_t mode)
 {
    Serial.printf("Measuring heart rate for %d seconds (raw IR capture)...\n", durationMs / 1000);
+   if (mode == PPG_MODE_SPO2)
+      Serial.println("SpO2 needs the streaming pipeline, measuring IR only");
 
-   HRVResult result = {0, 0, false};
-   // Buffer capacity: worst-case 100 Hz for the full duration
-   int bufCapacity = durationMs / SAMPLE_INTERVAL_MS;
+   HRVResult result = {};
+   // Buffer capacity: nominal rate plus 1/16 for a fast sensor clock
+   int bufCapacity = HR_MS_TO_SAMPLES(durationMs) + HR_MS_TO_SAMPLES(durationMs) / 16;
 
-   // Heap-allocate buffers (~24 KB each for 60 s at 100 Hz)
+   // Heap-allocate buffers (~12 KB each for 56 s at 50 Hz)
    int32_t *rawIR = (int32_t *)malloc(bufCapacity * sizeof(int32_t));
-   float *signal = (float *)malloc(bufCapacity * sizeof(float));
+   dsp_sample_t *signal = (dsp_sample_t *)malloc(bufCapacity * sizeof(dsp_sample_t));
    if (!rawIR || !signal)
    {
       Serial.println("ERROR: Failed to allocate IR buffers");
@@ -269,24 +1450,62 @@ HRVResult measureHeartRate(uint32_t durationMs)
    uint32_t lastPrint = startTime;
    uint32_t lastWristMs = startTime; // tracks when wrist was last detected
    bool wristDetected = false;
+   bool noWristAbort = false;
    int collected = 0;
-
-   while ((millis() - startTime) < durationMs && collected < bufCapacity)
+   long irValue = 0;
+   PPGSample burst[MAX30102_FIFO_DEPTH];
+   CicDecimator decimator(PPG_DECIMATION);
+#if HR_ADAPTIVE_DURATION
+   // Running RR estimate for the adaptive stop only; the result still comes
+   // from filtfilt + detectPeaks() over everything captured.
+   StreamingHRPipeline monitor(BANDPASS_SOS,
+                               PEAK_MIN_DISTANCE,
+                               HR_MS_TO_SAMPLES(STREAM_WARMUP_MS),
+                               HR_MS_TO_SAMPLES(STREAM_VAR_WINDOW_MS));
+#endif
+
+   respiration.reset();
+   setPPGMode(PPG_MODE_IR_ONLY);
+   runLedAgc(1);
+   result.led_ua = ledCurrentUa(1);
+   ppgFifo.begin(PPG_OUTPUT_RATE_HZ, 1);
+
+   while ((millis() - startTime) < durationMs && collected < bufCapacity && !noWristAbort)
    {
-      long irValue = particleSensor.getIR();
+      uint8_t n = ppgFifo.drain(burst, MAX30102_FIFO_DEPTH);
 
-      if (irValue > IR_WRIST_THRESHOLD)
+      for (uint8_t i = 0; i < n && collected < bufCapacity; i++)
       {
-         wristDetected = true;
-         lastWristMs = millis();
+         irValue = (long)burst[i].ir;
+         if (irValue > IR_WRIST_THRESHOLD)
+         {
+            wristDetected = true;
+            lastWristMs = millis();
+         }
+         int32_t decimated;
+         if (!decimator.push((int32_t)irValue, decimated))
+            continue;
+         rawIR[collected++] = decimated;
+#if HR_RESPIRATION
+         respiration.push(dspFromCounts(decimated - rawIR[0]), burst[i].timeUs);
+#endif
+#if HR_ADAPTIVE_DURATION
+         monitor.push(decimated, burst[i].timeUs);
+#endif
       }
-      else if ((millis() - lastWristMs) >= NO_WRIST_TIMEOUT_MS)
+
+      if (n > 0 && irValue <= IR_WRIST_THRESHOLD && (millis() - lastWristMs) >= NO_WRIST_TIMEOUT_MS)
       {
          Serial.println("No wrist detected for 10 s — aborting measurement early.");
+         noWristAbort = true;
+      }
+#if HR_ADAPTIVE_DURATION
+      else if (hrConverged(monitor.rrStats(), millis() - startTime))
+      {
+         logConvergence(monitor.rrStats(), millis() - startTime);
          break;
       }
-
-      rawIR[collected++] = (int32_t)irValue;
+#endif
 
       if (millis() - lastPrint >= 1000)
       {
@@ -296,12 +1515,17 @@ HRVResult measureHeartRate(uint32_t durationMs)
          lastPrint = millis();
       }
 
-      // Yield to FreeRTOS scheduler; sensor I2C read (~10ms) provides natural pacing
-      delay(1);
+      // Sleep until the FIFO has collected the next burst.
+      delay(FIFO_DRAIN_INTERVAL_MS);
    }
+#if HR_RESPIRATION
+   respiration.finish();
+#endif
 
    uint32_t totalCollectionMs = millis() - startTime;
-   float actualIntervalMs = (float)totalCollectionMs / collected;
+   result.durationMs = totalCollectionMs;
+   // Sample spacing from the sensor's own clock (see MAX30102Fifo), after decimation
+   float actualIntervalMs = ppgFifo.periodMs() * PPG_DECIMATION;
 
    if (!wristDetected)
    {
@@ -311,53 +1535,46 @@ HRVResult measureHeartRate(uint32_t durationMs)
       return result;
    }
 
-   Serial.printf("Collection complete: %d samples in %d ms (%.1f Hz)\n",
-                 collected, (int)totalCollectionMs, 1000.0f / actualIntervalMs);
+   Serial.printf("Collection complete: %d samples in %d ms (%.1f Hz after /%d, %lu bursts, %lu I2C transactions, %lu dropped)\n",
+                 collected, (int)totalCollectionMs, 1000.0f / actualIntervalMs, PPG_DECIMATION,
+                 ppgFifo.burstCount(), ppgFifo.i2cTransactions(), ppgFifo.droppedSamples());
 
    // --- Phase 2: Bandpass filter (0.5–5 Hz) ---
    // Remove DC offset first – raw IR values are ~100k; the large DC causes
    // enormous filter transients that drown out the actual heartbeat AC component.
-   float dcOffset = 0;
+   int64_t irSum = 0;
    for (int i = 0; i < collected; i++)
-      dcOffset += (float)rawIR[i];
-   dcOffset /= collected;
+      irSum += rawIR[i];
+   int32_t dcOffset = (int32_t)(irSum / collected);
+   const uint32_t sessionDc[2] = {0, (uint32_t)dcOffset};
+   storeLedState(sessionDc, 0.0f); // no PI without the SQI; the last one stays
    for (int i = 0; i < collected; i++)
-      signal[i] = (float)rawIR[i] - dcOffset;
+      signal[i] = dspFromCounts(rawIR[i] - dcOffset);
    free(rawIR); // No longer needed
 
-   Serial.printf("DC offset removed: %.0f\n", dcOffset);
-   Serial.println("Applying bandpass filter (0.5-5 Hz)...");
+   Serial.printf("DC offset removed: %ld\n", (long)dcOffset);
+   uint16_t designFsHz;
+   dspLoadSOS(pickBandpassSOS(1000.0f / actualIntervalMs, designFsHz), 4, bandpassBiquads);
+   Serial.printf("Applying bandpass filter (0.5-5 Hz, designed for %u Hz)...\n", designFsHz);
    applyBandpassFiltfilt(signal, collected);
+   spectralHR.reset();
+   for (int i = 0; i < collected; i++)
+      spectralHR.push(signal[i]);
 
    // --- Phase 3: Peak detection ---
-   // Skip first/last 2 seconds to avoid filter edge transients
-   int trimSamples = (int)(2000.0f / actualIntervalMs);
-   int startIdx = trimSamples;
-   int endIdx = collected - trimSamples;
-   if (endIdx <= startIdx)
-   {
-      startIdx = 0;
-      endIdx = collected;
-   }
-   int regionLen = endIdx - startIdx;
-
-   // Compute std dev on trimmed (transient-free) region
-   float mean = 0;
-   for (int i = startIdx; i < endIdx; i++)
-      mean += signal[i];
-   mean /= regionLen;
-
-   float variance = 0;
-   for (int i = startIdx; i < endIdx; i++)
-   {
-      float diff = signal[i] - mean;
-      variance += diff * diff;
-   }
-   float stddev = sqrtf(variance / regionLen);
-   float prominenceThreshold = 0.3f * stddev;
-
-   Serial.printf("Filtered region [%d..%d]: mean=%.2f, stddev=%.2f, threshold=%.2f\n",
-                 startIdx, endIdx, mean, stddev, prominenceThreshold);
+   // filtfilt starts from steady-state initial conditions, so the whole
+   // window is transient-free and usable.
+   dsp_sample_t mean = dspMean(signal, collected);
+   dsp_sample_t stddev = dspStdDev(signal, collected, mean);
+#if DSP_FIXED_POINT
+   dsp_sample_t prominenceThreshold = (dsp_sample_t)(((int64_t)stddev * 19661) >> 16); // 0.3 in Q16
+#else
+   dsp_sample_t prominenceThreshold = 0.3f * stddev;
+#endif
+
+   Serial.printf("Filtered signal: mean=%.2f, stddev=%.2f, threshold=%.2f\n",
+                 dspToCounts(mean), dspToCounts(stddev),
+                 dspToCounts(prominenceThreshold));
 
    int *peakIndices = (int *)malloc(PEAK_MAX_COUNT * sizeof(int));
    if (!peakIndices)
@@ -367,58 +1584,374 @@ HRVResult measureHeartRate(uint32_t durationMs)
       return result;
    }
 
-   // Compute min peak distance from actual sample rate (0.4s minimum between beats)
-   int actualMinDist = (int)(400.0f / actualIntervalMs); // 0.4s / intervalMs
-   int peakCount = detectPeaks(signal + startIdx, regionLen, actualMinDist,
+   // Compute min peak distance from actual sample rate (0.4s minimum between beats),
+   // rounded up: at 25-50 Hz a sample less lets the dicrotic wave through
+   int actualMinDist = (int)ceilf(400.0f / actualIntervalMs); // 0.4s / intervalMs
+   int peakCount = detectPeaks(signal, collected, actualMinDist,
                                prominenceThreshold, peakIndices, PEAK_MAX_COUNT);
+   if (peaksDropped)
+      Serial.printf("WARNING: %d local maxima beyond PEAK_MAX_COUNT (%d) ignored, window tail lost\n",
+                    peaksDropped, PEAK_MAX_COUNT);
+
+   // Refine each peak to a Q8 sample position (index * 256 + parabolic offset)
+   for (int i = 0; i < peakCount; i++)
+   {
+      int k = peakIndices[i];
+      peakIndices[i] = k * 256 + dspParabolicPeakOffset(signal[k - 1], signal[k], signal[k + 1], 256);
+   }
    free(signal);
 
-   Serial.printf("Detected %d peaks (threshold=%.2f)\n", peakCount, prominenceThreshold);
+   Serial.printf("Detected %d peaks (threshold=%.2f)\n", peakCount, dspToCounts(prominenceThreshold));
 
    if (peakCount < 2)
    {
       Serial.println("Not enough peaks for HR/HRV calculation");
       free(peakIndices);
+      applySpectralHR(result, 1000.0f / actualIntervalMs);
+      applyRespiration(result);
       return result;
    }
 
-   // --- Phase 4: Compute RR intervals, HR, and SDNN ---
-   int rrCount = peakCount - 1;
-   float rrSum = 0;
+   // --- Phase 4: RR intervals -> artifact correction -> HR and HRV metrics, one pass ---
+   // RR in µs from the Q8 peak positions and the sensor sample clock (period in 1/256 µs)
+   uint32_t periodQ8 = ppgFifo.periodUsQ8() * PPG_DECIMATION;
+   RRArtifactFilter artifacts;
+   RRStats rr;
+   rr.attach(&hrvTachogram);
+   rr.reset();
+   for (int i = 0; i < peakCount - 1; i++)
+      artifacts.push((uint32_t)(((uint64_t)(peakIndices[i + 1] - peakIndices[i]) * periodQ8) >> 16), rr);
+   artifacts.finish(rr);
+   free(peakIndices);
+
+   fillHRVResult(result, rr, artifacts);
+   applySpectralHR(result, 1000.0f / actualIntervalMs);
+   applyRespiration(result);
+   return result;
+}
+
+// ---------------------------------------------------------------------------
+// Streaming measurement: every sample is filtered and fed to the online peak
+// detector as it arrives; RR statistics are accumulated on the fly. Memory
+// use is independent of durationMs (see StreamingHR.h).
+// ---------------------------------------------------------------------------
+HRVResult measureHeartRateStreaming(uint32_t durationMs, uint8_t mode)
+{
+   Serial.printf("Measuring heart rate for %d seconds (streaming, %s)...\n", durationMs / 1000,
+                 mode == PPG_MODE_SPO2 ? "Red + IR" : "IR only");
+
+   HRVResult result = {};
+
+   // RR intervals come from the per-sample FIFO timestamps, not sample counts.
+   StreamingHRPipeline pipeline(BANDPASS_SOS,
+                                PEAK_MIN_DISTANCE,
+                                HR_MS_TO_SAMPLES(STREAM_WARMUP_MS),
+                                HR_MS_TO_SAMPLES(STREAM_VAR_WINDOW_MS));
+   pipeline.attachTachogram(&hrvTachogram);
+   pipeline.attachSpectral(&spectralHR);
+#if HR_RESPIRATION
+   pipeline.attachRespiration(&respiration);
+#endif
+   bool readRed = mode == PPG_MODE_SPO2;
+   CicDecimator redDecimator(PPG_DECIMATION);
+   if (readRed)
+      pipeline.attachSpO2(&spo2Estimator);
+#if HR_SIGNAL_QUALITY
+   pipeline.attachQuality(&signalQuality);
+   bool contactChecked = false;
+#else
+   signalQuality.reset();
+#endif
+#if HR_MOTION_CANCEL
+   AccelSample accelBurst[MAX30102_FIFO_DEPTH];
+   bool useAccel = imuReady && accelFifo.begin();
+   if (useAccel)
+      pipeline.attachMotion(&motionCanceller);
+   else if (imuReady)
+      Serial.println("WARNING: BMA400 FIFO not available, no motion cancellation");
+   accelAligner.reset();
+#endif
+
+   const uint32_t NO_WRIST_TIMEOUT_MS = 10000UL;
 
-   // First pass: compute mean RR (using actual measured sample interval)
-   for (int i = 0; i < rrCount; i++)
+   uint32_t startTime = millis();
+   uint32_t lastPrint = startTime;
+   uint32_t lastWristMs = startTime;
+   bool wristDetected = false;
+   int collected = 0;
+   long irValue = 0;
+   PPGSample burst[MAX30102_FIFO_DEPTH];
+   CicDecimator decimator(PPG_DECIMATION);
+   int64_t dcSum[2] = {0, 0}; // Red, IR; for the next session's AGC
+   uint32_t dcCount = 0;
+
+   uint8_t channels = setPPGMode(mode);
+   runLedAgc(channels);
+   result.led_ua = ledCurrentUa(channels);
+   ppgFifo.begin(PPG_OUTPUT_RATE_HZ, channels);
+
+   while ((millis() - startTime) < durationMs)
    {
-      float rr = (float)(peakIndices[i + 1] - peakIndices[i]) * actualIntervalMs;
-      rrSum += rr;
+#if HR_MOTION_CANCEL
+      if (useAccel)
+         accelAligner.push(accelBurst, accelFifo.drain(accelBurst, MAX30102_FIFO_DEPTH));
+#endif
+      uint8_t n = ppgFifo.drain(burst, MAX30102_FIFO_DEPTH);
+
+      for (uint8_t i = 0; i < n; i++)
+      {
+         irValue = (long)burst[i].ir;
+         if (irValue > IR_WRIST_THRESHOLD)
+         {
+            wristDetected = true;
+            lastWristMs = millis();
+         }
+         int32_t decimated, redDecimated = 0;
+         if (readRed)
+            redDecimator.push((int32_t)burst[i].red, redDecimated); // in step with the IR decimator
+         if (!decimator.push((int32_t)irValue, decimated))
+            continue;
+         if (readRed)
+            spo2Estimator.push(redDecimated, decimated);
+         dcSum[PPG_LED_RED] += redDecimated;
+         dcSum[PPG_LED_IR] += decimated;
+         dcCount++;
+#if HR_MOTION_CANCEL
+         if (useAccel)
+         {
+            pipeline.push(decimated, burst[i].timeUs, accelAligner.at(burst[i].timeUs));
+            continue;
+         }
+#endif
+         pipeline.push(decimated, burst[i].timeUs);
+      }
+      collected += n;
+
+      if (n > 0 && irValue <= IR_WRIST_THRESHOLD && (millis() - lastWristMs) >= NO_WRIST_TIMEOUT_MS)
+      {
+         Serial.println("No wrist detected for 10 s — aborting measurement early.");
+         break;
+      }
+#if HR_SIGNAL_QUALITY
+      // Judge the contact on the first window instead of the whole session
+      if (!contactChecked && signalQuality.windowCount() > 0)
+      {
+         contactChecked = true;
+         const SqiWindow &w = signalQuality.window(0);
+         if (w.pi < SQI_MIN_PI)
+         {
+            Serial.printf("No pulse in the first window (PI %.3f%%) — poor contact, aborting measurement early.\n", w.pi);
+            result.poorContact = true;
+            break;
+         }
+         if (!w.good)
+            Serial.printf("WARNING: poor signal in the first window (PI %.2f%%, corr %.2f, kurtosis %.1f)\n",
+                          w.pi, w.corr, w.kurtosis);
+      }
+#endif
+      if (hrConverged(pipeline.rrStats(), millis() - startTime))
+      {
+         logConvergence(pipeline.rrStats(), millis() - startTime);
+         break;
+      }
+
+      if (millis() - lastPrint >= 1000)
+      {
+         Serial.printf("  [%ds] IR=%ld, samples=%d, beats=%d %s\n",
+                       (int)((millis() - startTime) / 1000), irValue, collected,
+                       pipeline.peakCount(), irValue < IR_WRIST_THRESHOLD ? "(no wrist)" : "");
+         lastPrint = millis();
+      }
+
+      // Sleep until the FIFO has collected the next burst.
+      delay(FIFO_DRAIN_INTERVAL_MS);
    }
-   float meanRR = rrSum / rrCount;
+   pipeline.finish();
+#if HR_MOTION_CANCEL
+   accelFifo.end();
+#endif
+   if (wristDetected && dcCount > 0)
+   {
+      uint32_t dc[2] = {(uint32_t)(dcSum[PPG_LED_RED] / dcCount), (uint32_t)(dcSum[PPG_LED_IR] / dcCount)};
+      storeLedState(dc, signalQuality.meanPi());
+   }
+
+   uint32_t totalCollectionMs = millis() - startTime;
+   result.durationMs = totalCollectionMs;
 
-   // Second pass: compute SDRR (std dev of all RR intervals)
-   float rrVariance = 0;
-   for (int i = 0; i < rrCount; i++)
+   if (!wristDetected)
    {
-      float rr = (float)(peakIndices[i + 1] - peakIndices[i]) * actualIntervalMs;
-      float diff = rr - meanRR;
-      rrVariance += diff * diff;
+      Serial.println("No wrist detected during measurement");
+      return result;
    }
-   float sdrr = sqrtf(rrVariance / rrCount);
 
-   free(peakIndices);
+   Serial.printf("Collection complete: %d samples in %d ms (%.1f Hz, %lu bursts, %lu I2C transactions, %lu dropped)\n",
+                 collected, (int)totalCollectionMs, 1000.0f / ppgFifo.periodMs(),
+                 ppgFifo.burstCount(), ppgFifo.i2cTransactions(), ppgFifo.droppedSamples());
+   Serial.printf("Detected %d peaks (threshold=%.2f)\n", pipeline.peakCount(), pipeline.threshold());
 
-   uint8_t bpm = (uint8_t)(60000.0f / meanRR);
-   if (bpm < MIN_BPM || bpm > MAX_BPM)
+   if (result.poorContact)
+      return result;
+
+   if (pipeline.rrStats().count() < 1)
    {
-      Serial.printf("Computed BPM %d out of range [%d-%d]\n", bpm, MIN_BPM, MAX_BPM);
+      Serial.println("Not enough peaks for HR/HRV calculation");
+      applySpectralHR(result, 1000.0f / (ppgFifo.periodMs() * PPG_DECIMATION));
+      applyRespiration(result);
+      applyMotion(result);
+      applySpO2(result, mode);
       return result;
    }
 
-   result.bpm = bpm;
-   result.sdrr_ms = (uint16_t)sdrr;
-   result.valid = true;
+   RRStats goodRR;
+   bool selected = applySignalQuality(result, pipeline, goodRR);
+   fillHRVResult(result, selected ? goodRR : pipeline.rrStats(), pipeline.artifactStats());
+   if (result.hrvPoorSignal)
+      clearHRVMetrics(result);
+   applySpectralHR(result, 1000.0f / (ppgFifo.periodMs() * PPG_DECIMATION));
+   applyRespiration(result);
+   applyMotion(result);
+   applySpO2(result, mode);
+   return result;
+}
 
-   Serial.printf("Heart rate: %d BPM, SDRR: %d ms (%d RR intervals)\n",
-                 result.bpm, result.sdrr_ms, rrCount);
+// Measure heart rate + HRV over the specified duration using the pipeline
+// selected by HR_STREAMING_PIPELINE, with the LEDs in mode (PPG_MODE_*).
+HRVResult measureHeartRate(uint32_t durationMs, uint8_t mode = PPG_MODE_IR_ONLY)
+{
+#if HR_STREAMING_PIPELINE
+   return measureHeartRateStreaming(durationMs, mode);
+#else
+   return measureHeartRateBatch(durationMs, mode);
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Workout mode
+//
+// Runs the streaming pipeline until keepRunning() returns false (or for
+// WORKOUT_MAX_MS). Every WORKOUT_UPDATE_MS, onUpdate() receives the sliding-
+// window HR (0 = no estimate) and the millis() it was computed at. Beats are
+// ~0.4 s old when confirmed and the FIFO adds up to one drain interval, so
+// an estimate lags the newest beat by ~0.6 s plus the window.
+// ---------------------------------------------------------------------------
+struct WorkoutResult
+{
+   uint32_t durationMs;
+   uint8_t *series;  // HR per second (0 = no estimate); malloc'd, caller frees
+   uint16_t seconds; // entries in series
+   uint16_t updates; // estimates published
+   uint8_t meanBpm;  // over the seconds with an estimate
+   uint8_t maxBpm;
+   uint32_t led_ua;     // LED drive current
+   uint32_t ledAvgUa;   // LED current averaged over the pulse duty cycle
+};
+
+WorkoutResult runWorkout(bool (*keepRunning)(), void (*onUpdate)(uint8_t bpm, uint32_t estimateMs))
+{
+   WorkoutResult result = {};
+   result.series = (uint8_t *)malloc(WORKOUT_MAX_SECONDS);
+   if (!result.series)
+   {
+      Serial.println("ERROR: Failed to allocate the workout HR series");
+      return result;
+   }
+   Serial.printf("Workout: continuous HR, %d s window, update every %d s\n",
+                 WORKOUT_WINDOW_MS / 1000, WORKOUT_UPDATE_MS / 1000);
+
+   StreamingHRPipeline pipeline(BANDPASS_SOS,
+                                PEAK_MIN_DISTANCE,
+                                HR_MS_TO_SAMPLES(STREAM_WARMUP_MS),
+                                HR_MS_TO_SAMPLES(STREAM_VAR_WINDOW_MS));
+   // The tachogram is drained after every burst, so it never fills up.
+   pipeline.attachTachogram(&hrvTachogram);
+   SlidingHR sliding(WORKOUT_WINDOW_MS * 1000UL);
+#if HR_MOTION_CANCEL
+   AccelSample accelBurst[MAX30102_FIFO_DEPTH];
+   bool useAccel = imuReady && accelFifo.begin();
+   if (useAccel)
+      pipeline.attachMotion(&motionCanceller);
+   accelAligner.reset();
+#endif
+
+   uint8_t channels = setPPGMode(PPG_MODE_IR_ONLY);
+   runLedAgc(channels);
+   result.led_ua = ledCurrentUa(channels);
+   result.ledAvgUa = ledAverageUa(channels);
+   ppgFifo.begin(PPG_OUTPUT_RATE_HZ, channels);
+
+   PPGSample burst[MAX30102_FIFO_DEPTH];
+   CicDecimator decimator(PPG_DECIMATION);
+   uint32_t startMs = millis();
+   uint32_t lastUpdateMs = startMs;
+   uint32_t lastBeatMs = startMs;
+   uint32_t bpmSum = 0;
+   uint16_t bpmSeconds = 0;
+
+   while (millis() - startMs < WORKOUT_MAX_MS && keepRunning())
+   {
+#if HR_MOTION_CANCEL
+      if (useAccel)
+         accelAligner.push(accelBurst, accelFifo.drain(accelBurst, MAX30102_FIFO_DEPTH));
+#endif
+      uint8_t n = ppgFifo.drain(burst, MAX30102_FIFO_DEPTH);
+      for (uint8_t i = 0; i < n; i++)
+      {
+         int32_t decimated;
+         if (!decimator.push((int32_t)burst[i].ir, decimated))
+            continue;
+#if HR_MOTION_CANCEL
+         if (useAccel)
+         {
+            pipeline.push(decimated, burst[i].timeUs, accelAligner.at(burst[i].timeUs));
+            continue;
+         }
+#endif
+         pipeline.push(decimated, burst[i].timeUs);
+      }
+      uint32_t now = millis();
+      if (hrvTachogram.count() > 0)
+      {
+         for (uint16_t k = 0; k < hrvTachogram.count(); k++)
+            sliding.add(hrvTachogram.intervalUs(k));
+         hrvTachogram.reset();
+         lastBeatMs = now;
+      }
+      // No beats for a whole window: the estimate would be stale
+      uint8_t bpm = now - lastBeatMs < WORKOUT_WINDOW_MS ? sliding.bpm(WORKOUT_MIN_RR) : 0;
+
+      uint32_t second = (now - startMs) / 1000;
+      for (; result.seconds < second && result.seconds < WORKOUT_MAX_SECONDS; result.seconds++)
+      {
+         result.series[result.seconds] = bpm;
+         if (bpm > 0)
+         {
+            bpmSum += bpm;
+            bpmSeconds++;
+            if (bpm > result.maxBpm)
+               result.maxBpm = bpm;
+         }
+      }
+      if (now - lastUpdateMs >= WORKOUT_UPDATE_MS)
+      {
+         lastUpdateMs = now;
+         onUpdate(bpm, now);
+         result.updates++;
+      }
+
+      // Sleep until the FIFO has collected the next burst.
+      delay(FIFO_DRAIN_INTERVAL_MS);
+   }
+#if HR_MOTION_CANCEL
+   accelFifo.end();
+#endif
+   pipeline.attachTachogram(nullptr);
+
+   result.durationMs = millis() - startMs;
+   result.meanBpm = bpmSeconds ? (uint8_t)((bpmSum + bpmSeconds / 2) / bpmSeconds) : 0;
+   Serial.printf("Workout done: %lu s, mean %d BPM, max %d BPM, %d/%d s with HR, %d updates, %lu dropped samples\n",
+                 result.durationMs / 1000, result.meanBpm, result.maxBpm, bpmSeconds, result.seconds,
+                 result.updates, ppgFifo.droppedSamples());
    return result;
 }
 
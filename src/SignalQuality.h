@@ -0,0 +1,241 @@
+#ifndef SIGNALQUALITY_H
+#define SIGNALQUALITY_H
+
+#include <math.h>
+#include <stdint.h>
+#include "DSPCore.h"
+
+/*
+ * Windowed signal-quality index (SQI) of the bandpassed PPG. The session is
+ * cut into fixed windows, and each one is scored on three measures:
+ *
+ *   - perfusion index, PI = AC / DC in percent (hrv_analysis.ipynb): AC is
+ *     the peak-to-peak range of the bandpassed signal, DC the mean raw IR.
+ *     Low PI means poor contact or no pulse under the sensor.
+ *   - template correlation: each beat (SQI_TEMPLATE_POINTS samples around
+ *     the peak) is correlated with a running average of the previous beats.
+ *     Motion bends the pulse shape even when the peaks are still found.
+ *   - kurtosis of the window: a clean pulse stays below ~5 (a sine is 1.5);
+ *     motion spikes make the distribution heavy-tailed.
+ *
+ * A window is good when all three pass. The caller keeps only the RR
+ * intervals inside good windows (see StreamingHRPipeline::firstBeatUs()).
+ *
+ * Float arithmetic in both DSP modes: 6 flops per sample, ~200 per beat.
+ */
+
+#define SQI_TEMPLATE_HALF 20 // template points on each side of the peak
+#define SQI_TEMPLATE_POINTS (2 * SQI_TEMPLATE_HALF + 1)
+#define SQI_TEMPLATE_SHIFT 2 // running template weight 1/4
+#define SQI_RING 64          // recent samples kept (at the template stride)
+#define SQI_MAX_WINDOWS 32
+#define SQI_MIN_PI 0.05f     // percent
+#define SQI_MIN_CORR 0.75f
+#define SQI_MAX_KURTOSIS 6.0f
+#define SQI_MIN_BEATS 2 // per window
+
+struct SqiWindow
+{
+   uint32_t startUs, endUs;
+   float pi;       // perfusion index, percent
+   float corr;     // mean beat-to-template correlation
+   float kurtosis;
+   uint8_t beats;
+   bool good;
+};
+
+class SignalQuality
+{
+   uint32_t windowSamples;
+   uint32_t stride; // samples between template points
+
+   float ring[SQI_RING];
+   uint32_t n;
+   float beatTemplate[SQI_TEMPLATE_POINTS];
+   bool haveTemplate;
+
+   // Current window
+   uint32_t inWindow;
+   uint32_t startUs, lastUs;
+   int64_t dcSum;
+   float lo, hi;
+   float s1, s2, s3, s4;
+   float corrSum;
+   uint8_t corrBeats, beats;
+
+   SqiWindow windows[SQI_MAX_WINDOWS];
+   uint8_t count;
+
+   void openWindow()
+   {
+      inWindow = 0;
+      dcSum = 0;
+      s1 = s2 = s3 = s4 = 0.0f;
+      corrSum = 0.0f;
+      corrBeats = beats = 0;
+   }
+
+   void closeWindow(uint32_t endUs)
+   {
+      if (count < SQI_MAX_WINDOWS)
+      {
+         SqiWindow &w = windows[count++];
+         float m = s1 / inWindow;
+         float m2 = s2 / inWindow - m * m;
+         float m4 = s4 / inWindow - 4.0f * m * s3 / inWindow + 6.0f * m * m * s2 / inWindow - 3.0f * m * m * m * m;
+         float dc = (float)dcSum / inWindow;
+         w.startUs = startUs;
+         w.endUs = endUs;
+         w.pi = dc > 0.0f ? 100.0f * (hi - lo) / dc : 0.0f;
+         w.corr = corrBeats ? corrSum / corrBeats : 0.0f;
+         w.kurtosis = m2 > 0.0f ? m4 / (m2 * m2) : 0.0f;
+         w.beats = beats;
+         w.good = w.pi >= SQI_MIN_PI && w.beats >= SQI_MIN_BEATS &&
+                  w.corr >= SQI_MIN_CORR && w.kurtosis <= SQI_MAX_KURTOSIS;
+      }
+      openWindow();
+   }
+
+public:
+   // windowSamples: window length; strideSamples: spacing of the template
+   // points (20 ms keeps the template at ±400 ms, which the peak detector's
+   // 400 ms confirmation delay has fully buffered).
+   SignalQuality(uint32_t windowSamples, uint32_t strideSamples)
+       : windowSamples(windowSamples), stride(strideSamples > 0 ? strideSamples : 1) { reset(); }
+
+   void reset()
+   {
+      n = 0;
+      haveTemplate = false;
+      count = 0;
+      openWindow();
+   }
+
+   // raw: IR sample as acquired; y: the same sample bandpassed.
+   void push(int32_t raw, dsp_sample_t y, uint32_t timeUs)
+   {
+      float v = dspToCounts(y);
+      if (inWindow == 0)
+      {
+         startUs = timeUs;
+         lo = hi = v;
+      }
+      float v2 = v * v;
+      dcSum += raw;
+      if (v < lo)
+         lo = v;
+      if (v > hi)
+         hi = v;
+      s1 += v;
+      s2 += v2;
+      s3 += v2 * v;
+      s4 += v2 * v2;
+      if (n % stride == 0)
+         ring[(n / stride) % SQI_RING] = v;
+      n++;
+      lastUs = timeUs;
+      if (++inWindow >= windowSamples)
+         closeWindow(timeUs);
+   }
+
+   // A beat was confirmed ageSamples before the last pushed sample.
+   void beat(uint32_t ageSamples)
+   {
+      beats++;
+      if (ageSamples >= n)
+         return;
+      uint32_t newest = (n - 1) / stride;
+      uint32_t peak = (n - 1 - ageSamples + stride / 2) / stride;
+      if (peak < SQI_TEMPLATE_HALF || peak + SQI_TEMPLATE_HALF > newest ||
+          newest - (peak - SQI_TEMPLATE_HALF) >= SQI_RING)
+         return; // not (or no longer) fully in the ring
+
+      // Zero mean, unit norm
+      float seg[SQI_TEMPLATE_POINTS];
+      float mean = 0.0f;
+      for (uint8_t i = 0; i < SQI_TEMPLATE_POINTS; i++)
+      {
+         seg[i] = ring[(peak - SQI_TEMPLATE_HALF + i) % SQI_RING];
+         mean += seg[i];
+      }
+      mean /= SQI_TEMPLATE_POINTS;
+      float norm = 0.0f;
+      for (uint8_t i = 0; i < SQI_TEMPLATE_POINTS; i++)
+      {
+         seg[i] -= mean;
+         norm += seg[i] * seg[i];
+      }
+      if (norm <= 0.0f)
+         return;
+      norm = 1.0f / sqrtf(norm);
+      for (uint8_t i = 0; i < SQI_TEMPLATE_POINTS; i++)
+         seg[i] *= norm;
+
+      if (!haveTemplate)
+      {
+         for (uint8_t i = 0; i < SQI_TEMPLATE_POINTS; i++)
+            beatTemplate[i] = seg[i];
+         haveTemplate = true;
+         return;
+      }
+      float dot = 0.0f, tNorm = 0.0f;
+      for (uint8_t i = 0; i < SQI_TEMPLATE_POINTS; i++)
+      {
+         dot += seg[i] * beatTemplate[i];
+         tNorm += beatTemplate[i] * beatTemplate[i];
+         beatTemplate[i] += (seg[i] - beatTemplate[i]) * (1.0f / (1 << SQI_TEMPLATE_SHIFT));
+      }
+      corrSum += dot / sqrtf(tNorm);
+      corrBeats++;
+   }
+
+   uint8_t windowCount() const { return count; }
+   const SqiWindow &window(uint8_t i) const { return windows[i]; }
+
+   // Close a trailing partial window if it is at least half as long.
+   void finish()
+   {
+      if (inWindow >= windowSamples / 2)
+         closeWindow(lastUs);
+      openWindow();
+   }
+
+   // True when timeUs lies inside a good window (each window reaching up to
+   // the start of the next).
+   bool good(uint32_t timeUs) const
+   {
+      for (int i = count - 1; i >= 0; i--)
+         if ((int32_t)(timeUs - windows[i].startUs) >= 0)
+            return windows[i].good && (i + 1 < count || (int32_t)(windows[i].endUs - timeUs) >= 0);
+      return false;
+   }
+
+   // Mean perfusion index of the good windows (of all windows when none is
+   // good), percent; 0 without windows.
+   float meanPi() const
+   {
+      float sum = 0.0f, goodSum = 0.0f;
+      uint8_t g = 0;
+      for (uint8_t i = 0; i < count; i++)
+      {
+         sum += windows[i].pi;
+         if (windows[i].good)
+         {
+            goodSum += windows[i].pi;
+            g++;
+         }
+      }
+      return g ? goodSum / g : count ? sum / count : 0.0f;
+   }
+
+   // Share of the closed windows that are good, percent.
+   uint8_t goodPct() const
+   {
+      uint8_t g = 0;
+      for (uint8_t i = 0; i < count; i++)
+         g += windows[i].good;
+      return count ? (uint8_t)(g * 100 / count) : 0;
+   }
+};
+
+#endif // SIGNALQUALITY_H
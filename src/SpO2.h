@@ -0,0 +1,152 @@
+#ifndef SPO2_H
+#define SPO2_H
+
+#include <stdint.h>
+#include "DSPCore.h"
+
+/*
+ * SpO2 from the Red and IR channels by the ratio of ratios:
+ *
+ *   R = (AC_red / DC_red) / (AC_ir / DC_ir)
+ *
+ * Both channels go through the same bandpass as the HR pipeline, here with
+ * their own filter states so Red and IR see identical processing (the IR
+ * path of the pipeline may also be motion-cancelled). The HR pipeline's beats
+ * cut the signal into beat intervals. Per interval, AC is the peak-to-peak
+ * range of the bandpassed channel and DC the mean raw level, which gives one
+ * R per beat. The session R is their median, mapped to SpO2 with Maxim's
+ * reference curve (as in the SparkFun spo2_algorithm). The curve is not
+ * calibrated for this enclosure, so treat absolute values as a trend.
+ */
+
+#define SPO2_MAX_BEATS 128 // per-beat ratios kept for the median
+#define SPO2_MIN_BEATS 8
+#define SPO2_MIN_PCT 70
+// SpO2 = A·R² + B·R + C
+#define SPO2_CAL_A -45.060f
+#define SPO2_CAL_B 30.354f
+#define SPO2_CAL_C 94.845f
+
+class SpO2Estimator
+{
+   DspBiquad coeffs[DSP_MAX_SECTIONS];
+   DspBiquadState state[2][DSP_MAX_SECTIONS]; // 0 = Red, 1 = IR
+   uint32_t warmup;
+   uint32_t n;
+   bool anchored;
+   int32_t anchor[2];
+
+   // Current beat interval
+   bool open;
+   uint32_t inBeat;
+   int64_t dcSum[2];
+   dsp_sample_t lo[2], hi[2];
+
+   uint16_t ratios[SPO2_MAX_BEATS]; // R in Q13
+   uint16_t count;
+
+   void openBeat()
+   {
+      inBeat = 0;
+      dcSum[0] = dcSum[1] = 0;
+   }
+
+public:
+   // sos: the HR bandpass; warmupSamples: filter settle time before the
+   // first beat interval starts.
+   SpO2Estimator(const float (*sos)[6], uint32_t warmupSamples) : warmup(warmupSamples)
+   {
+      dspLoadSOS(sos, DSP_MAX_SECTIONS, coeffs);
+      reset();
+   }
+
+   void reset()
+   {
+      for (uint8_t c = 0; c < 2; c++)
+         for (uint8_t s = 0; s < DSP_MAX_SECTIONS; s++)
+            dspBiquadReset(state[c][s]);
+      n = 0;
+      anchored = false;
+      open = false;
+      count = 0;
+      openBeat();
+   }
+
+   // One raw sample of each channel, taken at the same time.
+   void push(int32_t red, int32_t ir)
+   {
+      if (!anchored)
+      {
+         anchor[0] = red;
+         anchor[1] = ir;
+         anchored = true;
+      }
+      const int32_t raw[2] = {red, ir};
+      for (uint8_t c = 0; c < 2; c++)
+      {
+         dsp_sample_t y = dspFromCounts(raw[c] - anchor[c]);
+         for (uint8_t s = 0; s < DSP_MAX_SECTIONS; s++)
+            y = dspBiquadStep(coeffs[s], state[c][s], y);
+         if (inBeat == 0 || y < lo[c])
+            lo[c] = y;
+         if (inBeat == 0 || y > hi[c])
+            hi[c] = y;
+         dcSum[c] += raw[c];
+      }
+      inBeat++;
+      n++;
+   }
+
+   // The HR pipeline confirmed a beat: close the interval since the last one.
+   void beat()
+   {
+      if (n <= warmup)
+         return;
+      if (open && inBeat > 0 && count < SPO2_MAX_BEATS)
+      {
+         float redDc = (float)dcSum[0] / inBeat, irDc = (float)dcSum[1] / inBeat;
+         float redAc = dspToCounts(hi[0] - lo[0]), irAc = dspToCounts(hi[1] - lo[1]);
+         if (redDc > 0.0f && irDc > 0.0f && irAc > 0.0f)
+         {
+            float r = (redAc / redDc) / (irAc / irDc);
+            if (r < 8.0f)
+               ratios[count++] = (uint16_t)(r * 8192.0f + 0.5f);
+         }
+      }
+      open = true;
+      openBeat();
+   }
+
+   uint16_t beatCount() const { return count; }
+
+   // Median ratio of ratios; 0 below SPO2_MIN_BEATS. Sorts the ratios.
+   float ratio()
+   {
+      if (count < SPO2_MIN_BEATS)
+         return 0.0f;
+      for (uint16_t i = 1; i < count; i++)
+      {
+         uint16_t v = ratios[i];
+         int16_t j = i - 1;
+         for (; j >= 0 && ratios[j] > v; j--)
+            ratios[j + 1] = ratios[j];
+         ratios[j + 1] = v;
+      }
+      return ratios[count / 2] / 8192.0f;
+   }
+
+   // SpO2 in percent from the median ratio; 0 when there are too few beats
+   // or the ratio maps below SPO2_MIN_PCT.
+   uint8_t spo2Pct()
+   {
+      float r = ratio();
+      if (r <= 0.0f)
+         return 0;
+      float spo2 = SPO2_CAL_A * r * r + SPO2_CAL_B * r + SPO2_CAL_C;
+      if (spo2 < SPO2_MIN_PCT)
+         return 0;
+      return spo2 >= 100.0f ? 100 : (uint8_t)(spo2 + 0.5f);
+   }
+};
+
+#endif // SPO2_H
@@ -0,0 +1,180 @@
+#ifndef SPECTRALHR_H
+#define SPECTRALHR_H
+
+#include <math.h>
+#include <stdint.h>
+#include "DSPCore.h"
+#include "FilterDesign.h"
+
+/*
+ * Spectral heart-rate estimate: a Goertzel bank with one bin per BPM from
+ * SPECTRAL_HR_MIN_BPM to SPECTRAL_HR_MAX_BPM, fed with the bandpassed signal
+ * one sample at a time. It needs no peaks, so it still finds the pulse rate
+ * when motion breaks the peak detector, and serves as a cross-check when the
+ * detector works.
+ *
+ * The 2cos(w) coefficients are computed at compile time for the nominal
+ * FILTER_FS (GoertzelHRTable<FsHz>); peakBpm() rescales to the measured rate.
+ * Fixed point: input reduced to Q4, int64 resonator state, Q30 coefficients.
+ */
+
+#define SPECTRAL_HR_MIN_BPM 40
+#define SPECTRAL_HR_MAX_BPM 180
+#define SPECTRAL_HR_BINS (SPECTRAL_HR_MAX_BPM - SPECTRAL_HR_MIN_BPM + 1)
+
+#if DSP_FIXED_POINT
+typedef int32_t goertzel_coef_t; // 2cos(w), Q30
+typedef int64_t goertzel_state_t;
+#else
+typedef float goertzel_coef_t;
+typedef float goertzel_state_t;
+#endif
+
+struct GoertzelCoefs
+{
+   goertzel_coef_t c[SPECTRAL_HR_BINS];
+};
+
+template <int FsHz>
+struct GoertzelHRTable
+{
+   static_assert(SPECTRAL_HR_MAX_BPM < FsHz * 30, "top bin must be below Nyquist");
+
+   static constexpr GoertzelCoefs design()
+   {
+      GoertzelCoefs out = {};
+      for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+      {
+         double w = 2.0 * filter_design::PI * (SPECTRAL_HR_MIN_BPM + k) / 60.0 / FsHz;
+         double c = 2.0 * filter_design::ccos(w);
+#if DSP_FIXED_POINT
+         out.c[k] = (int32_t)(c * (1 << DSP_COEF_FRAC_BITS) + 0.5);
+#else
+         out.c[k] = (float)c;
+#endif
+      }
+      return out;
+   }
+
+   static constexpr GoertzelCoefs table = design();
+};
+
+class GoertzelHRBank
+{
+   const goertzel_coef_t *coef;
+   uint32_t segment; // samples per segment
+   goertzel_state_t s1[SPECTRAL_HR_BINS];
+   goertzel_state_t s2[SPECTRAL_HR_BINS];
+   float spectrum[SPECTRAL_HR_BINS]; // sum of the normalised segment spectra
+   uint32_t n;
+   uint32_t inSegment;
+   uint16_t segments;
+
+   // Close the current segment: add its spectrum, scaled to unit total power,
+   // and restart the resonators.
+   void endSegment()
+   {
+      float sum = 0.0f;
+      for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+         sum += power(k);
+      if (sum > 0.0f)
+      {
+         for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+            spectrum[k] += power(k) / sum;
+         segments++;
+      }
+      for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+         s1[k] = s2[k] = 0;
+      inSegment = 0;
+   }
+
+   float power(int k) const
+   {
+#if DSP_FIXED_POINT
+      float a = (float)s1[k], b = (float)s2[k];
+      float c = (float)coef[k] / (float)(1 << DSP_COEF_FRAC_BITS);
+#else
+      float a = s1[k], b = s2[k], c = coef[k];
+#endif
+      return a * a + b * b - c * a * b;
+   }
+
+public:
+   GoertzelHRBank(const GoertzelCoefs &table, uint32_t segmentSamples)
+       : coef(table.c), segment(segmentSamples) { reset(); }
+
+   void reset()
+   {
+      for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+      {
+         s1[k] = s2[k] = 0;
+         spectrum[k] = 0.0f;
+      }
+      n = inSegment = 0;
+      segments = 0;
+   }
+
+   void push(dsp_sample_t x)
+   {
+#if DSP_FIXED_POINT
+      goertzel_state_t in = x >> DSP_STAT_SHIFT;
+      for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+      {
+         goertzel_state_t s = in + ((coef[k] * s1[k]) >> DSP_COEF_FRAC_BITS) - s2[k];
+         s2[k] = s1[k];
+         s1[k] = s;
+      }
+#else
+      for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+      {
+         float s = x + coef[k] * s1[k] - s2[k];
+         s2[k] = s1[k];
+         s1[k] = s;
+      }
+#endif
+      n++;
+      if (++inSegment >= segment)
+         endSegment();
+   }
+
+   // Close a trailing partial segment if it is at least half as long.
+   void finish()
+   {
+      if (inSegment >= segment / 2)
+         endSegment();
+   }
+
+   uint32_t count() const { return n; }
+
+   // Strongest bin of the averaged spectrum, refined by a parabola through
+   // its neighbours and scaled from the design rate to the measured one.
+   // peakRatio receives the peak over the mean bin (1 = flat spectrum).
+   // Returns 0 before the first segment is complete (see finish()) and when
+   // the maximum sits on an edge bin.
+   float peakBpm(float designFsHz, float actualFsHz, float &peakRatio) const
+   {
+      peakRatio = 0.0f;
+      if (segments == 0)
+         return 0.0f;
+      int best = 0;
+      float sum = 0.0f;
+      for (int k = 0; k < SPECTRAL_HR_BINS; k++)
+      {
+         sum += spectrum[k];
+         if (spectrum[k] > spectrum[best])
+            best = k;
+      }
+      peakRatio = spectrum[best] * SPECTRAL_HR_BINS / sum;
+
+      // A maximum on the edge bin is the slope of something outside the band
+      // (usually slow motion), not a pulse peak.
+      if (best == 0 || best == SPECTRAL_HR_BINS - 1)
+         return 0.0f;
+      float pl = spectrum[best - 1], pc = spectrum[best], pr = spectrum[best + 1];
+      float den = pl - 2.0f * pc + pr;
+      float offset = den < 0.0f ? 0.5f * (pl - pr) / den : 0.0f;
+      return (SPECTRAL_HR_MIN_BPM + best + offset) * actualFsHz / designFsHz;
+   }
+};
+
+#endif // SPECTRALHR_H
@@ -0,0 +1,522 @@
+#ifndef STREAMINGHR_H
+#define STREAMINGHR_H
+
+#include <math.h>
+#include <stdint.h>
+#include "DSPCore.h"
+#include "MotionCancel.h"
+#include "SignalQuality.h"
+#include "SpO2.h"
+#include "SpectralHR.h"
+
+/*
+ * Streaming HR/HRV pipeline — constant-memory alternative to the batch
+ * capture-then-filter path in measureHeartRate().
+ *
+ *   raw IR ─► DC anchor ─► causal SOS bandpass ─► motion canceller (optional)
+ *          │                ─► online peak detector ─► RR artifact correction
+ *          │                │                       ─► RR stats
+ *          │                └─► windowed SQI, fed the peaks too (optional)
+ *          └─► respiratory SOS band ─► online breath detector (optional)
+ *
+ * Every stage consumes one sample at a time, so memory is fixed and does not
+ * grow with the measurement window: ~0.4 KB for the pipeline object itself,
+ * ~9 KB with every optional stage attached (README.md has the breakdown;
+ * the largest are the Goertzel bank, 2.8 KB, the tachogram ring, 1.5 KB,
+ * and the SQI template/ring, 1.3 KB). The filter is the same
+ * 0.5-5 Hz Butterworth as the batch path but runs forward only: its phase
+ * delay shifts every beat by a near-constant amount, which cancels out in
+ * the RR intervals. Arithmetic follows DSP_FIXED_POINT (see DSPCore.h).
+ */
+
+// SOS cascade, one sample per call.
+class StreamingBandpass
+{
+public:
+   static constexpr uint8_t SECTIONS = DSP_MAX_SECTIONS;
+
+private:
+   DspBiquad coeffs[SECTIONS];
+   DspBiquadState state[SECTIONS];
+
+public:
+   explicit StreamingBandpass(const float (*sos)[6])
+   {
+      dspLoadSOS(sos, SECTIONS, coeffs);
+      reset();
+   }
+
+   void reset()
+   {
+      for (uint8_t s = 0; s < SECTIONS; s++)
+         dspBiquadReset(state[s]);
+   }
+
+   dsp_sample_t process(dsp_sample_t x)
+   {
+      for (uint8_t s = 0; s < SECTIONS; s++)
+         x = dspBiquadStep(coeffs[s], state[s], x);
+      return x;
+   }
+};
+
+// Causal peak detector following hrv_analysis.ipynb (find_peaks with
+// distance + prominence). A local maximum becomes a candidate; a taller
+// one within minDist samples replaces it. After minDist samples without a
+// taller maximum the candidate is confirmed if its prominence (height above
+// the higher of the troughs on either side) exceeds thresholdScale × running
+// stddev. Peaks are therefore emitted with a fixed latency of minDist samples;
+// their time is interpolated between samples (dspParabolicPeakOffset()).
+class OnlinePeakDetector
+{
+   uint32_t minDist;
+   uint32_t warmup;
+#if DSP_FIXED_POINT
+   int32_t scaleQ16;
+   int32_t alphaQ16; // EMA weight for the running mean/variance
+   int64_t emaVar;   // Q4² (see DSP_STAT_SHIFT)
+#else
+   float thresholdScale;
+   float alpha; // EMA weight for the running mean/variance
+   float emaVar;
+#endif
+   dsp_sample_t emaMean;
+
+   uint32_t n; // samples seen
+   dsp_sample_t prev1, prev2;
+   uint32_t prevTimeUs;
+   dsp_sample_t trough; // minimum since the last confirmed/rejected candidate
+
+   uint32_t emittedIdx; // sample index of the last confirmed peak
+
+   bool pending;
+   uint32_t pendingIdx;
+   uint32_t pendingUs;
+   dsp_sample_t pendingVal;
+   dsp_sample_t pendingLeftMin;
+   dsp_sample_t pendingRightMin;
+
+   void updateVariance(dsp_sample_t y)
+   {
+#if DSP_FIXED_POINT
+      int64_t d = (int64_t)y - emaMean;
+      emaMean += (dsp_sample_t)((d * alphaQ16) >> 16);
+      int64_t d4 = d >> DSP_STAT_SHIFT;
+      emaVar += ((d4 * d4 - emaVar) * alphaQ16) >> 16;
+#else
+      float d = y - emaMean;
+      emaMean += alpha * d;
+      emaVar = (1.0f - alpha) * (emaVar + alpha * d * d);
+#endif
+   }
+
+public:
+   // minDistSamples: refractory distance; warmupSamples: settle time before
+   // detection starts; varWindowSamples: time constant of the stddev estimate.
+   OnlinePeakDetector(uint32_t minDistSamples, uint32_t warmupSamples,
+                      uint32_t varWindowSamples, float scale = 0.3f)
+       : minDist(minDistSamples), warmup(warmupSamples),
+#if DSP_FIXED_POINT
+         scaleQ16((int32_t)(scale * 65536.0f)),
+         alphaQ16((int32_t)(65536UL / (varWindowSamples > 0 ? varWindowSamples : 1)))
+#else
+         thresholdScale(scale),
+         alpha(1.0f / (float)(varWindowSamples > 0 ? varWindowSamples : 1))
+#endif
+   {
+      reset();
+   }
+
+   void reset()
+   {
+      n = 0;
+      prev1 = prev2 = 0;
+      prevTimeUs = 0;
+      emaMean = 0;
+      emaVar = 0;
+      trough = 0;
+      emittedIdx = 0;
+      pending = false;
+      pendingIdx = pendingUs = 0;
+      pendingVal = pendingLeftMin = pendingRightMin = 0;
+   }
+
+   dsp_sample_t threshold() const
+   {
+#if DSP_FIXED_POINT
+      int64_t sd = (int64_t)isqrt64((uint64_t)emaVar) << DSP_STAT_SHIFT;
+      return (dsp_sample_t)((sd * scaleQ16) >> 16);
+#else
+      return thresholdScale * sqrtf(emaVar);
+#endif
+   }
+
+   // Feed one filtered sample taken at timeUs. Returns true when a peak has
+   // been confirmed; its acquisition timestamp is written to peakUs.
+   bool push(dsp_sample_t y, uint32_t timeUs, uint32_t &peakUs)
+   {
+      bool emitted = false;
+
+      // Running mean/variance of the filtered signal (exponential window).
+      updateVariance(y);
+
+      if (n < warmup)
+      {
+         trough = y;
+      }
+      else
+      {
+         // prev1 is a local maximum (same comparison as detectPeaks()).
+         if (prev1 > prev2 && prev1 >= y)
+         {
+            // Beat time between samples from the parabola through prev2..y
+            uint32_t peakTimeUs = prevTimeUs + dspParabolicPeakOffset(prev2, prev1, y, (int32_t)(timeUs - prevTimeUs));
+            if (!pending)
+            {
+               pending = true;
+               pendingIdx = n - 1;
+               pendingUs = peakTimeUs;
+               pendingVal = prev1;
+               pendingLeftMin = trough;
+               pendingRightMin = prev1;
+            }
+            else if (prev1 >= pendingVal)
+            {
+               // Taller peak inside the refractory window replaces the
+               // candidate; its left base extends back over the old one.
+               if (pendingRightMin < pendingLeftMin)
+                  pendingLeftMin = pendingRightMin;
+               pendingIdx = n - 1;
+               pendingUs = peakTimeUs;
+               pendingVal = prev1;
+               pendingRightMin = prev1;
+            }
+         }
+
+         if (y < trough)
+            trough = y;
+         if (pending && y < pendingRightMin)
+            pendingRightMin = y;
+
+         if (pending && n - pendingIdx >= minDist)
+         {
+            dsp_sample_t base = (pendingLeftMin > pendingRightMin) ? pendingLeftMin : pendingRightMin;
+            pending = false;
+            if (pendingVal - base >= threshold())
+            {
+               peakUs = pendingUs;
+               emittedIdx = pendingIdx;
+               emitted = true;
+               trough = pendingRightMin;
+            }
+         }
+      }
+
+      prev2 = prev1;
+      prev1 = y;
+      prevTimeUs = timeUs;
+      n++;
+      return emitted;
+   }
+
+   // Confirm a candidate still waiting out its refractory window at the end
+   // of the session.
+   bool flush(uint32_t &peakUs)
+   {
+      if (!pending)
+         return false;
+      pending = false;
+      dsp_sample_t base = (pendingLeftMin > pendingRightMin) ? pendingLeftMin : pendingRightMin;
+      if (pendingVal - base < threshold())
+         return false;
+      peakUs = pendingUs;
+      emittedIdx = pendingIdx;
+      return true;
+   }
+
+   // Samples between the last confirmed peak and the last sample pushed.
+   uint32_t peakAge() const { return n - 1 - emittedIdx; }
+};
+
+// Respiratory band of the same input: a second SOS cascade (0.1-0.5 Hz)
+// keeps the baseline modulation the cardiac bandpass removes, and the online
+// peak detector picks one peak per breath.
+class StreamingRespiration
+{
+   StreamingBandpass filter;
+   OnlinePeakDetector detector;
+   uint16_t breaths;
+   uint32_t firstUs, lastUs;
+
+public:
+   StreamingRespiration(const float (*sos)[6], uint32_t minDistSamples,
+                        uint32_t warmupSamples, uint32_t varWindowSamples)
+       : filter(sos), detector(minDistSamples, warmupSamples, varWindowSamples)
+   {
+      reset();
+   }
+
+   void reset()
+   {
+      filter.reset();
+      detector.reset();
+      breaths = 0;
+      firstUs = lastUs = 0;
+   }
+
+   // x: DC-anchored sample in DSP format (what StreamingHRPipeline filters).
+   void push(dsp_sample_t x, uint32_t timeUs)
+   {
+      uint32_t peakUs;
+      if (detector.push(filter.process(x), timeUs, peakUs))
+         addBreath(peakUs);
+   }
+
+   void finish()
+   {
+      uint32_t peakUs;
+      if (detector.flush(peakUs))
+         addBreath(peakUs);
+   }
+
+   uint16_t breathCount() const { return breaths; }
+
+   // Breaths per minute x 10 from the mean breath interval; 0 below 3 breaths.
+   uint16_t rateX10() const
+   {
+      if (breaths < 3 || lastUs == firstUs)
+         return 0;
+      return (uint16_t)((uint64_t)(breaths - 1) * 600000000ULL / (lastUs - firstUs));
+   }
+
+private:
+   void addBreath(uint32_t peakUs)
+   {
+      if (breaths == 0)
+         firstUs = peakUs;
+      lastUs = peakUs;
+      breaths++;
+   }
+};
+
+// Full streaming chain with artifact-corrected running RR statistics.
+class StreamingHRPipeline
+{
+   StreamingBandpass filter;
+   OnlinePeakDetector detector;
+   RRArtifactFilter artifacts;
+   RRStats rr;
+   GoertzelHRBank *spectral; // optional, fed with the filtered signal after warmup
+   StreamingRespiration *respiration; // optional, fed with the same input
+   MotionCanceller *motion;           // optional, needs accel with each sample
+   SignalQuality *quality;            // optional, windows the filtered signal after warmup
+   SpO2Estimator *spo2;               // optional, fed Red/IR by the caller; gets the beats
+   uint32_t warmup;
+   uint32_t samples;
+
+   bool anchored;
+   int32_t dcAnchor; // first sample; keeps the ~100k IR level out of the filter
+
+   bool havePeak;
+   uint32_t firstPeakUs;
+   uint32_t lastPeakUs;
+   uint16_t peaks;
+
+   void addPeak(uint32_t peakUs)
+   {
+      peaks++;
+      if (quality)
+         quality->beat(detector.peakAge());
+      if (spo2)
+         spo2->beat();
+      if (havePeak)
+         artifacts.push(peakUs - lastPeakUs, rr);
+      else
+         firstPeakUs = peakUs;
+      havePeak = true;
+      lastPeakUs = peakUs;
+   }
+
+public:
+   StreamingHRPipeline(const float (*sos)[6], uint32_t minDistSamples,
+                       uint32_t warmupSamples, uint32_t varWindowSamples)
+       : filter(sos), detector(minDistSamples, warmupSamples, varWindowSamples),
+         spectral(nullptr), respiration(nullptr), motion(nullptr), quality(nullptr),
+         spo2(nullptr), warmup(warmupSamples)
+   {
+      reset();
+   }
+
+   void reset()
+   {
+      filter.reset();
+      detector.reset();
+      artifacts.reset();
+      rr.reset();
+      if (spectral)
+         spectral->reset();
+      if (respiration)
+         respiration->reset();
+      if (motion)
+         motion->reset();
+      if (quality)
+         quality->reset();
+      if (spo2)
+         spo2->reset();
+      samples = 0;
+      anchored = false;
+      dcAnchor = 0;
+      havePeak = false;
+      firstPeakUs = lastPeakUs = 0;
+      peaks = 0;
+   }
+
+   // Record the corrected RR series into t (cleared now and on reset()).
+   void attachTachogram(RRTachogram *t)
+   {
+      rr.attach(t);
+      if (t)
+         t->reset();
+   }
+
+   // Also run the spectral HR estimate on the filtered signal (reset now and
+   // on reset()).
+   void attachSpectral(GoertzelHRBank *bank)
+   {
+      spectral = bank;
+      if (bank)
+         bank->reset();
+   }
+
+   // Also extract the respiratory band from the same input (reset now and on
+   // reset()).
+   void attachRespiration(StreamingRespiration *resp)
+   {
+      respiration = resp;
+      if (resp)
+         resp->reset();
+   }
+
+   // Subtract the accel-correlated part of the filtered signal before peak
+   // detection (reset now and on reset()).
+   void attachMotion(MotionCanceller *canceller)
+   {
+      motion = canceller;
+      if (canceller)
+         canceller->reset();
+   }
+
+   // Also score the filtered signal in windows (reset now and on reset()).
+   void attachQuality(SignalQuality *sqi)
+   {
+      quality = sqi;
+      if (sqi)
+         sqi->reset();
+   }
+
+   // Pass the beats on to a SpO2 estimator; its samples come from the caller
+   // (reset now and on reset()).
+   void attachSpO2(SpO2Estimator *estimator)
+   {
+      spo2 = estimator;
+      if (estimator)
+         estimator->reset();
+   }
+
+   // Feed one raw IR sample, with the accel counts taken at the same time
+   // when available. Returns true when a new RR interval was added.
+   bool push(int32_t ir, uint32_t timeUs, const int16_t *accel = nullptr)
+   {
+      if (!anchored)
+      {
+         dcAnchor = ir;
+         anchored = true;
+      }
+      dsp_sample_t x = dspFromCounts(ir - dcAnchor);
+      if (respiration)
+         respiration->push(x, timeUs);
+      dsp_sample_t y = filter.process(x);
+      if (motion && accel)
+         y = motion->process(y, accel);
+      bool settled = ++samples > warmup;
+      if (spectral && settled)
+         spectral->push(y);
+      if (quality && settled)
+         quality->push(ir, y, timeUs);
+      uint32_t peakUs;
+      if (!detector.push(y, timeUs, peakUs))
+         return false;
+      uint16_t before = rr.count();
+      addPeak(peakUs);
+      return rr.count() != before;
+   }
+
+   void finish()
+   {
+      uint32_t peakUs;
+      if (detector.flush(peakUs))
+         addPeak(peakUs);
+      artifacts.finish(rr);
+      if (respiration)
+         respiration->finish();
+      if (quality)
+         quality->finish();
+   }
+
+   uint16_t peakCount() const { return peaks; }
+   // Acquisition time of the first peak; the tachogram's beat times count
+   // from it.
+   uint32_t firstBeatUs() const { return firstPeakUs; }
+   const RRStats &rrStats() const { return rr; }
+   const RRArtifactFilter &artifactStats() const { return artifacts; }
+   float threshold() const { return dspToCounts(detector.threshold()); }
+};
+
+// Heart rate over the newest RR intervals that together span a time window
+// (workout mode). Tracks changes within seconds where the session mean would
+// average them away.
+#define SLIDING_HR_MAX_RR 32 // 8 s at 240 BPM
+
+class SlidingHR
+{
+   uint32_t rr[SLIDING_HR_MAX_RR]; // ring, newest at head - 1
+   uint8_t head;
+   uint8_t filled;
+   uint32_t windowUs;
+
+public:
+   explicit SlidingHR(uint32_t windowUs) : windowUs(windowUs) { reset(); }
+
+   void reset()
+   {
+      head = 0;
+      filled = 0;
+   }
+
+   void add(uint32_t rrUs)
+   {
+      rr[head] = rrUs;
+      head = (head + 1) % SLIDING_HR_MAX_RR;
+      if (filled < SLIDING_HR_MAX_RR)
+         filled++;
+   }
+
+   // BPM from the newest intervals reaching back windowUs (all of them when
+   // they span less); 0 with fewer than minIntervals.
+   uint8_t bpm(uint8_t minIntervals) const
+   {
+      uint32_t sumUs = 0;
+      uint8_t k = 0;
+      while (k < filled && sumUs < windowUs)
+      {
+         sumUs += rr[(head + SLIDING_HR_MAX_RR - 1 - k) % SLIDING_HR_MAX_RR];
+         k++;
+      }
+      if (k < minIntervals || sumUs == 0)
+         return 0;
+      uint32_t bpm = (60000000ULL * k + sumUs / 2) / sumUs;
+      return bpm > 255 ? 255 : (uint8_t)bpm;
+   }
+};
+
+#endif // STREAMINGHR_H
@@ -6,15 +6,20 @@
 
 // Screen modes — double-tap cycles forward through all views
 #define SCREEN_DASHBOARD 0
-#define SCREEN_HR_1H 1
-#define SCREEN_HR_4H 2
-#define SCREEN_HR_24H 3
-#define SCREEN_HR_7D 4
-#define SCREEN_HR_1MO 5
-#define SCREEN_HRV_7D 6
-#define SCREEN_HRV_1MO 7
-#define SCREEN_SLEEP_SUMMARY 8
-#define SCREEN_COUNT 9
+#define SCREEN_WORKOUT 1 // staying on it for WORKOUT_ARM_MS starts workout mode
+#define SCREEN_HR_1H 2
+#define SCREEN_HR_4H 3
+#define SCREEN_HR_24H 4
+#define SCREEN_HR_7D 5
+#define SCREEN_HR_1MO 6
+#define SCREEN_HRV_7D 7
+#define SCREEN_HRV_1MO 8
+#define SCREEN_SLEEP_SUMMARY 9
+#define SCREEN_COUNT 10
+
+// Dwell on SCREEN_WORKOUT before the workout starts, so paging past it to
+// the graphs does not start one
+#define WORKOUT_ARM_MS 3000UL
 
 // Inactivity timeout for interactive wake sessions (milliseconds)
 #define INACTIVITY_TIMEOUT_MS 60000UL
@@ -72,7 +77,7 @@ void toggleScreen()
 {
    currentScreen = (currentScreen + 1) % SCREEN_COUNT;
    const char *screenNames[] = {
-       "DASHBOARD", "HR_1H", "HR_4H", "HR_24H",
+       "DASHBOARD", "WORKOUT", "HR_1H", "HR_4H", "HR_24H",
        "HR_7D", "HR_1MO", "HRV_7D", "HRV_1MO", "SLEEP_SUMMARY"};
    Serial.printf("Switched to %s screen\n",
                  currentScreen < SCREEN_COUNT ? screenNames[currentScreen] : "UNKNOWN");
@@ -84,7 +89,7 @@ void printSystemState()
    Serial.println("\n=== System State ===");
    Serial.printf("Boot count: %d\n", bootCount);
    const char *screenNames[] = {
-       "DASHBOARD", "HR_1H", "HR_4H", "HR_24H",
+       "DASHBOARD", "WORKOUT", "HR_1H", "HR_4H", "HR_24H",
        "HR_7D", "HR_1MO", "HRV_7D", "HRV_1MO", "SLEEP_SUMMARY"};
    Serial.printf("Current screen: %s\n",
                  currentScreen < SCREEN_COUNT ? screenNames[currentScreen] : "UNKNOWN");
@@ -5,6 +5,7 @@
  * - Timer-only wake: device wakes on schedule
  * - Task A: heart-rate measurement (runs independently)
  * - Task B: IMU interrupt handling + UI rendering
+ * - Task C: history persistence (write-behind, flushed before deep sleep)
  * - If interaction continues near session boundary, sleep is delayed
  *   until 60 seconds after the last confirmed double-tap.
  */
@@ -24,22 +25,28 @@
 #define SLEEP_INTERVAL_US (4ULL * 60ULL * 1000000ULL)
 #define SLEEP_INTERVAL_NOWRIST_US (9ULL * 60ULL * 1000000ULL)
 
-// Active measurement/session baseline duration (1 minute)
-#define MEASUREMENT_DURATION_MS 60000UL
+// Active measurement/session baseline duration (56-58 s, see HR_MEASUREMENT_MS)
+#define MEASUREMENT_DURATION_MS HR_MEASUREMENT_MS
 #define ACTIVE_WINDOW_MS MEASUREMENT_DURATION_MS
 
+// Longest wait for the history flush before deep sleep
+#define PERSIST_BARRIER_MS 5000
+
 // Global data storage
 TieredHRStorage hrHistory;
 
 // Task handles
 TaskHandle_t hrTaskHandle = nullptr;
 TaskHandle_t uiTaskHandle = nullptr;
+TaskHandle_t persistTaskHandle = nullptr;
 
 // Shared session state
 SemaphoreHandle_t stateMutex = nullptr;
-SemaphoreHandle_t historyMutex = nullptr;
+SemaphoreHandle_t historyMutex = nullptr; // history writers; readers use its seqlock
+SemaphoreHandle_t persistDone = nullptr;  // given by the persistence task on exit
 
 bool sessionStopRequested = false;
+bool persistStopRequested = false;
 bool measurementComplete = false;
 bool renderRequested = false;
 RTC_DATA_ATTR uint8_t latestHeartRate = 0;
@@ -47,6 +54,23 @@ float latestBatteryVoltage = 0.0f;
 uint16_t latestSdrr = 0;
 uint32_t lastTapTimestampMs = 0;
 
+// Workout mode: the HR task publishes estimates, the UI task refreshes the
+// HR number and accounts the display latency.
+bool workoutRunning = false;
+bool workoutDone = false; // ended while on SCREEN_WORKOUT; page away to re-arm
+bool workoutUpdated = false;
+uint8_t workoutBpm = 0;
+uint32_t workoutEstimateMs = 0;
+uint32_t workoutRefreshes = 0;
+uint32_t workoutLatencySumMs = 0; // estimate to refreshed panel
+uint32_t workoutLatencyMaxMs = 0;
+uint32_t workoutRefreshSumMs = 0; // panel busy time, for the power estimate
+
+// Typical supply currents for the workout power estimate
+#define MCU_ACTIVE_UA 20000    // ESP32-C3 at 160 MHz, radio off
+#define MAX30102_ACTIVE_UA 600 // excluding the LEDs
+#define HISTORY_SLOT_S 300     // one T1 entry per 5 min
+
 static bool lockState(TickType_t waitTicks = pdMS_TO_TICKS(50))
 {
    if (stateMutex == nullptr)
@@ -75,6 +99,82 @@ static void unlockHistory()
    xSemaphoreGive(historyMutex);
 }
 
+// One write-behind pass: copy what is pending under the history lock, write
+// it to flash without the lock, so samples and renders never wait on flash.
+static void persistHistory()
+{
+   while (lockHistory())
+   {
+      bool pending = hrHistory.preparePersist();
+      unlockHistory();
+      if (!pending)
+         return;
+      bool ok = hrHistory.writePersist();
+      // Always settle the job, its records are in the log now; writers
+      // hold the lock for RAM updates only, so this wait is short
+      lockHistory(portMAX_DELAY);
+      hrHistory.finishPersist(ok);
+      unlockHistory();
+      if (!ok)
+         return;
+   }
+}
+
+// Wake the persistence task after a sample was added.
+static void requestHistoryPersist()
+{
+   if (persistTaskHandle != nullptr)
+      xTaskNotifyGive(persistTaskHandle);
+}
+
+static void persistTask(void *parameter)
+{
+   (void)parameter;
+
+   while (true)
+   {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      // Read before the pass: everything stored before the stop request
+      // is then still written by it
+      bool shouldStop = false;
+      if (lockState())
+      {
+         shouldStop = persistStopRequested;
+         unlockState();
+      }
+      persistHistory();
+      if (shouldStop)
+      {
+         break;
+      }
+   }
+
+   xSemaphoreGive(persistDone);
+   persistTaskHandle = nullptr;
+   vTaskDelete(nullptr);
+}
+
+// Flush-before-sleep barrier: the persistence task writes what is pending
+// and exits (it is never deleted mid-write); without it, write here.
+static void flushHistory()
+{
+   if (persistTaskHandle == nullptr)
+   {
+      persistHistory();
+      return;
+   }
+   if (lockState())
+   {
+      persistStopRequested = true;
+      unlockState();
+   }
+   xTaskNotifyGive(persistTaskHandle);
+   if (xSemaphoreTake(persistDone, pdMS_TO_TICKS(PERSIST_BARRIER_MS)) != pdTRUE)
+   {
+      Serial.println("WARNING: History flush did not finish before sleep");
+   }
+}
+
 static void renderCurrentScreen(uint8_t hrValue, float batteryVoltage, bool isMeasuringActive)
 {
    if (currentScreen == SCREEN_DASHBOARD)
@@ -83,6 +183,11 @@ static void renderCurrentScreen(uint8_t hrValue, float batteryVoltage, bool isMe
       renderDashboard(hrValue, batteryVoltage);
       return;
    }
+   if (currentScreen == SCREEN_WORKOUT)
+   {
+      renderWorkout(workoutBpm, workoutRunning);
+      return;
+   }
    if (currentScreen == SCREEN_SLEEP_SUMMARY)
    {
       // Show ongoing sleep duration if currently asleep, otherwise the last completed session.
@@ -98,35 +203,32 @@ static void renderCurrentScreen(uint8_t hrValue, float batteryVoltage, bool isMe
    memset(histBuf, 0, sizeof(histBuf));
    uint16_t n = 0;
 
-   if (lockHistory())
+   // Snapshot reads: no lock, retried if a sample lands meanwhile
+   switch (currentScreen)
    {
-      switch (currentScreen)
-      {
-      case SCREEN_HR_1H:
-         n = hrHistory.getLastN(1, false, histBuf, 12);
-         break;
-      case SCREEN_HR_4H:
-         n = hrHistory.getLastN(1, false, histBuf, 48);
-         break;
-      case SCREEN_HR_24H:
-         n = hrHistory.getAll(1, false, histBuf);
-         break;
-      case SCREEN_HR_7D:
-         n = hrHistory.getAll(2, false, histBuf);
-         break;
-      case SCREEN_HR_1MO:
-         n = hrHistory.getAll(3, false, histBuf);
-         break;
-      case SCREEN_HRV_7D:
-         n = hrHistory.getAll(2, true, histBuf);
-         break;
-      case SCREEN_HRV_1MO:
-         n = hrHistory.getAll(3, true, histBuf);
-         break;
-      default:
-         break;
-      }
-      unlockHistory();
+   case SCREEN_HR_1H:
+      n = hrHistory.getLastN(1, false, histBuf, 12);
+      break;
+   case SCREEN_HR_4H:
+      n = hrHistory.getLastN(1, false, histBuf, 48);
+      break;
+   case SCREEN_HR_24H:
+      n = hrHistory.getAll(1, false, histBuf);
+      break;
+   case SCREEN_HR_7D:
+      n = hrHistory.getAll(2, false, histBuf);
+      break;
+   case SCREEN_HR_1MO:
+      n = hrHistory.getAll(3, false, histBuf);
+      break;
+   case SCREEN_HRV_7D:
+      n = hrHistory.getAll(2, true, histBuf);
+      break;
+   case SCREEN_HRV_1MO:
+      n = hrHistory.getAll(3, true, histBuf);
+      break;
+   default:
+      break;
    }
 
    switch (currentScreen)
@@ -157,30 +259,112 @@ static void renderCurrentScreen(uint8_t hrValue, float batteryVoltage, bool isMe
    }
 }
 
-static void heartRateTask(void *parameter)
+// Called with the state lock held. The screen must have been chosen by a tap
+// in this wake (currentScreen survives deep sleep) and kept for WORKOUT_ARM_MS.
+static bool workoutArmed()
 {
-   (void)parameter;
+   if (currentScreen != SCREEN_WORKOUT)
+   {
+      workoutDone = false;
+      return false;
+   }
+   return !workoutDone && lastTapTimestampMs != 0 && millis() - lastTapTimestampMs >= WORKOUT_ARM_MS;
+}
 
-   HRVResult result = measureHeartRate(MEASUREMENT_DURATION_MS);
+static bool workoutKeepRunning()
+{
+   bool keep = true;
+   if (lockState(pdMS_TO_TICKS(20)))
+   {
+      keep = !sessionStopRequested && currentScreen == SCREEN_WORKOUT;
+      unlockState();
+   }
+   return keep;
+}
 
-   if (result.valid && result.bpm > 0)
+static void workoutPublish(uint8_t bpm, uint32_t estimateMs)
+{
+   if (lockState())
    {
-      if (lockHistory(pdMS_TO_TICKS(500)))
-      {
-         uint8_t clampedHRV = (result.sdrr_ms > 255) ? 255 : (uint8_t)result.sdrr_ms;
-         hrHistory.addMeasurement(result.bpm, clampedHRV);
-         unlockHistory();
-         Serial.printf("Stored HR: %d BPM, SDRR: %d ms\n", result.bpm, result.sdrr_ms);
-      }
-      else
-      {
-         Serial.println("WARNING: Failed to lock history mutex, HR not stored");
-      }
+      workoutBpm = bpm;
+      workoutEstimateMs = estimateMs;
+      workoutUpdated = true;
+      unlockState();
    }
-   else
+}
+
+// Runs on the HR task until the user pages away from SCREEN_WORKOUT.
+static void runWorkoutSession()
+{
+   if (lockState())
+   {
+      workoutRunning = true;
+      workoutBpm = 0;
+      workoutUpdated = false;
+      workoutRefreshes = workoutLatencySumMs = workoutLatencyMaxMs = workoutRefreshSumMs = 0;
+      renderRequested = true;
+      unlockState();
+   }
+
+   WorkoutResult w = runWorkout(workoutKeepRunning, workoutPublish);
+
+   uint32_t refreshes = 0, latencySumMs = 0, latencyMaxMs = 0, refreshSumMs = 0;
+   if (lockState(pdMS_TO_TICKS(500)))
    {
-      Serial.println("No valid HR measurement");
+      workoutRunning = false;
+      workoutDone = true;
+      refreshes = workoutRefreshes;
+      latencySumMs = workoutLatencySumMs;
+      latencyMaxMs = workoutLatencyMaxMs;
+      refreshSumMs = workoutRefreshSumMs;
+      renderRequested = true;
+      unlockState();
    }
+   if (w.series == nullptr)
+      return;
+
+   Serial.printf("Workout display: %lu refreshes, latency mean %lu ms, max %lu ms from estimate to panel\n",
+                 refreshes, refreshes ? latencySumMs / refreshes : 0, latencyMaxMs);
+   uint32_t displayUa = w.durationMs ? (uint32_t)((uint64_t)EPD_REFRESH_UA * refreshSumMs / w.durationMs) : 0;
+   uint32_t totalUa = MCU_ACTIVE_UA + MAX30102_ACTIVE_UA + w.ledAvgUa + displayUa;
+   Serial.printf("Workout power (estimated): %.1f mA = MCU %.1f + MAX30102 %.1f + LED %.2f (%.1f mA pulses) + display %.2f\n",
+                 totalUa / 1000.0f, MCU_ACTIVE_UA / 1000.0f, MAX30102_ACTIVE_UA / 1000.0f,
+                 w.ledAvgUa / 1000.0f, w.led_ua / 1000.0f, displayUa / 1000.0f);
+
+   Serial.print("Workout HR series (BPM per second):");
+   for (uint16_t i = 0; i < w.seconds; i++)
+      Serial.printf(i % 30 == 0 ? "\n  %d" : " %d", w.series[i]);
+   Serial.println();
+
+   // No timer wakes while the workout runs: one T1 entry per full 5 min keeps
+   // the history tiers on their time base.
+   if (lockHistory(pdMS_TO_TICKS(500)))
+   {
+      for (uint16_t slot = 0; (slot + 1) * HISTORY_SLOT_S <= w.seconds; slot++)
+      {
+         uint32_t sum = 0;
+         uint16_t n = 0;
+         for (uint16_t i = slot * HISTORY_SLOT_S; i < (slot + 1) * HISTORY_SLOT_S; i++)
+         {
+            if (w.series[i] > 0)
+            {
+               sum += w.series[i];
+               n++;
+            }
+         }
+         hrHistory.addSample(n ? (uint8_t)((sum + n / 2) / n) : 0, 0, 0, SLEEP_STATE_AWAKE);
+      }
+      unlockHistory();
+      requestHistoryPersist();
+   }
+   free(w.series);
+}
+
+static void heartRateTask(void *parameter)
+{
+   (void)parameter;
+
+   HRVResult result = measureHeartRate(MEASUREMENT_DURATION_MS, ppgModeForSession(bootCount));
 
    // --- Sleep detection ---
    // consumeNoMotion() drains the motion event counter accumulated over
@@ -209,11 +393,29 @@ static void heartRateTask(void *parameter)
                  newSleepState == SLEEP_STATE_ASLEEP ? "ASLEEP" : "AWAKE",
                  consecutiveSleepCycles, lastSleepDurationCycles);
 
-   // Persist sleep state aligned with the HR measurement just stored
-   if (lockHistory(pdMS_TO_TICKS(500)))
+   if (result.valid && result.bpm > 0)
    {
-      hrHistory.addSleepState(newSleepState);
-      unlockHistory();
+      if (lockHistory(pdMS_TO_TICKS(500)))
+      {
+         uint8_t clampedHRV = (result.sdrr_ms > 255) ? 255 : (uint8_t)result.sdrr_ms;
+         // RAM only; the persistence task writes it
+         hrHistory.addSample(result.bpm, clampedHRV, result.resp_brpm, newSleepState);
+         unlockHistory();
+         requestHistoryPersist();
+         Serial.printf("Stored HR: %d BPM%s, SDRR: %d ms, RMSSD: %d ms, resp: %d/min, SpO2: %d%%, SQI %d%%, LED %.1f mA (measured for %lu ms)\n",
+                       result.bpm, result.spectralFallback ? " (spectral)" : result.hrvPoorSignal ? " (no HRV, poor signal)" : "",
+                       result.sdrr_ms, result.rmssd_ms, result.resp_brpm, result.spo2_pct, result.sqi_pct, result.led_ua / 1000.0f,
+                       result.durationMs);
+      }
+      else
+      {
+         Serial.println("WARNING: Failed to lock history mutex, HR not stored");
+      }
+   }
+   else
+   {
+      Serial.printf("No valid HR measurement (measured for %lu ms%s)\n", result.durationMs,
+                    result.poorContact ? ", poor sensor contact" : "");
    }
 
    setDashboardSDNN(result.sdrr_ms);
@@ -230,15 +432,21 @@ static void heartRateTask(void *parameter)
    while (true)
    {
       bool shouldStop = false;
+      bool startWorkout = false;
       if (lockState(pdMS_TO_TICKS(20)))
       {
          shouldStop = sessionStopRequested;
+         startWorkout = !shouldStop && workoutArmed();
          unlockState();
       }
       if (shouldStop)
       {
          break;
       }
+      if (startWorkout)
+      {
+         runWorkoutSession();
+      }
       vTaskDelay(pdMS_TO_TICKS(50));
    }
 
@@ -270,6 +478,9 @@ static void uiTask(void *parameter)
    {
       bool shouldStop = false;
       bool shouldRender = false;
+      bool workoutRefresh = false;
+      uint8_t workoutBpmSnapshot = 0;
+      uint32_t workoutEstimateSnapshot = 0;
 
       if (lockState(pdMS_TO_TICKS(20)))
       {
@@ -279,6 +490,10 @@ static void uiTask(void *parameter)
          hrSnapshot = latestHeartRate;
          batterySnapshot = latestBatteryVoltage;
          measuringSnapshot = !measurementComplete;
+         workoutRefresh = workoutUpdated && workoutRunning;
+         workoutUpdated = false;
+         workoutBpmSnapshot = workoutBpm;
+         workoutEstimateSnapshot = workoutEstimateMs;
          unlockState();
       }
 
@@ -322,6 +537,22 @@ static void uiTask(void *parameter)
             renderCurrentScreen(hrSnapshot, batterySnapshot, measuringSnapshot);
          }
       }
+      else if (workoutRefresh && currentScreen == SCREEN_WORKOUT)
+      {
+         uint32_t refreshStartMs = millis();
+         updateWorkoutHrPartial(workoutBpmSnapshot);
+         uint32_t doneMs = millis();
+         if (lockState())
+         {
+            uint32_t latencyMs = doneMs - workoutEstimateSnapshot;
+            workoutRefreshes++;
+            workoutLatencySumMs += latencyMs;
+            if (latencyMs > workoutLatencyMaxMs)
+               workoutLatencyMaxMs = latencyMs;
+            workoutRefreshSumMs += doneMs - refreshStartMs;
+            unlockState();
+         }
+      }
 
       previousMeasuringSnapshot = measuringSnapshot;
 
@@ -332,6 +563,24 @@ static void uiTask(void *parameter)
    vTaskDelete(nullptr);
 }
 
+// No-wrist path: the watch is off, so an ongoing sleep session ends here.
+// Nothing is measured or stored; the display keeps its last image.
+static void sleepWithoutSession()
+{
+   if (currentSleepState == SLEEP_STATE_ASLEEP && consecutiveSleepCycles > 0)
+      lastSleepDurationCycles = consecutiveSleepCycles;
+   consecutiveSleepCycles = 0;
+   currentSleepState = SLEEP_STATE_AWAKE;
+   latestHeartRate = 0;
+
+   particleSensor.shutDown();
+   esp_sleep_enable_timer_wakeup(SLEEP_INTERVAL_NOWRIST_US);
+   Serial.printf("Sleep for %d minutes (timer wake only) [no wrist - skipped session]\n",
+                 (int)(SLEEP_INTERVAL_NOWRIST_US / 60000000ULL));
+   Serial.flush();
+   esp_deep_sleep_start();
+}
+
 void setup()
 {
    Serial.begin(115200);
@@ -345,6 +594,20 @@ void setup()
    updateWakeReason();
    printSystemState();
 
+   bool hrSensorReady = initHeartRateSensor();
+   if (!hrSensorReady)
+   {
+      Serial.println("ERROR: Failed to initialize heart rate sensor!");
+   }
+#if WRIST_PRESENCE_CHECK
+   // Not worn: skip storage, display and both tasks (scheduled wakes only;
+   // a power-on boot always runs a session)
+   else if (wakeReason == WAKE_TIMER && !detectWristPresence())
+   {
+      sleepWithoutSession();
+   }
+#endif
+
    // Initialize data storage
    if (!hrHistory.begin())
    {
@@ -362,11 +625,6 @@ void setup()
       Serial.println("WARNING: Failed to configure no-motion interrupt (sleep detection degraded)");
    }
 
-   if (!initHeartRateSensor())
-   {
-      Serial.println("ERROR: Failed to initialize heart rate sensor!");
-   }
-
    // Initialize display
    if (!initDisplay())
    {
@@ -382,6 +640,7 @@ void setup()
    // Create synchronization primitives
    stateMutex = xSemaphoreCreateMutex();
    historyMutex = xSemaphoreCreateMutex();
+   persistDone = xSemaphoreCreateBinary();
    bool mutexReady = (stateMutex != nullptr && historyMutex != nullptr);
    if (!mutexReady)
    {
@@ -403,6 +662,13 @@ void setup()
    {
       uiCreated = xTaskCreate(uiTask, "UI", 6144, nullptr, 1, &uiTaskHandle);
       hrCreated = xTaskCreate(heartRateTask, "HR", 8192, nullptr, 2, &hrTaskHandle);
+      // Optional: without it, flushHistory() writes before deep sleep
+      if (persistDone == nullptr ||
+          xTaskCreate(persistTask, "Persist", 4096, nullptr, 1, &persistTaskHandle) != pdPASS)
+      {
+         persistTaskHandle = nullptr;
+         Serial.println("WARNING: No history persistence task, writing before sleep");
+      }
    }
 
    if (!mutexReady || uiCreated != pdPASS || hrCreated != pdPASS)
@@ -420,11 +686,10 @@ void setup()
          hrTaskHandle = nullptr;
       }
 
-      HRVResult result = measureHeartRate(MEASUREMENT_DURATION_MS);
+      HRVResult result = measureHeartRate(MEASUREMENT_DURATION_MS, ppgModeForSession(bootCount));
       if (result.valid && result.bpm > 0 && lockHistory(pdMS_TO_TICKS(500)))
       {
          uint8_t clampedHRV = (result.sdrr_ms > 255) ? 255 : (uint8_t)result.sdrr_ms;
-         hrHistory.addMeasurement(result.bpm, clampedHRV);
          // Sleep detection for sync path
          // consumeNoMotion() drains the motion event counter accumulated
          // over the measurement window — true means no motion detected.
@@ -444,7 +709,7 @@ void setup()
             consecutiveSleepCycles = 0;
          }
          currentSleepState = newSleepState;
-         hrHistory.addSleepState(newSleepState);
+         hrHistory.addSample(result.bpm, clampedHRV, result.resp_brpm, newSleepState);
          unlockHistory();
       }
       latestHeartRate = result.bpm;
@@ -455,16 +720,24 @@ void setup()
    else
    {
       const uint32_t sessionStartMs = millis();
+#if HR_ADAPTIVE_DURATION
+      // The measurement itself sets the baseline, so an early stop also
+      // shortens the session.
+      const uint32_t baselineEndMs = sessionStartMs;
+#else
       const uint32_t baselineEndMs = sessionStartMs + ACTIVE_WINDOW_MS;
+#endif
 
       // Keep device active for baseline window + optional inactivity extension.
       while (true)
       {
          bool hrDone = false;
+         bool inWorkout = false;
          uint32_t lastTapMs = 0;
          if (lockState(pdMS_TO_TICKS(20)))
          {
             hrDone = measurementComplete;
+            inWorkout = workoutRunning;
             lastTapMs = lastTapTimestampMs;
             unlockState();
          }
@@ -472,7 +745,7 @@ void setup()
          uint32_t now = millis();
          bool baselineElapsed = (int32_t)(now - baselineEndMs) >= 0;
 
-         if (!baselineElapsed || !hrDone)
+         if (!baselineElapsed || !hrDone || inWorkout)
          {
             vTaskDelay(pdMS_TO_TICKS(50));
             continue;
@@ -508,14 +781,18 @@ void setup()
       }
    }
 
+   flushHistory();
    if (lockHistory())
    {
-      Serial.printf("History: T1=%d/288 entries\n", hrHistory.getCount());
+      Serial.printf("History: T1=%d/288 entries, %lu flash bytes written\n", hrHistory.getCount(),
+                    (unsigned long)hrHistory.getBytesWritten());
       unlockHistory();
    }
 
    // Prepare for deep sleep
    Serial.println("\n=== Entering Deep Sleep ===");
+   if (currentScreen == SCREEN_WORKOUT)
+      currentScreen = SCREEN_DASHBOARD; // the dashboard is what stays on the panel
    setDashboardMeasuringActive(false);
    setDashboardSDNN(latestSdrr);
    renderDashboard(latestHeartRate, latestBatteryVoltage); // Final screen update before sleep
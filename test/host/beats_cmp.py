@@ -0,0 +1,26 @@
+# Beats of the firmware (run_hr DUMP= tachogram) against ref_hr.py. With a
+# minimum share, exits 1 when fewer firmware beats than that lie within 60 ms
+# of a reference beat, or any lies further than 120 ms from one.
+# usage: python3 beats_cmp.py <csv> <tachogram> [min-share]
+import sys
+import numpy as np
+from ref_hr import ref_peaks
+
+NEAR_MS, FAR_MS = 60, 120
+
+_, ref = ref_peaks(sys.argv[1])
+beats = np.atleast_2d(np.loadtxt(sys.argv[2]))[:, 0] / 1000.0
+# Firmware beat times run on the sensor clock, offset from the recording by
+# the session start and the causal filter delay: take the best-matching shift.
+def matched(shift, tol=NEAR_MS):
+    return sum(1 for b in beats if np.min(np.abs(ref - (b - shift))) < tol)
+
+
+off = max(np.arange(-5000, 5000, 5), key=matched)
+hit, near = matched(off), matched(off, FAR_MS)
+ok = True
+if len(sys.argv) > 3:
+    ok = hit >= float(sys.argv[3]) * len(beats) and near == len(beats)
+print(f"{sys.argv[1].split('/')[-1]:22s} ref={len(ref)} fw={len(beats)} matched={hit} "
+      f"(<{FAR_MS} ms: {near}) offset={off} ms{'' if ok else '  FAIL'}")
+sys.exit(0 if ok else 1)
@@ -0,0 +1,48 @@
+// applyBandpassFiltfilt() on the first n samples of a trace at FILTER_FS:
+// prints the SOS table (one section per line), then input and output in
+// counts, one sample per line.
+// usage: filtfilt <csv> [n]
+#include "Sensors.h"
+#include <vector>
+
+int main(int argc, char **argv)
+{
+   FILE *f = fopen(argv[1], "r");
+   char line[256];
+   fgets(line, sizeof(line), f);
+   std::vector<double> tMs, raw;
+   double t, abs, ir;
+   while (fgets(line, sizeof(line), f) && sscanf(line, "%lf,%lf,%lf", &t, &abs, &ir) == 3)
+   {
+      tMs.push_back(t);
+      raw.push_back(ir);
+   }
+   fclose(f);
+   // Block-average the recording down to FILTER_FS, as the FIFO and CIC do
+   int decim = (int)lround((raw.size() - 1) * 1000.0 / (tMs.back() - tMs[0]) / FILTER_FS);
+   if (decim < 1)
+      decim = 1;
+   std::vector<int32_t> v;
+   for (size_t i = 0; i + decim <= raw.size(); i += decim)
+   {
+      double sum = 0;
+      for (int j = 0; j < decim; j++)
+         sum += raw[i + j];
+      v.push_back((int32_t)lround(sum / decim));
+   }
+   int n = argc > 2 && atoi(argv[2]) < (int)v.size() ? atoi(argv[2]) : (int)v.size();
+   int64_t sum = 0;
+   for (int i = 0; i < n; i++)
+      sum += v[i];
+   int32_t dc = (int32_t)(sum / n);
+   std::vector<dsp_sample_t> x(n);
+   for (int i = 0; i < n; i++)
+      x[i] = dspFromCounts(v[i] - dc);
+   for (int s = 0; s < 4; s++)
+      printf("%.10e %.10e %.10e %.10e %.10e %.10e\n", BANDPASS_SOS[s][0], BANDPASS_SOS[s][1], BANDPASS_SOS[s][2],
+             BANDPASS_SOS[s][3], BANDPASS_SOS[s][4], BANDPASS_SOS[s][5]);
+   dspLoadSOS(BANDPASS_SOS, 4, bandpassBiquads);
+   applyBandpassFiltfilt(x.data(), n);
+   for (int i = 0; i < n; i++)
+      printf("%d %.4f\n", v[i], dspToCounts(x[i]));
+}
@@ -0,0 +1,24 @@
+# applyBandpassFiltfilt() against scipy.signal.sosfiltfilt with the same
+# SOS table, on whole recordings and on a 300-sample window (edge padding), at FILTER_FS.
+# Exits 1 when any output sample differs by 0.1 IR counts or more.
+# usage: python3 filtfilt_cmp.py <filtfilt-exe> <csv>...
+import subprocess
+import sys
+import numpy as np
+from scipy.signal import sosfiltfilt
+
+MAX_ERR = 0.1
+bad = 0
+for f in sys.argv[2:]:
+    for n in [1 << 30, 300]:
+        out = subprocess.check_output([sys.argv[1], f, str(n)]).decode().split('\n')
+        sos = np.array([[float(v) for v in line.split()] for line in out[:4]])
+        x, fw = np.array([[float(v) for v in line.split()] for line in out[4:] if line]).T
+        n = len(x)
+        ref = sosfiltfilt(sos, x - np.sum(x.astype(np.int64)) // n)
+        err = np.abs(fw - ref)
+        ok = err.max() < MAX_ERR
+        bad += not ok
+        print(f"{f.split('/')[-1]:22s} n={n:5d} rms {np.std(ref):8.2f}  max err {err.max():.4f}  "
+              f"edge err {max(err[:100].max(), err[-100:].max()):.4f}{'' if ok else '  FAIL'}")
+sys.exit(1 if bad else 0)
@@ -0,0 +1,33 @@
+# LF/HF of the firmware (tachogram output) against scipy.signal.lombscargle
+# on the same RR series: 36 bins from 0.04 Hz in 0.01 Hz steps, one-sided PSD.
+# Exits 1 when a band differs by more than 2e-4 relative (plus the rounding
+# to whole ms^2), unless the firmware withheld the session's HRV.
+# usage: python3 lomb_cmp.py <tachogram-dir>
+import glob
+import sys
+import numpy as np
+from scipy.signal import lombscargle
+
+MAX_REL = 2e-4
+bad = 0
+for fn in sorted(glob.glob(sys.argv[1] + '/tach_*')):
+    with open(fn) as f:
+        lf_fw, hf_fw, withheld = (float(v) for v in f.readline().split())
+    d = np.atleast_2d(np.loadtxt(fn, skiprows=1))
+    t, rr = d[:, 0] / 1e6, d[:, 1] / 1000
+    name = fn.split('tach_', 1)[1]
+    if len(t) < 16 or t[-1] - t[0] < 25:
+        print(f"{name:22s} too short (fw LF {lf_fw:.0f} HF {hf_fw:.0f})")
+        continue
+    f = 0.04 + 0.01 * np.arange(36)
+    p = lombscargle(t - t[0], rr - rr.mean(), 2 * np.pi * f)
+    psd = 2 * p * (t[-1] - t[0]) / len(t)
+    lf, hf = psd[:11].sum() * 0.01, psd[11:].sum() * 0.01
+    if withheld:
+        print(f"{name:22s} scipy LF {lf:8.1f} HF {hf:8.1f} | fw: HRV withheld (poor signal)")
+        continue
+    ok = abs(lf_fw - lf) <= 0.5 + MAX_REL * lf and abs(hf_fw - hf) <= 0.5 + MAX_REL * hf
+    bad += not ok
+    print(f"{name:22s} scipy LF {lf:8.1f} HF {hf:8.1f} | fw LF {lf_fw:6.0f} HF {hf_fw:6.0f} | "
+          f"rel {abs(lf_fw - lf) / lf:.1e} {abs(hf_fw - hf) / hf:.1e}{'' if ok else '  FAIL'}")
+sys.exit(1 if bad else 0)
@@ -0,0 +1,147 @@
+// Host side of the firmware: virtual clock, serial, map-backed NVS and a
+// MAX30102/BMA400 pair on a simulated I2C bus that replays a recorded IR
+// trace (working_code/hrv/*.csv) against the virtual clock.
+#include <Arduino.h>
+#include <Wire.h>
+#include <nvs.h>
+#include <esp_sleep.h>
+#include <MAX30105.h>
+#include <SparkFun_BMA400_Arduino_Library.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <math.h>
+uint64_t g_virtualUs = 0;
+bool g_quiet = false;
+HardwareSerial Serial;
+TwoWire Wire;
+std::map<std::string, std::vector<uint8_t>> g_nvs;
+int g_nvsWritesLeft = -1, g_nvsCommits = 0, g_nvsT1Reads = 0;
+size_t g_nvsWrites = 0;
+esp_sleep_wakeup_cause_t g_wake = ESP_SLEEP_WAKEUP_UNDEFINED;
+std::vector<double> g_tMs;
+std::vector<double> g_ir;
+uint8_t g_ledMode = 3;
+uint8_t g_adcRange = 0x20, g_ampRed = 0x1F, g_ampIR = 0x1F;
+// Traces were recorded at 0x1F / 4096 nA; MOCK_GAIN models skin/strap coupling
+static double ledScale(uint8_t amp) { double g = getenv("MOCK_GAIN") ? atof(getenv("MOCK_GAIN")) : 1.0; return g * amp / 31.0 * 4096.0 / (2048 << (g_adcRange >> 5)); }
+static uint32_t clip18(double v) { return v < 0 ? 0 : v > 262143 ? 262143 : (uint32_t)v; }
+double g_getIRCostUs = 1520;
+static size_t g_cursor = 0;
+static uint64_t g_t0 = 0;
+void mockLoadCsv(const char *path) {
+  g_tMs.clear(); g_ir.clear(); g_cursor = 0;
+  std::ifstream f(path); std::string line; std::getline(f, line);
+  while (std::getline(f, line)) {
+    std::stringstream ss(line); std::string a, b, c;
+    std::getline(ss, a, ','); std::getline(ss, b, ','); std::getline(ss, c, ',');
+    g_tMs.push_back(atof(a.c_str())); g_ir.push_back(atof(c.c_str()));
+  }
+  double off = g_tMs[0]; for (auto &t : g_tMs) t -= off;
+}
+void mockStart() { g_t0 = g_virtualUs; g_cursor = 0; }
+double mockTraceValueAt(double tMs) {
+  while (g_cursor + 1 < g_tMs.size() && g_tMs[g_cursor + 1] <= tMs) g_cursor++;
+  if (g_cursor + 1 >= g_tMs.size()) return 1000; // off-wrist after trace end
+  return g_ir[g_cursor];
+}
+uint32_t MAX30105::getIR() { g_virtualUs += (uint64_t)g_getIRCostUs; return (uint32_t)mockTraceValueAt((g_virtualUs - g_t0) / 1000.0); }
+uint32_t MAX30105::getRed() { return getIR(); }
+uint8_t MAX30105::readRegister8(uint8_t, uint8_t) { return 0; }
+void MAX30105::writeRegister8(uint8_t, uint8_t, uint8_t) {}
+int8_t BMA400::getSensorData(bool) { data.accelX = 0; data.accelY = 0; data.accelZ = 1; return 0; }
+// MAX30102 FIFO emulation: sensor clock at g_fifoRateHz, 32-deep FIFO with rollover.
+double g_adcRateHz = 397.0;
+int g_mockAvg = 1;
+#define g_fifoRateHz (g_adcRateHz / g_mockAvg)
+static uint64_t g_consumed = 0;
+static uint8_t g_reg = 0;
+static std::vector<uint8_t> g_rx;
+static size_t g_rxPos = 0;
+static uint8_t g_ovf = 0;
+uint32_t g_i2cTransactions = 0;
+static uint64_t producedTotal() { return (uint64_t)((g_virtualUs - g_t0) * g_fifoRateHz / 1e6); }
+void MAX30105::clearFIFO() { g_consumed = producedTotal(); g_ovf = 0; }
+static void fifoUpdate() {
+  uint64_t p = producedTotal();
+  if (p - g_consumed > 32) { uint64_t lost = p - g_consumed - 32; g_ovf = lost > 31 ? 31 : (uint8_t)lost; g_consumed = p - 32; }
+}
+static uint8_t g_addr = 0, g_wcount = 0;
+// Synthetic motion: accel on the BMA400 FIFO and a matching PPG artifact
+static double envd(const char *n, double d) { const char *v = getenv(n); return v ? atof(v) : d; }
+static double g_motStart = envd("MOT_START", 1e9), g_motEnd = envd("MOT_END", 1e9);
+static double g_motHz = envd("MOT_HZ", 1.7), g_motA = envd("MOT_A", 38), g_motK = envd("MOT_K", 0);
+static double g_bmaHz = envd("BMA_HZ", 101.3);
+static double env01(double tS) { if (tS < g_motStart || tS > g_motEnd) return 0; double r = fmin(tS - g_motStart, g_motEnd - tS); return r < 1 ? r : 1; }
+static void accelAt(double tS, double a[3]) {
+  double e = env01(tS), w = 2 * M_PI * g_motHz * tS;
+  a[0] = e * g_motA * (sin(w) + 0.5 * sin(2 * w + 1.0));
+  a[1] = e * g_motA * 0.7 * sin(w + 0.8);
+  a[2] = 128 + e * g_motA * 0.3 * sin(2 * w + 0.3);
+}
+double mockArtifact(double tMs) {
+  if (g_motK == 0) return 0;
+  double a[3], b[3], tS = tMs / 1000;
+  accelAt(tS, a); accelAt(tS - 0.03, b);
+  return g_motK * (0.6 * a[0] + 0.3 * b[1] - 0.4 * (a[2] - 128) + 0.2 * b[0]);
+}
+static uint64_t g_bmaConsumed = 0;
+static uint64_t bmaProduced() { return (uint64_t)((g_virtualUs - g_t0) * g_bmaHz / 1e6); }
+void TwoWire::beginTransmission(uint8_t a) { g_addr = a; g_wcount = 0; }
+size_t TwoWire::write(uint8_t v) {
+  if (g_wcount++ == 0) g_reg = v;
+  else if (g_addr == 0x14 && g_reg == 0x7E && v == 0xB0) g_bmaConsumed = bmaProduced();
+  return 1;
+}
+uint8_t TwoWire::endTransmission(bool) { g_virtualUs += 75; g_i2cTransactions++; return 0; }
+uint8_t TwoWire::requestFrom(uint8_t, uint8_t n) {
+  g_i2cTransactions++;
+  g_virtualUs += 25 * (n + 2);
+  g_rx.clear(); g_rxPos = 0;
+  fifoUpdate();
+  if (g_addr == 0x14) {
+    uint64_t bp = bmaProduced();
+    if (bp - g_bmaConsumed > 146) g_bmaConsumed = bp - 146;
+    if (g_reg == 0x12) { uint32_t len = (bp - g_bmaConsumed) * 7; g_rx.push_back(len & 255); g_rx.push_back(len >> 8); }
+    else if (g_reg == 0x14) {
+      for (int k = 0; k < n / 7; k++) {
+        if (g_bmaConsumed >= bp) { g_rx.push_back(0x80); g_rx.push_back(0); continue; }
+        double a[3]; accelAt(g_bmaConsumed / g_bmaHz, a); g_bmaConsumed++;
+        g_rx.push_back(0x8E);
+        for (int j = 0; j < 3; j++) { int v = (int)lround(a[j]) & 0xFFF; g_rx.push_back(v & 255); g_rx.push_back(v >> 8); }
+      }
+    }
+    return n;
+  }
+  uint64_t p = producedTotal();
+  if (g_reg == 0x04) {
+    g_rx.push_back(p & 31); g_rx.push_back(g_ovf); g_rx.push_back(g_consumed & 31); g_ovf = 0;
+  } else if (g_reg == 0x07) {
+    int bps = g_ledMode == 0x07 ? 3 : 6;
+    for (int k = 0; k < n / bps; k++) {
+      if (g_consumed >= p) { for (int b = 0; b < bps; b++) g_rx.push_back(0); continue; }
+      double tMs = g_consumed * 1000.0 / g_fifoRateHz; g_consumed++;
+      // sample value at production time
+      double acc = 0;
+      for (int a = 0; a < g_mockAvg; a++) {
+        double ta = tMs + a * 1000.0 / g_adcRateHz;
+        size_t lo = 0, hi = g_tMs.size() - 1;
+        double va = 1000;
+        if (ta <= g_tMs.back()) { while (lo < hi) { size_t m = (lo + hi + 1) / 2; if (g_tMs[m] <= ta) lo = m; else hi = m - 1; } va = g_ir[lo]; }
+        acc += va + mockArtifact(ta);
+      }
+      uint32_t v = (uint32_t)(acc / g_mockAvg);
+      // synthetic Red: DC x0.8, AC scaled so that R = MOCK_R
+      static double irDc = 0; if (irDc == 0) irDc = v; irDc += (v - irDc) * 0.005;
+      double R = getenv("MOCK_R") ? atof(getenv("MOCK_R")) : 0.6;
+      uint32_t red = clip18((0.8 * irDc + 0.8 * R * (v - irDc)) * ledScale(g_ampRed));
+      v = clip18(v * ledScale(g_ampIR));
+      if (g_ledMode == 0x07) { g_rx.push_back((v >> 16) & 3); g_rx.push_back((v >> 8) & 255); g_rx.push_back(v & 255); }
+      else { uint32_t ch[2] = {red, v}; for (int r = 0; r < 2; r++) { g_rx.push_back((ch[r] >> 16) & 3); g_rx.push_back((ch[r] >> 8) & 255); g_rx.push_back(ch[r] & 255); } }
+    }
+  }
+  return n;
+}
+int TwoWire::available() { return (int)(g_rx.size() - g_rxPos); }
+int TwoWire::read() { return g_rxPos < g_rx.size() ? g_rx[g_rxPos++] : 0; }
@@ -0,0 +1,63 @@
+// Generates the migration fixtures in data/: the NVS contents and the tier
+// dump of the NVS-only history layout after n samples. Build it against
+// DataStorage.h of that layout (git show 7783dbd:src/DataStorage.h).
+// usage: oldgen <n> <nvs-out> <dump-out>   (data/ holds n = 1000 and 100)
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "DataStorage.h"
+
+int main(int argc, char **argv)
+{
+   if (argc < 4)
+   {
+      printf("usage: oldgen <n> <nvs-out> <dump-out>\n");
+      return 1;
+   }
+   g_quiet = true;
+   int n = atoi(argv[1]);
+   TieredHRStorage *s = new TieredHRStorage();
+   s->begin();
+   for (int i = 0; i < n; i++)
+      s->commitSample(50 + i % 40, i % 3 ? 30 + i % 20 : 0, 12 + i % 5, i % 17 < 8);
+   s->flush();
+   delete s;
+
+   // Reload from NVS alone, as after a power cycle
+   memset(&histT1, 0xA5, sizeof(histT1));
+   g_wake = ESP_SLEEP_WAKEUP_UNDEFINED;
+   s = new TieredHRStorage();
+   s->begin();
+
+   // (key length, key, value length, value)*, read by storage_test's loadNvs()
+   FILE *f = fopen(argv[2], "wb");
+   for (auto &kv : g_nvs)
+   {
+      uint32_t keyLen = kv.first.size(), valueLen = kv.second.size();
+      fwrite(&keyLen, 4, 1, f);
+      fwrite(kv.first.data(), 1, keyLen, f);
+      fwrite(&valueLen, 4, 1, f);
+      fwrite(kv.second.data(), 1, valueLen, f);
+   }
+   fclose(f);
+
+   // Same layout as dump() in storage_fixture.h
+   static uint8_t buf[400];
+   f = fopen(argv[3], "wb");
+   for (uint8_t tier = 1; tier <= 3; tier++)
+   {
+      for (uint8_t isHRV = 0; isHRV < 2; isHRV++)
+      {
+         uint16_t k = s->getAll(tier, isHRV, buf);
+         fwrite(&k, 2, 1, f);
+         fwrite(buf, 1, k, f);
+         k = s->getLastNResp(tier, buf, sizeof(buf));
+         fwrite(buf, 1, k, f);
+      }
+   }
+   uint16_t k = s->getLastNSleep(buf, sizeof(buf));
+   fwrite(buf, 1, k, f);
+   fclose(f);
+   delete s;
+   return 0;
+}
@@ -0,0 +1,55 @@
+// detectPeaks() on a trace at FILTER_FS after filtfilt. Writes the filtered
+// signal to <signal-out> and prints the prominence threshold, then the peak
+// indices.
+// usage: peaks <csv> <distance> <signal-out> [threshold]
+#include "Sensors.h"
+#include <vector>
+
+int main(int argc, char **argv)
+{
+   FILE *f = fopen(argv[1], "r");
+   char line[256];
+   fgets(line, sizeof(line), f);
+   std::vector<double> tMs, raw;
+   double t, abs, ir;
+   while (fgets(line, sizeof(line), f) && sscanf(line, "%lf,%lf,%lf", &t, &abs, &ir) == 3)
+   {
+      tMs.push_back(t);
+      raw.push_back(ir);
+   }
+   fclose(f);
+   // Block-average the recording down to FILTER_FS, as the FIFO and CIC do
+   int decim = (int)lround((raw.size() - 1) * 1000.0 / (tMs.back() - tMs[0]) / FILTER_FS);
+   if (decim < 1)
+      decim = 1;
+   std::vector<int32_t> v;
+   for (size_t i = 0; i + decim <= raw.size(); i += decim)
+   {
+      double sum = 0;
+      for (int j = 0; j < decim; j++)
+         sum += raw[i + j];
+      v.push_back((int32_t)lround(sum / decim));
+   }
+   int n = (int)v.size(), dist = atoi(argv[2]);
+   int64_t sum = 0;
+   for (int i = 0; i < n; i++)
+      sum += v[i];
+   int32_t dc = (int32_t)(sum / n);
+   std::vector<dsp_sample_t> x(n);
+   for (int i = 0; i < n; i++)
+      x[i] = dspFromCounts(v[i] - dc);
+   dspLoadSOS(BANDPASS_SOS, 4, bandpassBiquads);
+   applyBandpassFiltfilt(x.data(), n);
+   dsp_sample_t mean = dspMean(x.data(), n), sd = dspStdDev(x.data(), n, mean);
+   dsp_sample_t thr = argc > 4 ? (dsp_sample_t)atof(argv[4]) : (dsp_sample_t)(sd * 0.3);
+
+   FILE *o = fopen(argv[3], "w");
+   for (int i = 0; i < n; i++)
+      fprintf(o, "%.17g\n", (double)x[i]);
+   fclose(o);
+   static int idx[PEAK_MAX_COUNT];
+   int k = detectPeaks(x.data(), n, dist, thr, idx, PEAK_MAX_COUNT);
+   printf("%.17g\n", (double)thr);
+   for (int i = 0; i < k; i++)
+      printf("%d\n", idx[i]);
+}
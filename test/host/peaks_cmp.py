@@ -0,0 +1,24 @@
+# detectPeaks() against scipy.signal.find_peaks(distance, prominence) on
+# the firmware's own filtered signal, for several distances and thresholds.
+# usage: python3 peaks_cmp.py <peaks-exe> <work-dir> <csv>...
+import subprocess
+import sys
+import numpy as np
+from scipy.signal import find_peaks
+
+exe, work = sys.argv[1], sys.argv[2]
+diffs = 0
+for f in sys.argv[3:]:
+    for dist in [20, 5, 50]:
+        for thr in [None, 0.0, 5.0]:
+            sig = f"{work}/peaks_signal.txt"
+            args = [exe, f, str(dist), sig] + ([] if thr is None else [str(thr)])
+            out = subprocess.check_output(args).split()
+            prom = float(out[0])
+            fw = np.array([int(v) for v in out[1:]])
+            ref, _ = find_peaks(np.loadtxt(sig), distance=dist, prominence=prom)
+            same = len(ref) == len(fw) and (ref == fw).all()
+            diffs += not same
+            print(f"{f.split('/')[-1]:22s} distance {dist:3d} threshold {'0.3 std' if thr is None else thr}: "
+                  f"{len(ref)} / {len(fw)} {'same' if same else 'DIFF %s' % sorted(set(ref) ^ set(fw))}")
+sys.exit(1 if diffs else 0)
@@ -0,0 +1,27 @@
+# Reference HR/SDRR per recording, as in hrv_analysis.ipynb: 4th-order
+# 0.5-5 Hz Butterworth, filtfilt, find_peaks(distance=0.4 s,
+# prominence=0.3 std), first 60 s.
+# usage: python3 ref_hr.py <csv>...
+import sys
+import numpy as np
+import pandas as pd
+from scipy.signal import butter, filtfilt, find_peaks
+
+
+def ref_peaks(path, dur_ms=60000):
+    df = pd.read_csv(path)
+    t = df.timestamp_ms.values - df.timestamp_ms.values[0]
+    m = t <= dur_ms
+    t, x = t[m], df.ir_value.values[m]
+    fs = len(t) / (t[-1] / 1000)
+    b, a = butter(4, [0.5 / (fs / 2), 5 / (fs / 2)], btype='band')
+    y = filtfilt(b, a, x)
+    p, _ = find_peaks(y, distance=int(fs * 0.4), prominence=np.std(y) * 0.3)
+    return fs, t[p]
+
+
+if __name__ == '__main__':
+    for f in sys.argv[1:]:
+        fs, beats = ref_peaks(f)
+        rr = np.diff(beats)
+        print(f"{f.split('/')[-1]:22s} fs={fs:.0f} peaks={len(beats)} bpm={60000 / rr.mean():.1f} sdrr={rr.std():.1f}")
@@ -0,0 +1,175 @@
+#!/bin/sh
+# Builds the firmware headers against the host stubs and runs the host
+# checks and comparisons. Exits non-zero when a check fails.
+# usage: test/host/run.sh [build-dir]    (needs g++; python3 with numpy,
+#        scipy and pandas for the reference comparisons, skipped otherwise)
+set -e
+HERE=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HERE/../.." && pwd)
+BUILD=${1:-${TMPDIR:-/tmp}/hrv-host}
+CSV="$ROOT/working_code/hrv"
+mkdir -p "$BUILD"
+
+CXX="${CXX:-g++} -std=gnu++17 -O2 -Wall -Wno-unused-function -Wno-format -Wno-unused-result -I$HERE/stubs -I$ROOT/src"
+build() # <name> <source> [flags...]
+{
+   name=$1 src=$2
+   shift 2
+   $CXX "$@" -o "$BUILD/$name" "$HERE/$src" "$HERE/mock.cpp" -lpthread
+}
+
+# expect <label> <awk condition>: every run_hr line on stdin must meet the
+# condition, written on f["bpm"], f["sdrr"], ... (the key=value fields)
+expect()
+{
+   awk -v label="$1" '
+   {
+      gsub(/= +/, "=")
+      delete f
+      for (i = 2; i <= NF; i++)
+         if (split($i, kv, "=") == 2)
+            f[kv[1]] = kv[2] + 0
+   }
+   !('"$2"') { print "FAIL " label ": " $0; bad = 1 }
+   END { exit bad }'
+}
+
+# same_as <label> <file> <awk condition on f[] and g[]> < <file2>: the
+# recording's line in file (f) and in file2 (g) must meet the condition
+same_as()
+{
+   awk -v label="$1" '
+   function fields(a)
+   {
+      gsub(/= +/, "=")
+      delete a
+      for (i = 2; i <= NF; i++)
+         if (split($i, kv, "=") == 2)
+            a[kv[1]] = kv[2] + 0
+   }
+   NR == FNR { fields(f); for (k in f) ref[$1, k] = f[k]; next }
+   {
+      fields(g)
+      delete f
+      for (k in g)
+         f[k] = ref[$1, k]
+   }
+   !('"$3"') { print "FAIL " label ": " $0; bad = 1 }
+   END { exit bad }' "$2" -
+}
+
+echo "== main.cpp against the stubs"
+$CXX -Wextra -Wno-unused-parameter -fsyntax-only -x c++ "$ROOT/src/main.cpp"
+
+build sensor_checks sensor_checks.cpp
+build storage_test storage_test.cpp
+build write_behind write_behind.cpp
+build run_hr run_hr.cpp
+build run_hr_float run_hr.cpp -DDSP_FIXED_POINT=0
+build run_hr_batch run_hr.cpp -DHR_STREAMING_PIPELINE=0
+build run_hr_nosqi run_hr.cpp -DHR_SIGNAL_QUALITY=0
+build run_hr_nomc run_hr.cpp -DHR_MOTION_CANCEL=0
+build run_hr_noagc run_hr.cpp -DPPG_LED_AGC=0
+build filtfilt filtfilt.cpp
+build filtfilt_float filtfilt.cpp -DDSP_FIXED_POINT=0
+build peaks peaks.cpp
+build peaks_float peaks.cpp -DDSP_FIXED_POINT=0
+build tachogram tachogram.cpp
+
+echo "== sensor checks"
+"$BUILD/sensor_checks"
+echo "== storage: power cuts, wear, migration"
+"$BUILD/storage_test" "$HERE/data"
+echo "== storage: write-behind"
+"$BUILD/write_behind"
+
+echo "== HR/HRV, streaming fixed point / float / batch"
+"$BUILD/run_hr" "$CSV"/*.csv | tee "$BUILD/hr_fixed.txt"
+"$BUILD/run_hr_float" "$CSV"/*.csv | tee "$BUILD/hr_float.txt"
+"$BUILD/run_hr_batch" "$CSV"/*.csv
+# Fixed point against float: within 1 BPM and 2 ms SDRR
+same_as "fixed vs float" "$BUILD/hr_fixed.txt" \
+   'g["bpm"] - f["bpm"] <= 1 && f["bpm"] - g["bpm"] <= 1 && g["sdrr"] - f["sdrr"] <= 2 && f["sdrr"] - g["sdrr"] <= 2' \
+   < "$BUILD/hr_float.txt"
+# Motion-spoiled sessions keep their BPM but report no HRV
+for f in "$BUILD/hr_fixed.txt" "$BUILD/hr_float.txt"; do
+   expect "HRV only from good SQI windows" \
+      'f["valid"] && f["sdrr"] <= 200 && f["rmssd"] <= 200 && ($1 !~ /^(Perfekt|RuhePuls)/ || !f["nohrv"])' < "$f"
+done
+
+echo "== motion canceller: synthetic swing at 10-30 s (mock.cpp MOT_*)"
+CLEAN="$CSV/Perfekt.csv $CSV/RuhePuls.csv"
+for hz in 1.7 2.5; do
+   echo "-- $hz Hz, artifact K=10: canceller, then HR_MOTION_CANCEL=0"
+   MOT_START=10 MOT_END=30 MOT_K=10 MOT_HZ=$hz "$BUILD/run_hr" $CLEAN | tee "$BUILD/hr_mc.txt"
+   MOT_START=10 MOT_END=30 MOT_K=10 MOT_HZ=$hz "$BUILD/run_hr_nomc" $CLEAN | tee "$BUILD/hr_nomc.txt"
+   # Within 2 BPM and 15 ms SDRR of the clean session, and better than without
+   same_as "canceller at $hz Hz vs clean" "$BUILD/hr_fixed.txt" \
+      'g["bpm"] - f["bpm"] <= 2 && f["bpm"] - g["bpm"] <= 2 && g["sdrr"] <= f["sdrr"] + 15' < "$BUILD/hr_mc.txt"
+   same_as "canceller at $hz Hz vs HR_MOTION_CANCEL=0" "$BUILD/hr_mc.txt" \
+      'f["sdrr"] + 50 < g["sdrr"] && g["bpm"] >= f["bpm"] + 10' < "$BUILD/hr_nomc.txt"
+done
+echo "-- swing without artifact (K=0)"
+MOT_START=10 MOT_END=30 "$BUILD/run_hr" $CLEAN | tee "$BUILD/hr_mc.txt"
+same_as "canceller without artifact vs clean" "$BUILD/hr_fixed.txt" \
+   'g["bpm"] - f["bpm"] <= 1 && f["bpm"] - g["bpm"] <= 1 && g["sdrr"] - f["sdrr"] <= 3 && f["sdrr"] - g["sdrr"] <= 3' \
+   < "$BUILD/hr_mc.txt"
+
+echo "== LED coupling: clean recordings at 1/4 and 2.5x the recorded level (MOCK_GAIN)"
+CLEAN="$CSV/Perfekt.csv $CSV/RuhePuls.csv $CSV/ShortPerfect.csv"
+for gain in 0.25 2.5; do
+   echo "-- gain $gain: AGC, then PPG_LED_AGC=0"
+   MOCK_GAIN=$gain "$BUILD/run_hr" $CLEAN | tee "$BUILD/hr_gain.txt"
+   same_as "AGC at gain $gain vs recorded level" "$BUILD/hr_fixed.txt" \
+      'g["bpm"] == f["bpm"] && g["sdrr"] - f["sdrr"] <= 2 && f["sdrr"] - g["sdrr"] <= 2' < "$BUILD/hr_gain.txt"
+   MOCK_GAIN=$gain "$BUILD/run_hr_noagc" $CLEAN | tee "$BUILD/hr_gain.txt"
+   expect "fixed LED current fails at gain $gain" '!f["valid"]' < "$BUILD/hr_gain.txt"
+done
+
+echo "== SpO2: synthetic Red channel of known R (MOCK_R)"
+for rs in 0.5:99 0.6:97 1.0:80; do
+   echo "-- R ${rs%:*}, curve ${rs#*:} %"
+   SPO2=1 MOCK_R=${rs%:*} "$BUILD/run_hr" "$CSV/Perfekt.csv" "$CSV/RuhePuls.csv" | tee "$BUILD/hr_spo2.txt"
+   expect "SpO2 at R ${rs%:*}" "f[\"valid\"] && f[\"spo2\"] - ${rs#*:} <= 1 && ${rs#*:} - f[\"spo2\"] <= 1" \
+      < "$BUILD/hr_spo2.txt"
+done
+
+if ! python3 -c "import numpy, scipy, pandas" 2>/dev/null; then
+   echo "python3 with numpy/scipy/pandas not found, reference comparisons skipped"
+   exit 0
+fi
+cd "$HERE"
+echo "== reference (hrv_analysis.ipynb: filtfilt + find_peaks)"
+python3 ref_hr.py "$CSV"/*.csv
+# Clean recordings: 70 % of the beats within 60 ms of the reference, all
+# within 120 ms (the causal filter reshapes pulses); the rest report only
+for f in "$CSV"/*.csv; do
+   DUMP="$BUILD/beats.txt" "$BUILD/run_hr" "$f" >/dev/null
+   case $(basename "$f") in
+   Perfekt.csv | RuhePuls.csv | ShortPerfect.csv) python3 beats_cmp.py "$f" "$BUILD/beats.txt" 0.7 ;;
+   *) python3 beats_cmp.py "$f" "$BUILD/beats.txt" ;;
+   esac
+done
+echo "== filtfilt vs scipy sosfiltfilt"
+python3 filtfilt_cmp.py "$BUILD/filtfilt" "$CSV"/*.csv
+python3 filtfilt_cmp.py "$BUILD/filtfilt_float" "$CSV"/*.csv
+echo "== detectPeaks vs scipy find_peaks"
+python3 peaks_cmp.py "$BUILD/peaks" "$BUILD" "$CSV"/*.csv
+python3 peaks_cmp.py "$BUILD/peaks_float" "$BUILD" "$CSV"/*.csv
+echo "== LF/HF vs scipy lombscargle"
+"$BUILD/tachogram" "$BUILD" "$CSV"/*.csv
+python3 lomb_cmp.py "$BUILD"
+echo "== signal quality: motion spliced into clean recordings (12-24 s)"
+for clean in Perfekt RuhePuls; do
+   for motion in WalkingSwing Faust DruckUnterschied; do
+      python3 splice.py "$CSV/$clean.csv" "$CSV/$motion.csv" 12 24 "$BUILD/${clean}+${motion}.csv"
+   done
+done
+"$BUILD/run_hr" "$CSV/Perfekt.csv" "$CSV/RuhePuls.csv" "$BUILD"/*+*.csv | tee "$BUILD/hr_splice.txt"
+echo "-- the same with HR_SIGNAL_QUALITY=0 (whole session)"
+"$BUILD/run_hr_nosqi" "$BUILD"/*+*.csv | tee "$BUILD/hr_splice_nosqi.txt"
+# Good windows keep SDRR near the clean 79/93 ms, below the whole session's
+expect "SQI selection on spliced motion" 'f["valid"] && !f["nohrv"] && f["sdrr"] >= 70 && f["sdrr"] <= 100' \
+   < "$BUILD/hr_splice.txt"
+same_as "SQI selection vs whole session" "$BUILD/hr_splice.txt" 'f["sdrr"] < g["sdrr"]' \
+   < "$BUILD/hr_splice_nosqi.txt"
@@ -0,0 +1,39 @@
+// measureHeartRate() on recorded traces: one line of HRVResult per file.
+// SPO2=1 runs the two-LED mode, DUMP=<file> writes the tachogram
+// (beat time, interval in µs) of the last file, VERBOSE=1 shows the log.
+#include "Sensors.h"
+#include <vector>
+
+void mockLoadCsv(const char *path);
+void mockStart();
+extern std::vector<double> g_tMs;
+
+int main(int argc, char **argv)
+{
+   g_quiet = getenv("VERBOSE") == nullptr;
+   initHeartRateSensor();
+   initIMU();
+   for (int i = 1; i < argc; i++)
+   {
+      mockLoadCsv(argv[i]);
+      uint32_t dur = (uint32_t)g_tMs.back();
+      if (dur > 60000)
+         dur = 60000;
+      mockStart();
+      uint64_t t0 = g_virtualUs;
+      HRVResult r = measureHeartRate(dur, getenv("SPO2") ? PPG_MODE_SPO2 : PPG_MODE_IR_ONLY);
+      if (getenv("DUMP"))
+      {
+         FILE *f = fopen(getenv("DUMP"), "w");
+         for (int k = 0; k < hrvTachogram.count(); k++)
+            fprintf(f, "%u %u\n", hrvTachogram.beatTimeUs(k) - (uint32_t)t0, hrvTachogram.intervalUs(k));
+         fclose(f);
+      }
+      const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+      printf("%-22s bpm=%3d sdrr=%3d rmssd=%3d pnn50=%2d sd1=%3d sd2=%3d corr=%d rej=%d lf=%lu hf=%lu "
+             "lf/hf=%u resp=%d mot=%d sqi=%d spo2=%d led=%u valid=%d nohrv=%d (%.1f s)\n",
+             name, r.bpm, r.sdrr_ms, r.rmssd_ms, r.pnn50_pct, r.sd1_ms, r.sd2_ms, r.correctedBeats, r.rejectedBeats,
+             (unsigned long)r.lf_ms2, (unsigned long)r.hf_ms2, r.lf_hf_x100, r.resp_brpm, r.motion_pct, r.sqi_pct,
+             r.spo2_pct, r.led_ua, r.valid, r.hrvPoorSignal, (g_virtualUs - t0) / 1e6);
+   }
+}
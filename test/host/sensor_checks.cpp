@@ -0,0 +1,157 @@
+// Unit checks of Sensors.h helpers that need no recording.
+#include "Sensors.h"
+#include <vector>
+
+void mockStart();
+extern std::vector<double> g_tMs, g_ir;
+extern double g_adcRateHz;
+
+static int failures = 0;
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); failures++; } } while (0)
+
+// Average LED current over the whole amplitude range, both LED modes
+static void checkLedAverage()
+{
+   const uint8_t amps[] = {AGC_MIN_AMPLITUDE, PPG_LED_AMPLITUDE, 0x80, 0x91, AGC_MAX_AMPLITUDE};
+   for (uint8_t amp : amps)
+   {
+      ppgLedAmplitude[PPG_LED_IR] = ppgLedAmplitude[PPG_LED_RED] = amp;
+      for (uint8_t ch = 1; ch <= 2; ch++)
+      {
+         double want = (double)ch * amp * AGC_UA_PER_STEP * PPG_ADC_RATE_HZ * PPG_PULSE_WIDTH_US / 1e6;
+         CHECK(ledCurrentUa(ch) == (uint32_t)ch * amp * AGC_UA_PER_STEP);
+         CHECK(ledAverageUa(ch) == (uint32_t)want);
+      }
+   }
+   // 51 mA per LED at full amplitude: 8.4 mA average on IR, 16.8 mA with Red
+   ppgLedAmplitude[PPG_LED_IR] = ppgLedAmplitude[PPG_LED_RED] = AGC_MAX_AMPLITUDE;
+   printf("LED average at full amplitude: %lu uA (IR), %lu uA (Red + IR)\n",
+          (unsigned long)ledAverageUa(1), (unsigned long)ledAverageUa(2));
+}
+
+// Spectral fallback on a session without usable peaks: HR from the spectrum,
+// HRV cleared, everything else of the session kept
+static void checkSpectralFallback()
+{
+   spectralHR.reset();
+   for (uint32_t i = 0; i < 30 * FILTER_FS; i++)
+      spectralHR.push(dspFromCounts((int32_t)(200 * sin(2 * M_PI * 1.2 * i / FILTER_FS))));
+   HRVResult r = {};
+   r.sdrr_ms = 250;
+   r.rmssd_ms = 300;
+   r.lf_ms2 = 5000;
+   r.led_ua = 6200;
+   r.sqi_pct = 40;
+   r.motion_pct = 25;
+   r.correctedBeats = 3;
+   r.durationMs = 30000;
+   applySpectralHR(r, (float)FILTER_FS);
+#if HR_SPECTRAL_FALLBACK
+   CHECK(r.valid && r.spectralFallback);
+   CHECK(r.bpm >= 71 && r.bpm <= 73);
+   CHECK(r.sdrr_ms == 0 && r.rmssd_ms == 0 && r.lf_ms2 == 0);
+   CHECK(r.led_ua == 6200 && r.sqi_pct == 40 && r.motion_pct == 25);
+   CHECK(r.correctedBeats == 3 && r.durationMs == 30000);
+#endif
+}
+
+// More local maxima than PEAK_MAX_COUNT: the excess is reported, not lost silently
+static void checkPeakOverflow()
+{
+   const int n = 4 * PEAK_MAX_COUNT;
+   dsp_sample_t *x = (dsp_sample_t *)malloc(n * sizeof(dsp_sample_t));
+   int *peaks = (int *)malloc(PEAK_MAX_COUNT * sizeof(int));
+   for (int i = 0; i < n; i++)
+      x[i] = dspFromCounts(i % 2 ? 100 + i % 7 : 0);
+   int found = detectPeaks(x, n, 1, 0, peaks, PEAK_MAX_COUNT);
+   CHECK(peaksDropped == n / 2 - 1 - PEAK_MAX_COUNT);
+   CHECK(found == PEAK_MAX_COUNT);
+   CHECK(peaks[0] == 1 && peaks[found - 1] == 2 * PEAK_MAX_COUNT - 1);
+   // Distance suppression keeps the tallest of each group (heights 100..106)
+   found = detectPeaks(x, PEAK_MAX_COUNT, 4, 0, peaks, PEAK_MAX_COUNT);
+   CHECK(peaksDropped == 0);
+   for (int k = 1; k < found; k++)
+      CHECK(peaks[k] - peaks[k - 1] >= 4);
+   x[7] = x[9] = dspFromCounts(200);
+   found = detectPeaks(x, 16, 4, 0, peaks, PEAK_MAX_COUNT);
+   // Equal heights 7 and 9: the later one wins, as in the reference comparison
+   CHECK(found == 4 && peaks[0] == 1 && peaks[1] == 5 && peaks[2] == 9 && peaks[3] == 13);
+   free(peaks);
+   free(x);
+}
+
+// FIFO edge cases on the simulated MAX30102 (flat trace, 100 Hz, no averaging)
+static void checkFifoDrain()
+{
+   g_tMs = {0, 1e7};
+   g_ir = {50000, 50000};
+   g_adcRateHz = 100;
+   mockStart();
+   setPPGMode(PPG_MODE_IR_ONLY);
+   PPGSample burst[MAX30102_FIFO_DEPTH];
+
+   // Exactly 32 samples and no overflow yet: WR_PTR == RD_PTR, but full
+   ppgFifo.begin(100, 1);
+   delay(320);
+   CHECK(ppgFifo.drain(burst, MAX30102_FIFO_DEPTH) == MAX30102_FIFO_DEPTH);
+   CHECK(ppgFifo.droppedSamples() == 0);
+   // ...and right after, empty
+   CHECK(ppgFifo.drain(burst, MAX30102_FIFO_DEPTH) == 0);
+
+   // A short read leaves samples behind; their timestamps still continue
+   ppgFifo.begin(100, 1);
+   delay(200);
+   PPGSample rest[MAX30102_FIFO_DEPTH];
+   CHECK(ppgFifo.drain(burst, 8) == 8);
+   delay(5);
+   uint32_t nowUs = micros();
+   uint8_t n = ppgFifo.drain(rest, MAX30102_FIFO_DEPTH);
+   CHECK(n == 12);
+   // The newest sample is recent, not 12 periods old
+   CHECK(n > 0 && (int32_t)(nowUs - rest[n - 1].timeUs) > -5000 &&
+         (int32_t)(nowUs - rest[n - 1].timeUs) < 20000);
+   CHECK(n > 0 && (int32_t)(rest[0].timeUs - burst[7].timeUs - 10000) > -200 &&
+         (int32_t)(rest[0].timeUs - burst[7].timeUs - 10000) < 200);
+   CHECK(n > 0 && (int32_t)(rest[n - 1].timeUs - rest[0].timeUs - (n - 1) * 10000) > -200 &&
+         (int32_t)(rest[n - 1].timeUs - rest[0].timeUs - (n - 1) * 10000) < 200);
+
+   // A stalled sensor (mode or LED change) leaves the pointers equal too:
+   // 10 periods later that is empty, not 32 stale samples
+   g_adcRateHz = 1e-3;
+   ppgFifo.begin(100, 1);
+   delay(100);
+   CHECK(ppgFifo.drain(burst, MAX30102_FIFO_DEPTH) == 0);
+   g_adcRateHz = 100;
+}
+
+// Fixed memory of the streaming pipeline, per stage (the README table)
+static void printFootprint()
+{
+#define FOOTPRINT(x) printf("  %-34s %5u B\n", #x, (unsigned)sizeof(x)), total += sizeof(x)
+   size_t total = 0;
+   printf("streaming memory:\n");
+   FOOTPRINT(StreamingHRPipeline);
+   FOOTPRINT(PPGSample[MAX30102_FIFO_DEPTH]);
+   FOOTPRINT(AccelSample[MAX30102_FIFO_DEPTH]);
+   FOOTPRINT(hrvTachogram);
+   FOOTPRINT(spectralHR);
+   FOOTPRINT(signalQuality);
+   FOOTPRINT(motionCanceller);
+   FOOTPRINT(accelAligner);
+   FOOTPRINT(spo2Estimator);
+   FOOTPRINT(respiration);
+   printf("  %-34s %5u B\n", "total", (unsigned)total);
+#undef FOOTPRINT
+}
+
+int main()
+{
+   g_quiet = true;
+   checkLedAverage();
+   checkSpectralFallback();
+   checkPeakOverflow();
+   checkFifoDrain();
+   printFootprint();
+   printf("sensor checks: %d failed\n", failures);
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,17 @@
+# Splices [start, end) seconds of a motion recording into a clean one, level
+# matched at the joins, for the signal-quality runs.
+# usage: python3 splice.py <clean.csv> <motion.csv> <start-s> <end-s> <out.csv>
+import sys
+import numpy as np
+import pandas as pd
+
+clean, motion = pd.read_csv(sys.argv[1]), pd.read_csv(sys.argv[2])
+t0, t1 = float(sys.argv[3]) * 1000, float(sys.argv[4]) * 1000
+tc = clean.timestamp_ms.values - clean.timestamp_ms.values[0]
+tm = motion.timestamp_ms.values - motion.timestamp_ms.values[0]
+m = (tc >= t0) & (tc < t1)
+seg = np.interp(tc[m] - t0, tm, motion.ir_value.values.astype(float))
+seg += clean.ir_value.values[m][:50].mean() - seg[:50].mean()
+out = clean.copy()
+out.loc[m, 'ir_value'] = seg
+out.to_csv(sys.argv[5], index=False, float_format='%.6f')
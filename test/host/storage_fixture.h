@@ -0,0 +1,61 @@
+// Shared by the TieredHRStorage host tests: CHECK, a comparable snapshot of
+// every tier, and boots of a fresh instance as after a power cycle or wake.
+#ifndef STORAGE_FIXTURE_H
+#define STORAGE_FIXTURE_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <vector>
+#include "DataStorage.h"
+
+static int failures = 0;
+#define CHECK(c)                              \
+   do                                         \
+   {                                          \
+      if (!(c))                               \
+      {                                       \
+         printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); \
+         failures++;                          \
+      }                                       \
+   } while (0)
+
+typedef std::vector<uint8_t> Dump;
+
+// All tiers as read through the public API: HR and HRV with their counts,
+// respiration, and the T1 sleep flags
+static Dump dump(TieredHRStorage &storage)
+{
+   static uint8_t buf[400];
+   Dump d;
+   for (uint8_t tier = 1; tier <= 3; tier++)
+   {
+      for (uint8_t isHRV = 0; isHRV < 2; isHRV++)
+      {
+         uint16_t n = storage.getAll(tier, isHRV, buf);
+         d.push_back(n & 0xFF);
+         d.push_back(n >> 8);
+         d.insert(d.end(), buf, buf + n);
+         n = storage.getLastNResp(tier, buf, sizeof(buf));
+         d.insert(d.end(), buf, buf + n);
+      }
+   }
+   uint16_t n = storage.getLastNSleep(buf, sizeof(buf));
+   d.insert(d.end(), buf, buf + n);
+   return d;
+}
+
+// RTC memory is lost and the next boot is a cold one
+static void powerCycle()
+{
+   memset(&histT1, 0xA5, sizeof(histT1));
+   g_wake = ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+static TieredHRStorage *boot(LogFlash *flash)
+{
+   TieredHRStorage *storage = new TieredHRStorage();
+   storage->begin(flash);
+   return storage;
+}
+
+#endif
@@ -0,0 +1,359 @@
+// TieredHRStorage on map-backed NVS and RAM log flash: flash traffic per
+// sample, power cuts after every possible write count (NVS items, log
+// writes and erases), wear over many laps of a small log, and migration
+// from the NVS-only layout (data/old_*.bin, see oldgen.cpp).
+// usage: storage_test <data-dir>
+#include "storage_fixture.h"
+#include <stdlib.h>
+#include <map>
+#include <string>
+
+// RAM flash sharing the NVS power-cut counter; a cut write is torn
+class TestFlash : public RamLogFlash
+{
+public:
+   int reads = 0;
+   int writes = 0;
+
+   explicit TestFlash(uint32_t sectors) : RamLogFlash(sectors) {}
+
+   bool read(uint32_t addr, void *buf, uint32_t len) override
+   {
+      reads++;
+      return RamLogFlash::read(addr, buf, len);
+   }
+
+   bool write(uint32_t addr, const void *buf, uint32_t len) override
+   {
+      writes++;
+      if (!nvsWrite())
+      {
+         RamLogFlash::write(addr, buf, len / 2);
+         return false;
+      }
+      return RamLogFlash::write(addr, buf, len);
+   }
+
+   bool eraseSector(uint32_t addr) override
+   {
+      if (!nvsWrite())
+      {
+         // Cut mid-erase: half the sector scrambled
+         uint8_t zeros[LOG_SECTOR_SIZE / 2];
+         memset(zeros, 0, sizeof(zeros));
+         RamLogFlash::write(addr, zeros, sizeof(zeros));
+         return false;
+      }
+      return RamLogFlash::eraseSector(addr);
+   }
+};
+
+static TestFlash *flash;
+static int sampleNo = 0;
+
+// One measurement as the firmware stores it: add, then persist
+static void sample(TieredHRStorage *s)
+{
+   int i = sampleNo++;
+   s->addSample(50 + i % 40, i % 3 ? 30 + i % 20 : 0, 12 + i % 5, i % 17 < 8);
+   s->persist();
+}
+
+static Dump readFile(const std::string &path)
+{
+   Dump d;
+   FILE *f = fopen(path.c_str(), "rb");
+   if (f == nullptr)
+   {
+      printf("cannot open %s\n", path.c_str());
+      return d;
+   }
+   int c;
+   while ((c = fgetc(f)) != EOF)
+      d.push_back(c);
+   fclose(f);
+   return d;
+}
+
+// NVS snapshot written by oldgen: (key length, key, value length, value)*
+static void loadNvs(const std::string &path)
+{
+   g_nvs.clear();
+   Dump d = readFile(path);
+   size_t o = 0;
+   while (o + 4 <= d.size())
+   {
+      uint32_t keyLen, valueLen;
+      memcpy(&keyLen, &d[o], 4);
+      o += 4;
+      std::string key((const char *)&d[o], keyLen);
+      o += keyLen;
+      memcpy(&valueLen, &d[o], 4);
+      o += 4;
+      g_nvs[key] = Dump(d.begin() + o, d.begin() + o + valueLen);
+      o += valueLen;
+   }
+}
+
+// NVS keys of the old layout still present (T2/T3 chunks and "hckpt" belong
+// to the new one)
+static int oldKeysLeft(bool print)
+{
+   int left = 0;
+   for (auto &kv : g_nvs)
+   {
+      if (kv.first == "hckpt" || kv.first.find("30m.") != std::string::npos ||
+          kv.first.find("2h.") != std::string::npos)
+         continue;
+      left++;
+      if (print)
+         printf("  left key %s\n", kv.first.c_str());
+   }
+   return left;
+}
+
+// Whole device state: NVS, log flash, RTC memory and the sample counter
+struct Snap
+{
+   std::map<std::string, Dump> nvs;
+   Dump flash;
+   HistT1 rtc;
+   int sampleNo;
+};
+
+static Snap snap()
+{
+   Snap s;
+   s.nvs = g_nvs;
+   s.flash.resize(flash->size());
+   flash->RamLogFlash::read(0, s.flash.data(), flash->size());
+   s.rtc = histT1;
+   s.sampleNo = sampleNo;
+   return s;
+}
+
+static void restore(const Snap &s)
+{
+   g_nvs = s.nvs;
+   for (uint32_t a = 0; a < flash->size(); a += LOG_SECTOR_SIZE)
+   {
+      flash->RamLogFlash::eraseSector(a);
+      flash->RamLogFlash::write(a, &s.flash[a], LOG_SECTOR_SIZE);
+   }
+   histT1 = s.rtc;
+   sampleNo = s.sampleNo;
+}
+
+// Timer wakes with one sample each: flash traffic, RTC reuse
+static Dump checkTimerWakes()
+{
+   TieredHRStorage *s = boot(flash);
+   delete s;
+   uint32_t bytes = 0;
+   int commits = 0, wakeReads = 0, mismatches = 0;
+   Dump prev;
+   for (int i = 0; i < 2000; i++)
+   {
+      g_wake = ESP_SLEEP_WAKEUP_TIMER;
+      flash->reads = 0;
+      s = boot(flash);
+      if (i && dump(*s) != prev)
+         mismatches++;
+      wakeReads += flash->reads;
+      int c0 = g_nvsCommits;
+      sample(s);
+      bytes += s->getBytesWritten();
+      commits += g_nvsCommits - c0;
+      prev = dump(*s);
+      delete s;
+   }
+   printf("2000 samples: %u B (%.1f B/sample), %.3f commits/sample, %.1f flash reads per timer wake, %d wake mismatches\n",
+          bytes, bytes / 2000.0, commits / 2000.0, wakeReads / 2000.0, mismatches);
+   CHECK(mismatches == 0);
+   return prev;
+}
+
+// Power cut after k writes (NVS items, flash writes, erases), across
+// promotions and a sector switch. After the reboot the tiers must be the
+// state before or after the sample and carry on consistently.
+static void checkPowerCuts()
+{
+   int bad = 0, pre = 0, post = 0;
+   for (int i = 0; i < 60; i++)
+   {
+      g_wake = ESP_SLEEP_WAKEUP_TIMER;
+      Snap before = snap();
+      TieredHRStorage *s = boot(flash);
+      Dump a = dump(*s);
+      sample(s);
+      Dump b = dump(*s);
+      delete s;
+
+      // Writes one sample takes
+      restore(before);
+      g_nvsWritesLeft = 1000;
+      s = boot(flash);
+      sample(s);
+      delete s;
+      int used = 1000 - g_nvsWritesLeft;
+      g_nvsWritesLeft = -1;
+
+      for (int k = 0; k < used; k++)
+      {
+         restore(before);
+         g_wake = ESP_SLEEP_WAKEUP_TIMER;
+         s = boot(flash);
+         g_nvsWritesLeft = k;
+         sample(s);
+         g_nvsWritesLeft = -1;
+         delete s;
+
+         powerCycle();
+         s = boot(flash);
+         Dump r = dump(*s);
+         delete s;
+         if (r == a)
+            pre++;
+         else if (r == b)
+            post++;
+         else if (++bad < 6)
+            printf("bad i=%d k=%d\n", i, k);
+
+         // Continues consistently, over a wake and a power cycle
+         g_wake = ESP_SLEEP_WAKEUP_TIMER;
+         s = boot(flash);
+         sample(s);
+         Dump r2 = dump(*s);
+         delete s;
+         s = boot(flash);
+         if (dump(*s) != r2)
+            bad++;
+         delete s;
+         powerCycle();
+         s = boot(flash);
+         if (dump(*s) != r2 && ++bad < 6)
+            printf("bad after cycle i=%d k=%d\n", i, k);
+         delete s;
+      }
+
+      restore(before);
+      g_wake = ESP_SLEEP_WAKEUP_TIMER;
+      s = boot(flash);
+      sample(s);
+      delete s;
+      sampleNo = before.sampleNo + 1;
+      // Move next to a sector boundary once
+      if (i == 30)
+      {
+         s = boot(flash);
+         while (sampleNo % LOG_RECORDS_PER_SECTOR != LOG_RECORDS_PER_SECTOR - 5)
+            sample(s);
+         delete s;
+      }
+   }
+   printf("power cuts: %d pre, %d post, %d inconsistent\n", pre, post, bad);
+   CHECK(bad == 0);
+}
+
+// 8-sector log, 20000 samples: erase counts stay level
+static void checkWear()
+{
+   delete flash;
+   flash = new TestFlash(8);
+   g_nvs.clear();
+   powerCycle();
+   sampleNo = 0;
+   TieredHRStorage *s = boot(flash);
+   for (int i = 0; i < 20000; i++)
+      sample(s);
+   Dump w = dump(*s);
+   delete s;
+
+   uint32_t lo = ~0u, hi = 0;
+   for (uint32_t k = 0; k < 8; k++)
+   {
+      LogSectorHeader h;
+      flash->RamLogFlash::read(k * LOG_SECTOR_SIZE, &h, sizeof(h));
+      if (h.eraseCount < lo)
+         lo = h.eraseCount;
+      if (h.eraseCount > hi)
+         hi = h.eraseCount;
+   }
+   powerCycle();
+   flash->reads = 0;
+   s = boot(flash);
+   printf("wear: erase counts %u..%u, reload equal %d, %d reads\n", lo, hi, dump(*s) == w, flash->reads);
+   CHECK(dump(*s) == w && hi - lo <= 1);
+   delete s;
+}
+
+// Migration from the NVS-only layout, whole and cut at every write
+static void checkMigration(const std::string &data, const char *nvsFile, const char *dumpFile)
+{
+   delete flash;
+   flash = new TestFlash(64);
+   loadNvs(data + nvsFile);
+   powerCycle();
+   Dump want = readFile(data + dumpFile);
+   TieredHRStorage *s = boot(flash);
+   Dump got = dump(*s);
+   delete s;
+   int left = oldKeysLeft(true);
+   powerCycle();
+   s = boot(flash);
+   Dump again = dump(*s);
+   delete s;
+   printf("migration %s: equal %d, reload equal %d, keys left %d, nvs keys %zu\n",
+          nvsFile, got == want, again == want, left, g_nvs.size());
+   CHECK(got == want && again == want && left == 0);
+
+   int bad = 0;
+   for (int k = 0; k < 400; k++)
+   {
+      delete flash;
+      flash = new TestFlash(64);
+      loadNvs(data + nvsFile);
+      powerCycle();
+      g_nvsWritesLeft = k;
+      s = boot(flash);
+      delete s;
+      g_nvsWritesLeft = -1;
+      powerCycle();
+      s = boot(flash);
+      if (dump(*s) != want)
+         bad++;
+      delete s;
+      if (oldKeysLeft(false))
+         bad++;
+   }
+   printf("  cut migration: %d bad\n", bad);
+   CHECK(bad == 0);
+}
+
+int main(int argc, char **argv)
+{
+   std::string data = argc > 1 ? std::string(argv[1]) + "/" : "";
+   g_quiet = true;
+   flash = new TestFlash(64);
+   powerCycle();
+
+   Dump last = checkTimerWakes();
+   powerCycle();
+   flash->reads = 0;
+   TieredHRStorage *s = boot(flash);
+   printf("power cycle: %d flash reads, equals pre-cycle state %d\n", flash->reads, dump(*s) == last);
+   CHECK(dump(*s) == last);
+   delete s;
+   g_wake = ESP_SLEEP_WAKEUP_TIMER;
+   histT1.hr[5] ^= 1;
+   s = boot(flash);
+   printf("corrupt RTC: equals %d\n", dump(*s) == last);
+   CHECK(dump(*s) == last);
+   delete s;
+
+   checkPowerCuts();
+   checkWear();
+   checkMigration(data, "old_nvs.bin", "old_dump.bin");
+   checkMigration(data, "old_nvs100.bin", "old_dump100.bin");
+   return failures ? 1 : 0;
+}
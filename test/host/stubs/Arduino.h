@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+typedef uint8_t byte;
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+enum { D0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, A0 };
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define HIGH 1
+#define LOW 0
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+extern uint64_t g_virtualUs;
+extern bool g_quiet;
+inline uint32_t millis() { return (uint32_t)(g_virtualUs / 1000); }
+inline uint32_t micros() { return (uint32_t)g_virtualUs; }
+inline void delay(uint32_t ms) { g_virtualUs += (uint64_t)ms * 1000; }
+inline void delayMicroseconds(uint32_t us) { g_virtualUs += us; }
+inline void yield() {}
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return 0; }
+inline int digitalPinToInterrupt(int p) { return p; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline uint32_t analogReadMilliVolts(int) { return 1950; }
+struct HardwareSerial {
+  void begin(int) {}
+  int printf(const char *f, ...) { if (g_quiet) return 0; va_list a; va_start(a, f); int r = vprintf(f, a); va_end(a); return r; }
+  void println(const char *s = "") { if (!g_quiet) printf("%s\n", s); }
+  void println(int v) { if (!g_quiet) printf("%d\n", v); }
+  void print(const char *s) { if (!g_quiet) printf("%s", s); }
+  void print(int v) { if (!g_quiet) printf("%d", v); }
+  void flush() {}
+};
+extern HardwareSerial Serial;
+template <class T> T constrain(T x, T a, T b) { return x < a ? a : (x > b ? b : x); }
@@ -0,0 +1,2 @@
+#pragma once
+static const GFXfont FreeMonoBold12pt7b = {};
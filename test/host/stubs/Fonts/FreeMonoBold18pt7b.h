@@ -0,0 +1,2 @@
+#pragma once
+static const GFXfont FreeMonoBold18pt7b = {};
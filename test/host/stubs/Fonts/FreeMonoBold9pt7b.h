@@ -0,0 +1,2 @@
+#pragma once
+static const GFXfont FreeMonoBold9pt7b = {};
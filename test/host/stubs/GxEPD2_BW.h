@@ -0,0 +1,37 @@
+#pragma once
+#include <Arduino.h>
+#define GxEPD_BLACK 0
+#define GxEPD_WHITE 1
+struct GFXfont {};
+struct GxEPD2_154_D67 { static const int HEIGHT = 200; GxEPD2_154_D67(int, int, int, int) {} };
+template <class D, int H> struct GxEPD2_BW {
+  GxEPD2_BW(D) {}
+  void init(uint32_t, bool, int, bool) {}
+  void setRotation(int) {}
+  int16_t width() { return 200; }
+  int16_t height() { return 200; }
+  void setPartialWindow(int16_t, int16_t, int16_t, int16_t) {}
+  void setFullWindow() {}
+  void firstPage() {}
+  bool nextPage() { return false; }
+  void fillScreen(int) {}
+  void fillRect(int16_t, int16_t, int16_t, int16_t, int) {}
+  void drawRect(int16_t, int16_t, int16_t, int16_t, int) {}
+  void drawRoundRect(int16_t, int16_t, int16_t, int16_t, int16_t, int) {}
+  void drawCircle(int16_t, int16_t, int16_t, int) {}
+  void fillCircle(int16_t, int16_t, int16_t, int) {}
+  void drawLine(int16_t, int16_t, int16_t, int16_t, int) {}
+  void drawPixel(int16_t, int16_t, int) {}
+  void drawFastHLine(int16_t, int16_t, int16_t, int) {}
+  void drawFastVLine(int16_t, int16_t, int16_t, int) {}
+  void fillTriangle(int16_t, int16_t, int16_t, int16_t, int16_t, int16_t, int) {}
+  void setFont(const GFXfont *) {}
+  void setFont(int) {}
+  void setTextColor(int) {}
+  void setCursor(int16_t, int16_t) {}
+  void print(const char *) {}
+  void print(int) {}
+  void getTextBounds(const char *, int16_t, int16_t, int16_t *a, int16_t *b, uint16_t *c, uint16_t *d) { *a = *b = 0; *c = *d = 10; }
+  void hibernate() {}
+  void powerOff() {}
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+#define MAX30105_ADDRESS 0x57
+// Host mock: serves IR samples from a CSV trace against virtual time.
+class MAX30105 {
+public:
+  bool begin(TwoWire &w = Wire, uint32_t s = 100000, uint8_t a = MAX30105_ADDRESS) { return true; }
+  uint32_t getRed();
+  uint32_t getIR();
+  void shutDown() {}
+  void wakeUp() {}
+  void softReset() {}
+  void setLEDMode(uint8_t m) { extern uint8_t g_ledMode; g_ledMode = m; }
+  void setADCRange(uint8_t r) { extern uint8_t g_adcRange; g_adcRange = r; }
+  void setSampleRate(uint8_t) {}
+  void setPulseWidth(uint8_t) {}
+  void setPulseAmplitudeRed(uint8_t a) { extern uint8_t g_ampRed; g_ampRed = a; }
+  void setPulseAmplitudeIR(uint8_t a) { extern uint8_t g_ampIR; g_ampIR = a; }
+  void setPulseAmplitudeGreen(uint8_t) {}
+  void setPulseAmplitudeProximity(uint8_t) {}
+  void setProximityThreshold(uint8_t) {}
+  void enableSlot(uint8_t, uint8_t) {}
+  void disableSlots() {}
+  uint8_t getINT1() { return 0; }
+  uint8_t getINT2() { return 0; }
+  void enableAFULL() {}
+  void disableAFULL() {}
+  void enableDATARDY() {}
+  void disableDATARDY() {}
+  void enablePROXINT() {}
+  void disablePROXINT() {}
+  void setFIFOAverage(uint8_t) {}
+  void enableFIFORollover() {}
+  void disableFIFORollover() {}
+  void setFIFOAlmostFull(uint8_t) {}
+  uint16_t check() { return 0; }
+  uint8_t available() { return 0; }
+  void nextSample() {}
+  uint32_t getFIFORed() { return 0; }
+  uint32_t getFIFOIR() { return 0; }
+  uint8_t getWritePointer() { return 0; }
+  uint8_t getReadPointer() { return 0; }
+  void clearFIFO();
+  uint8_t readPartID() { return 0x15; }
+  void setup(byte powerLevel = 0x1F, byte sampleAverage = 4, byte ledMode = 3, int sampleRate = 400, int pulseWidth = 411, int adcRange = 4096) { extern int g_mockAvg; g_mockAvg = sampleAverage; }
+  uint8_t readRegister8(uint8_t address, uint8_t reg);
+  void writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <string.h>
+extern std::map<std::string, std::vector<uint8_t>> g_nvs;
+extern size_t g_nvsWrites;
+class Preferences {
+  template <class T> size_t put(const char *k, T v) { std::vector<uint8_t> b(sizeof v); memcpy(b.data(), &v, sizeof v); g_nvs[k] = b; g_nvsWrites++; return sizeof v; }
+  template <class T> T get(const char *k, T d) { auto it = g_nvs.find(k); if (it == g_nvs.end() || it->second.size() != sizeof d) return d; T v; memcpy(&v, it->second.data(), sizeof v); return v; }
+public:
+  bool begin(const char *, bool ro = false) { return true; }
+  void end() {}
+  size_t getBytes(const char *k, void *buf, size_t n) { auto it = g_nvs.find(k); if (it == g_nvs.end() || it->second.size() > n) return 0; memcpy(buf, it->second.data(), it->second.size()); return it->second.size(); }
+  size_t putBytes(const char *k, const void *buf, size_t n) { g_nvs[k] = std::vector<uint8_t>((const uint8_t*)buf, (const uint8_t*)buf + n); g_nvsWrites++; return n; }
+  uint16_t getUShort(const char *k, uint16_t d = 0) { return get(k, d); }
+  size_t putUShort(const char *k, uint16_t v) { return put(k, v); }
+  uint8_t getUChar(const char *k, uint8_t d = 0) { return get(k, d); }
+  size_t putUChar(const char *k, uint8_t v) { return put(k, v); }
+  uint32_t getUInt(const char *k, uint32_t d = 0) { return get(k, d); }
+  size_t putUInt(const char *k, uint32_t v) { return put(k, v); }
+  bool clear() { g_nvs.clear(); return true; }
+  bool remove(const char *k) { return g_nvs.erase(k) > 0; }
+  bool isKey(const char *k) { return g_nvs.count(k); }
+};
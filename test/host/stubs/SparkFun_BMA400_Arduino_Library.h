@@ -0,0 +1,42 @@
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+#define BMA400_OK 0
+#define BMA400_ODR_100HZ 0x08
+#define BMA400_ODR_200HZ 0x09
+#define BMA400_RANGE_4G 1
+#define BMA400_RANGE_16G 3
+#define BMA400_TAP_Z_AXIS_EN 1
+#define BMA400_TAP_SENSITIVITY_0 0
+#define BMA400_TICS_TH_18_DATA_SAMPLES 2
+#define BMA400_QUIET_60_DATA_SAMPLES 0
+#define BMA400_QUIET_DT_4_DATA_SAMPLES 0
+#define BMA400_AXIS_XYZ_EN 7
+#define BMA400_DATA_SRC_ACC_FILT1 0
+#define BMA400_INACTIVITY_INT 0
+#define BMA400_ALL_AXES_INT 1
+#define BMA400_UPDATE_EVERY_TIME 2
+#define BMA400_HYST_0_MG 0
+#define BMA400_INT_PUSH_PULL_ACTIVE_1 2
+#define BMA400_DOUBLE_TAP_INT_EN 0x1000
+#define BMA400_SINGLE_TAP_INT_EN 0x0800
+#define BMA400_GEN2_INT_EN 0x0008
+#define BMA400_MODE_NORMAL 2
+enum bma400_int_chan { BMA400_UNMAP_INT_PIN, BMA400_INT_CHANNEL_1, BMA400_INT_CHANNEL_2, BMA400_MAP_BOTH_INT_PINS };
+struct bma400_tap_conf { uint8_t axes_sel, sensitivity, tics_th, quiet, quiet_dt; bma400_int_chan int_chan; };
+struct bma400_gen_int_conf { uint8_t gen_int_thres, gen_int_dur, axes_sel, data_src, criterion_sel, evaluate_axes, ref_update, hysteresis; uint16_t int_thres_ref_x, int_thres_ref_y, int_thres_ref_z; bma400_int_chan int_chan; };
+struct BMA400_SensorData { float accelX, accelY, accelZ; uint32_t sensorTimeMillis; };
+class BMA400 {
+public:
+  BMA400_SensorData data;
+  int8_t beginI2C(uint8_t a = 0x14, TwoWire &w = Wire) { return 0; }
+  int8_t setMode(uint8_t) { return 0; }
+  int8_t setODR(uint8_t) { return 0; }
+  int8_t setRange(uint8_t) { return 0; }
+  int8_t setTapInterrupt(bma400_tap_conf *) { return 0; }
+  int8_t setGeneric2Interrupt(bma400_gen_int_conf *) { return 0; }
+  int8_t setInterruptPinMode(bma400_int_chan, uint8_t) { return 0; }
+  int8_t enableInterrupt(uint16_t, bool) { return 0; }
+  int8_t getInterruptStatus(uint16_t *s) { *s = 0; return 0; }
+  int8_t getSensorData(bool t = false);
+};
@@ -0,0 +1,16 @@
+#pragma once
+#include <Arduino.h>
+#define I2C_SPEED_FAST 400000
+#define I2C_BUFFER_LENGTH 128
+struct TwoWire {
+  void begin() {}
+  void setClock(uint32_t) {}
+  void beginTransmission(uint8_t a);
+  size_t write(uint8_t v);
+  uint8_t endTransmission(bool stop = true);
+  uint8_t requestFrom(uint8_t a, uint8_t n);
+  uint8_t requestFrom(int a, int n) { return requestFrom((uint8_t)a, (uint8_t)n); }
+  int available();
+  int read();
+};
+extern TwoWire Wire;
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+typedef enum { ESP_SLEEP_WAKEUP_UNDEFINED, ESP_SLEEP_WAKEUP_TIMER, ESP_SLEEP_WAKEUP_GPIO } esp_sleep_wakeup_cause_t;
+extern esp_sleep_wakeup_cause_t g_wake; // set by the test before begin()
+inline esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return g_wake; }
+inline void esp_sleep_enable_timer_wakeup(uint64_t) {}
+inline void esp_deep_sleep_start() {}
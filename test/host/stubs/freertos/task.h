@@ -0,0 +1,9 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void *TaskHandle_t;
+inline BaseType_t xTaskCreate(void (*)(void *), const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *h) { *h = (void *)1; return pdPASS; }
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskDelay(TickType_t t) { delay(t); }
+inline TickType_t xTaskGetTickCount() { return millis(); }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+typedef int esp_err_t;
+typedef uint32_t nvs_handle_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+extern std::map<std::string, std::vector<uint8_t>> g_nvs;
+extern int g_nvsWritesLeft; // -1: unlimited; writes beyond fail (power loss)
+extern int g_nvsCommits;
+extern int g_nvsT1Reads;
+inline bool nvsWrite() { if (g_nvsWritesLeft == 0) return false; if (g_nvsWritesLeft > 0) g_nvsWritesLeft--; return true; }
+inline esp_err_t nvs_open(const char *, nvs_open_mode_t, nvs_handle_t *h) { *h = 1; return ESP_OK; }
+inline esp_err_t nvs_get_blob(nvs_handle_t, const char *k, void *b, size_t *n) { if (strstr(k, "5m.")) g_nvsT1Reads++; auto it = g_nvs.find(k); if (it == g_nvs.end()) return ESP_FAIL; if (it->second.size() > *n) return ESP_FAIL; memcpy(b, it->second.data(), it->second.size()); *n = it->second.size(); return ESP_OK; }
+inline esp_err_t nvs_set_blob(nvs_handle_t, const char *k, const void *b, size_t n) { if (!nvsWrite()) return ESP_FAIL; g_nvs[k] = std::vector<uint8_t>((const uint8_t *)b, (const uint8_t *)b + n); return ESP_OK; }
+template <class T> esp_err_t nvsGet(const char *k, T *v) { auto it = g_nvs.find(k); if (it == g_nvs.end() || it->second.size() != sizeof(T)) return ESP_FAIL; memcpy(v, it->second.data(), sizeof(T)); return ESP_OK; }
+inline esp_err_t nvs_get_u8(nvs_handle_t, const char *k, uint8_t *v) { return nvsGet(k, v); }
+inline esp_err_t nvs_get_u16(nvs_handle_t, const char *k, uint16_t *v) { return nvsGet(k, v); }
+inline esp_err_t nvs_erase_key(nvs_handle_t, const char *k) { if (!nvsWrite()) return ESP_FAIL; g_nvs.erase(k); return ESP_OK; }
+inline esp_err_t nvs_commit(nvs_handle_t) { g_nvsCommits++; return ESP_OK; }
@@ -0,0 +1,31 @@
+// RR tachogram and LF/HF of measureHeartRate() per trace, for lomb_cmp.py.
+// usage: tachogram <out-dir> <csv>...  writes <out-dir>/tach_<name>
+#include "Sensors.h"
+#include <string>
+#include <vector>
+
+void mockLoadCsv(const char *path);
+void mockStart();
+extern std::vector<double> g_tMs;
+
+int main(int argc, char **argv)
+{
+   g_quiet = getenv("VERBOSE") == nullptr;
+   initHeartRateSensor();
+   for (int i = 2; i < argc; i++)
+   {
+      mockLoadCsv(argv[i]);
+      uint32_t dur = (uint32_t)g_tMs.back();
+      if (dur > 60000)
+         dur = 60000;
+      mockStart();
+      HRVResult r = measureHeartRate(dur);
+      std::string fn = std::string(argv[1]) + "/tach_" + (strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i]);
+      FILE *f = fopen(fn.c_str(), "w");
+      // LF, HF, and whether HRV was withheld (poor signal)
+      fprintf(f, "%lu %lu %d\n", (unsigned long)r.lf_ms2, (unsigned long)r.hf_ms2, r.hrvPoorSignal ? 1 : 0);
+      for (int k = 0; k < hrvTachogram.count(); k++)
+         fprintf(f, "%u %u\n", hrvTachogram.beatTimeUs(k), hrvTachogram.intervalUs(k));
+      fclose(f);
+   }
+}
@@ -0,0 +1,181 @@
+// Write-behind persistence: batched persist(), samples added between
+// preparePersist() and finishPersist(), and a writer, persister and
+// lock-free reader on three threads (torn tier reads are counted).
+#include "storage_fixture.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+static RamLogFlash *flash;
+
+// A 2-hour workout worth of samples at once, then one flush
+static TieredHRStorage *checkBatch(TieredHRStorage *s)
+{
+   int c0 = g_nvsCommits;
+   for (int i = 0; i < 60; i++)
+      s->addSample(60 + i % 50, 20 + i % 9, 14, 0);
+   printf("60 added: %d commits before persist\n", g_nvsCommits - c0);
+   CHECK(g_nvsCommits == c0);
+   bool ok = s->persist();
+   printf("persist ok %d, %d commits\n", ok, g_nvsCommits - c0);
+   Dump a = dump(*s);
+   delete s;
+   powerCycle();
+   s = boot(flash);
+   printf("reload equal %d\n", dump(*s) == a);
+   CHECK(ok && dump(*s) == a);
+   return s;
+}
+
+// Samples land between prepare and finish
+static TieredHRStorage *checkInterleaved(TieredHRStorage *s)
+{
+   int bad = 0;
+   for (int round = 0; round < 200; round++)
+   {
+      s->addSample(70 + round % 30, 25, 15, round & 1);
+      if (s->preparePersist())
+      {
+         for (int k = 0; k < round % 4; k++)
+            s->addSample(90 + k, 30, 16, 0);
+         bool ok = s->writePersist();
+         s->finishPersist(ok);
+      }
+      if (round % 7 == 0)
+      {
+         s->persist();
+         Dump b = dump(*s);
+         delete s;
+         powerCycle();
+         s = boot(flash);
+         if (dump(*s) != b)
+            bad++;
+      }
+   }
+   printf("interleaved: %d bad\n", bad);
+   CHECK(bad == 0);
+   return s;
+}
+
+// Timer wakes: RTC is used right after a flush, not with unflushed samples
+static TieredHRStorage *checkTimerWake(TieredHRStorage *s)
+{
+   s->persist();
+   delete s;
+   g_wake = ESP_SLEEP_WAKEUP_TIMER;
+   g_quiet = false;
+   s = boot(flash);
+   g_quiet = true;
+   s->addSample(111, 22, 13, 0);
+   Dump c = dump(*s);
+   delete s;
+   g_wake = ESP_SLEEP_WAKEUP_TIMER;
+   s = boot(flash);
+   printf("unflushed sample dropped on wake (log is the truth): %d\n", dump(*s) != c);
+   CHECK(dump(*s) != c);
+   return s;
+}
+
+// clear() while a job is out: the job's older samples still reach the log,
+// T1 starts after them and keeps the samples added since
+static TieredHRStorage *checkClearDuringPersist(TieredHRStorage *s)
+{
+   for (int i = 0; i < 30; i++)
+      s->addSample(80, 40, 15, 0);
+   s->persist();
+   for (int i = 0; i < 5; i++)
+      s->addSample(81, 41, 15, 0);
+   CHECK(s->preparePersist());
+   s->clear();
+   for (int i = 0; i < 3; i++)
+      s->addSample(100 + i, 50, 16, 1);
+   s->finishPersist(s->writePersist());
+   CHECK(s->persist());
+
+   uint8_t hr[400];
+   uint16_t n = s->getAll(1, false, hr);
+   CHECK(n == 3 && hr[0] == 100 && hr[2] == 102);
+   Dump a = dump(*s);
+   delete s;
+   powerCycle();
+   s = boot(flash);
+   n = s->getAll(1, false, hr);
+   printf("clear during persist: T1 %u after reboot, equal %d\n", n, dump(*s) == a);
+   CHECK(n == 3 && dump(*s) == a);
+   return s;
+}
+
+// Concurrent writer, persister and lock-free reader. The writer's samples
+// count up, so a torn T1 read shows as a break in the sequence.
+static void checkConcurrent(TieredHRStorage *s)
+{
+   std::mutex lock;
+   std::atomic<bool> done{false};
+   std::atomic<long> reads{0}, torn{0};
+
+   std::thread writer([&]
+   {
+      for (int i = 0; i < 3000000; i++)
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         s->addSample(1 + i % 250, 1 + i % 250, 1, 0);
+      }
+      done = true;
+   });
+   std::thread persister([&]
+   {
+      while (!done)
+      {
+         bool pending;
+         {
+            std::lock_guard<std::mutex> guard(lock);
+            pending = s->preparePersist();
+         }
+         if (!pending)
+            continue;
+         bool ok = s->writePersist();
+         std::lock_guard<std::mutex> guard(lock);
+         s->finishPersist(ok);
+      }
+   });
+   std::thread reader([&]
+   {
+      uint8_t hr[400], hrv[400];
+      while (!done)
+      {
+         uint16_t n = s->getLastN(1, false, hr, 288);
+         s->getLastN(1, true, hrv, 288);
+         reads++;
+         for (int i = 1; i < n; i++)
+         {
+            if (hr[i] != hr[i - 1] % 250 + 1)
+            {
+               torn++;
+               break;
+            }
+         }
+      }
+   });
+   writer.join();
+   persister.join();
+   reader.join();
+   printf("concurrent: %ld reads, %ld torn\n", (long)reads, (long)torn);
+   CHECK(torn == 0);
+}
+
+int main()
+{
+   g_quiet = true;
+   flash = new RamLogFlash(64);
+   powerCycle();
+   TieredHRStorage *s = boot(flash);
+   s = checkBatch(s);
+   s = checkInterleaved(s);
+   s = checkTimerWake(s);
+   s = checkClearDuringPersist(s);
+   delete s;
+   s = boot(flash);
+   checkConcurrent(s);
+   delete s;
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+#include <unity.h>
+#include "HistoryLog.h"
+
+/*
+ * HistoryLog on RAM flash: recovery after power cuts at every point the log
+ * writes (record, sector header) and across the wrap of the ring.
+ */
+
+// RAM flash whose next write can be torn: only the first tearBytes reach
+// the flash and the write reports failure, as a power cut would leave it.
+class TearFlash : public RamLogFlash
+{
+public:
+   int32_t tearBytes = -1;
+
+   explicit TearFlash(uint32_t sectors) : RamLogFlash(sectors) {}
+
+   bool write(uint32_t addr, const void *buf, uint32_t len) override
+   {
+      if (tearBytes < 0)
+         return RamLogFlash::write(addr, buf, len);
+      RamLogFlash::write(addr, buf, (uint32_t)tearBytes < len ? (uint32_t)tearBytes : len);
+      tearBytes = -1;
+      return false;
+   }
+};
+
+static bool appendSample(HistoryLog &log, uint32_t i)
+{
+   LogRecord r;
+   r.hr = 50 + i % 40;
+   r.hrv = 30 + i % 20;
+   r.resp = 12 + i % 5;
+   r.sleep = i % 17 < 8;
+   return log.append(r);
+}
+
+// Walk back from the tail; every record must be the one appended with its
+// seq and seqs must be consecutive. Returns the number of records.
+static uint32_t walkBack(HistoryLog &log, uint32_t newest)
+{
+   LogCursor c = log.tail();
+   LogRecord r;
+   uint32_t n = 0;
+   while (log.prev(c, r))
+   {
+      TEST_ASSERT_EQUAL_UINT32(newest - n, r.seq);
+      TEST_ASSERT_EQUAL_UINT8(50 + (r.seq - 1) % 40, r.hr);
+      TEST_ASSERT_EQUAL_UINT8(12 + (r.seq - 1) % 5, r.resp);
+      n++;
+   }
+   return n;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_flash()
+{
+   RamLogFlash flash(4);
+   HistoryLog log;
+   TEST_ASSERT_TRUE(log.begin(flash));
+   TEST_ASSERT_EQUAL_UINT32(0, log.lastSeq());
+   LogCursor c = log.tail();
+   LogRecord r;
+   TEST_ASSERT_FALSE(log.prev(c, r));
+}
+
+void test_too_small()
+{
+   RamLogFlash flash(1);
+   HistoryLog log;
+   TEST_ASSERT_FALSE(log.begin(flash));
+   TEST_ASSERT_FALSE(appendSample(log, 0));
+}
+
+void test_begin_finds_tail()
+{
+   RamLogFlash flash(4);
+   // Every fill level of a sector, including empty-after-header and full
+   const uint32_t counts[] = {1, 2, 254, 255, 256, 300, 509, 510, 511};
+   for (uint32_t n : counts)
+   {
+      for (uint32_t s = 0; s < 4; s++)
+         flash.eraseSector(s * LOG_SECTOR_SIZE);
+      HistoryLog log;
+      TEST_ASSERT_TRUE(log.begin(flash));
+      for (uint32_t i = 0; i < n; i++)
+         TEST_ASSERT_TRUE(appendSample(log, i));
+
+      HistoryLog again;
+      TEST_ASSERT_TRUE(again.begin(flash));
+      TEST_ASSERT_EQUAL_UINT32(n, again.lastSeq());
+      TEST_ASSERT_EQUAL_UINT32(n, walkBack(again, n));
+      TEST_ASSERT_TRUE(appendSample(again, n));
+      TEST_ASSERT_EQUAL_UINT32(n + 1, again.lastSeq());
+      // ...in the slot right after the old tail, leaving no gap
+      LogRecord r;
+      uint32_t sector = n / LOG_RECORDS_PER_SECTOR, slot = n % LOG_RECORDS_PER_SECTOR + 1;
+      flash.read(sector * LOG_SECTOR_SIZE + slot * LOG_RECORD_SIZE, &r, sizeof(r));
+      TEST_ASSERT_EQUAL_UINT32(n + 1, r.seq);
+      TEST_ASSERT_EQUAL_UINT32(n + 1, walkBack(again, n + 1));
+   }
+}
+
+void test_torn_record()
+{
+   // Tear at every byte of a record write
+   for (int32_t tear = 0; tear < LOG_RECORD_SIZE; tear++)
+   {
+      TearFlash flash(4);
+      HistoryLog log;
+      log.begin(flash);
+      for (uint32_t i = 0; i < 10; i++)
+         appendSample(log, i);
+      flash.tearBytes = tear;
+      TEST_ASSERT_FALSE(appendSample(log, 10));
+
+      // Reboot: the torn slot is skipped, seq continues after the last intact record
+      HistoryLog again;
+      TEST_ASSERT_TRUE(again.begin(flash));
+      TEST_ASSERT_EQUAL_UINT32(10, again.lastSeq());
+      TEST_ASSERT_EQUAL_UINT32(10, walkBack(again, 10));
+      TEST_ASSERT_TRUE(appendSample(again, 10));
+      TEST_ASSERT_EQUAL_UINT32(11, walkBack(again, 11));
+
+      // Without a reboot the writer carries on just as well
+      TEST_ASSERT_TRUE(appendSample(log, 10));
+      TEST_ASSERT_EQUAL_UINT32(11, log.lastSeq());
+   }
+}
+
+void test_torn_sector_header()
+{
+   for (int32_t tear = 0; tear < LOG_RECORD_SIZE; tear++)
+   {
+      TearFlash flash(4);
+      HistoryLog log;
+      log.begin(flash);
+      for (uint32_t i = 0; i < LOG_RECORDS_PER_SECTOR; i++)
+         appendSample(log, i);
+      // The next append opens sector 1; its header write is cut
+      flash.tearBytes = tear;
+      TEST_ASSERT_FALSE(appendSample(log, LOG_RECORDS_PER_SECTOR));
+
+      HistoryLog again;
+      TEST_ASSERT_TRUE(again.begin(flash));
+      TEST_ASSERT_EQUAL_UINT32(LOG_RECORDS_PER_SECTOR, again.lastSeq());
+      TEST_ASSERT_EQUAL_UINT32(LOG_RECORDS_PER_SECTOR, walkBack(again, LOG_RECORDS_PER_SECTOR));
+      // The half-written sector counts as free and is reopened
+      TEST_ASSERT_TRUE(appendSample(again, LOG_RECORDS_PER_SECTOR));
+      TEST_ASSERT_EQUAL_UINT32(LOG_RECORDS_PER_SECTOR + 1, walkBack(again, LOG_RECORDS_PER_SECTOR + 1));
+   }
+}
+
+void test_ring_wrap()
+{
+   const uint32_t sectors = 4;
+   RamLogFlash flash(sectors);
+   HistoryLog log;
+   log.begin(flash);
+   uint32_t n = 0;
+   for (uint32_t lap = 0; lap < 3; lap++)
+   {
+      for (uint32_t i = 0; i < sectors * LOG_RECORDS_PER_SECTOR; i++)
+         TEST_ASSERT_TRUE(appendSample(log, n++));
+      // Partial head sector, so the oldest sector is the one after it
+      for (uint32_t i = 0; i < 10 + lap; i++)
+         TEST_ASSERT_TRUE(appendSample(log, n++));
+
+      HistoryLog again;
+      TEST_ASSERT_TRUE(again.begin(flash));
+      TEST_ASSERT_EQUAL_UINT32(n, again.lastSeq());
+      // Head sector plus the full sectors behind it, back to the head again
+      TEST_ASSERT_EQUAL_UINT32((sectors - 1) * LOG_RECORDS_PER_SECTOR + (n - 1) % LOG_RECORDS_PER_SECTOR + 1,
+                               walkBack(again, n));
+   }
+   // Rotation wears every sector equally
+   uint32_t opened = (n + LOG_RECORDS_PER_SECTOR - 1) / LOG_RECORDS_PER_SECTOR;
+   TEST_ASSERT_EQUAL_UINT32((opened + sectors - 1) / sectors, log.maxEraseCount());
+}
+
+void test_erase_count_after_torn_header()
+{
+   TearFlash flash(2);
+   HistoryLog log;
+   log.begin(flash);
+   for (uint32_t i = 0; i < 6 * LOG_RECORDS_PER_SECTOR; i++)
+      appendSample(log, i);
+   TEST_ASSERT_EQUAL_UINT32(3, log.maxEraseCount());
+   // Sector 0 is erased for its 4th time, then the header write is cut
+   flash.tearBytes = 4;
+   TEST_ASSERT_FALSE(appendSample(log, 6 * LOG_RECORDS_PER_SECTOR));
+
+   HistoryLog again;
+   TEST_ASSERT_TRUE(again.begin(flash));
+   TEST_ASSERT_EQUAL_UINT32(3, again.maxEraseCount());
+   TEST_ASSERT_TRUE(appendSample(again, 6 * LOG_RECORDS_PER_SECTOR));
+   TEST_ASSERT_EQUAL_UINT32(4, again.maxEraseCount());
+
+   HistoryLog third;
+   TEST_ASSERT_TRUE(third.begin(flash));
+   TEST_ASSERT_EQUAL_UINT32(4, third.maxEraseCount());
+}
+
+int main()
+{
+   UNITY_BEGIN();
+   RUN_TEST(test_empty_flash);
+   RUN_TEST(test_too_small);
+   RUN_TEST(test_begin_finds_tail);
+   RUN_TEST(test_torn_record);
+   RUN_TEST(test_torn_sector_header);
+   RUN_TEST(test_ring_wrap);
+   RUN_TEST(test_erase_count_after_torn_header);
+   return UNITY_END();
+}